@@ -0,0 +1,839 @@
+/*
+ * bench.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+/* Runs synthetic depth frames through the whole gesture pipeline, as
+   fast as possible and without the Kinect nor the stage, and reports
+   the time spent in every stage. The frames only depend on the
+   arguments, so runs can be compared across changes.
+
+   Frames are rendered as the raw disparities the Kinect sends. They
+   are converted to millimetres as a whole, as the driver would do,
+   unless MSPT_DEPTH_DISPARITY is set, in which case the reduction
+   converts the pixels it keeps and only what needs every pixel in
+   millimetres gets the whole frame converted.
+
+   With MSPT_TRACKING_INTERVAL, only one frame of that many is tracked
+   while a skeleton is followed, the joints in the others being
+   predicted, as in the application.
+
+   The gestures are those of the application, or described in the
+   file at MSPT_GESTURES. Their evaluator is timed again on its own,
+   over the joints of the frames that had a head, as it takes too
+   little time per frame to be timed there.
+
+   The stages are timed in a single thread. The preprocessing the
+   capture threads do is then timed again on a few frames for every
+   number of worker threads up to the number of processors, or
+   MSPT_DEPTH_THREADS, to see how it scales. */
+
+#include <stdlib.h>
+#include <skeltrack.h>
+
+#include "depth-synth.h"
+#include "depth-filter.h"
+#include "depth-components.h"
+#include "depth-process.h"
+#include "depth-pyramid.h"
+#include "depth-mask.h"
+#include "depth-workers.h"
+#include "joint-filter.h"
+#include "salut.h"
+
+#define FRAME_WIDTH 640
+#define FRAME_HEIGHT 480
+
+#define THRESHOLD_BEGIN 500
+#define THRESHOLD_END 2000
+
+#define NOISE 5
+#define NOISE_SEED 1
+
+/* frames the preprocessing scaling is measured on, each of them
+   processed several times */
+#define SCALING_FRAMES 30
+#define SCALING_ROUNDS 4
+
+/* times the joints of the run go through the gestures to time them */
+#define GESTURE_ROUNDS 100
+
+/* one frame out of this many loses joints when checking how gestures
+   get over them dropping out: both elbows, or the right elbow and the
+   left hand, in turns */
+#define DROPOUT_INTERVAL 7
+
+typedef enum
+{
+  STAGE_RENDER,
+  STAGE_CONVERT,
+  STAGE_FILTER,
+  STAGE_MASK,
+  STAGE_REDUCE,
+  STAGE_ISOLATE,
+  STAGE_TRACK,
+  STAGE_PYRAMID,
+  STAGE_GESTURES,
+  STAGE_POSES,
+  N_STAGES
+} Stage;
+
+static const gchar *stage_names[N_STAGES] =
+{
+  "render",
+  "convert",
+  "filter",
+  "mask",
+  "reduce",
+  "isolate",
+  "track",
+  "pyramid",
+  "gestures",
+  "poses"
+};
+
+/* those looked for in the depth around the hands, rather than with a
+   gesture of the table */
+static const GestId hand_poses[] =
+{
+  HAND_EAST_COAST,
+  HAND_METAL,
+  HAND_INDIAN
+};
+
+static const gchar *hand_pose_names[] =
+{
+  "east coast",
+  "metal",
+  "indian"
+};
+
+typedef struct
+{
+  const guint16 *depth;
+  gboolean disparity;
+  DepthFilter *filter;
+  guint16 *converted;
+  guint64 *mask_bits;
+  guint16 *pyramid_buffer;
+} Preparation;
+
+/* the passes over the full resolution frame, as the capture runs them */
+static void
+prepare_tile (gint first, gint last, gpointer data)
+{
+  Preparation *preparation = (Preparation *) data;
+  const guint16 *depth = preparation->depth;
+  gint offset, length;
+
+  offset = first * FRAME_WIDTH;
+  length = (last - first) * FRAME_WIDTH;
+
+  if (! preparation->disparity)
+    {
+      depth_process_disparity_to_mm (depth + offset,
+                                     preparation->converted + offset,
+                                     length);
+      depth = preparation->converted;
+    }
+
+  if (preparation->filter != NULL)
+    {
+      depth_filter_process_pixels (preparation->filter, depth, offset, length);
+      depth = depth_filter_get_output (preparation->filter);
+    }
+
+  depth_mask_build_rows (preparation->mask_bits,
+                         depth,
+                         FRAME_WIDTH,
+                         first,
+                         last,
+                         THRESHOLD_BEGIN,
+                         THRESHOLD_END);
+  depth_pyramid_build_rows (preparation->pyramid_buffer,
+                            depth,
+                            FRAME_WIDTH,
+                            FRAME_HEIGHT,
+                            first,
+                            last,
+                            THRESHOLD_BEGIN,
+                            THRESHOLD_END);
+}
+
+/* Returns the time, in microseconds, taken to preprocess every one of
+   @frames SCALING_ROUNDS times with @n_threads */
+static gint64
+time_preprocessing (guint16       **frames,
+                    guint           n_threads,
+                    DepthFilter    *filter,
+                    guint           dimension_factor,
+                    DepthSampling   sampling,
+                    guint16        *converted,
+                    guint64        *mask_bits,
+                    guint16        *pyramid_buffer,
+                    guint16        *reduced)
+{
+  DepthWorkers *workers;
+  Preparation preparation;
+  gint64 time;
+  guint i;
+
+  workers = depth_workers_new (n_threads);
+
+  /* the whole pipeline converts in millimetres, for the pyramid */
+  preparation.disparity = FALSE;
+  preparation.filter = filter;
+  preparation.converted = converted;
+  preparation.mask_bits = mask_bits;
+  preparation.pyramid_buffer = pyramid_buffer;
+
+  if (filter != NULL)
+    depth_filter_reset (filter);
+
+  time = g_get_monotonic_time ();
+
+  for (i = 0; i < SCALING_FRAMES * SCALING_ROUNDS; i++)
+    {
+      const guint16 *depth;
+      DepthBox foreground;
+      gint reduced_width, reduced_height;
+
+      preparation.depth = frames[i % SCALING_FRAMES];
+      depth_workers_run (workers,
+                         FRAME_HEIGHT,
+                         DEPTH_PYRAMID_ALIGNMENT,
+                         prepare_tile,
+                         &preparation);
+
+      depth = converted;
+      if (filter != NULL)
+        {
+          depth = depth_filter_get_output (filter);
+          depth_filter_end_frame (filter);
+        }
+
+      depth_process_reduce (depth,
+                            FRAME_WIDTH,
+                            FRAME_HEIGHT,
+                            FALSE,
+                            TRUE,
+                            dimension_factor,
+                            sampling,
+                            THRESHOLD_BEGIN,
+                            THRESHOLD_END,
+                            NULL,
+                            0,
+                            reduced,
+                            &reduced_width,
+                            &reduced_height,
+                            &foreground,
+                            workers);
+    }
+
+  time = g_get_monotonic_time () - time;
+
+  depth_workers_free (workers);
+
+  return time;
+}
+
+static void
+on_gesture (gpointer data)
+{
+  guint *count = (guint *) data;
+
+  (*count)++;
+}
+
+static SkeltrackJointList
+copy_joint_list (SkeltrackJointList list)
+{
+  SkeltrackJointList copy;
+  gint i;
+
+  copy = skeltrack_joint_list_new ();
+  for (i = 0; i < SKELTRACK_JOINT_MAX_JOINTS; i++)
+    {
+      SkeltrackJoint *joint;
+
+      joint = skeltrack_joint_list_get_joint (list, i);
+      if (joint != NULL)
+        copy[i] = skeltrack_joint_copy (joint);
+    }
+
+  return copy;
+}
+
+typedef struct
+{
+  guint frame;
+  GString *frames;
+} Dropouts;
+
+static void
+on_dropout_gesture (gpointer data)
+{
+  Dropouts *dropouts = (Dropouts *) data;
+
+  g_string_append_printf (dropouts->frames, " %u", dropouts->frame);
+}
+
+static void
+drop_joint (SkeltrackJointList list, SkeltrackJointId id)
+{
+  skeltrack_joint_free (list[id]);
+  list[id] = NULL;
+}
+
+/* Runs @lists through every gesture of @table with joints dropping
+   out every now and then, and prints the frames each one fires on, so
+   they can be compared across versions of the gestures. */
+static void
+print_dropouts (GestureTable *table,
+                GPtrArray    *lists,
+                GArray       *timestamps)
+{
+  Salut *salut;
+  Dropouts dropouts;
+  guint n, i;
+
+  salut = salut_new ();
+  dropouts.frames = g_string_new (NULL);
+
+  g_print ("Gestures detected with joints dropping out every %u frames:\n",
+           DROPOUT_INTERVAL);
+  for (n = 0; n < gesture_table_get_n_gestures (table); n++)
+    {
+      salut_set_gesture (salut,
+                         gesture_table_get_gesture (table, n),
+                         on_dropout_gesture,
+                         &dropouts);
+      g_string_truncate (dropouts.frames, 0);
+
+      for (i = 0; i < lists->len; i++)
+        {
+          SkeltrackJointList list;
+
+          list = copy_joint_list (g_ptr_array_index (lists, i));
+          if (i % DROPOUT_INTERVAL == DROPOUT_INTERVAL - 1)
+            {
+              drop_joint (list, SKELTRACK_JOINT_ID_RIGHT_ELBOW);
+              if ((i / DROPOUT_INTERVAL) % 2 == 0)
+                drop_joint (list, SKELTRACK_JOINT_ID_LEFT_ELBOW);
+              else
+                drop_joint (list, SKELTRACK_JOINT_ID_LEFT_HAND);
+            }
+
+          dropouts.frame = i;
+          salut_set_track_data (salut,
+                                NULL,
+                                NULL,
+                                list,
+                                g_array_index (timestamps, gint64, i));
+          skeltrack_joint_list_free (list);
+        }
+
+      g_print ("  %-10s%s\n",
+               gesture_table_get_gesture (table, n)->name,
+               dropouts.frames->len > 0 ? dropouts.frames->str : " none");
+    }
+
+  g_string_free (dropouts.frames, TRUE);
+  salut_free (salut);
+}
+
+/* Runs @lists through every gesture of @table, @rounds times, and
+   returns the time it took. */
+static gint64
+time_gestures (GestureTable *table,
+               GPtrArray    *lists,
+               GArray       *timestamps,
+               guint         rounds)
+{
+  Salut *salut;
+  guint detected = 0;
+  guint round, n, i;
+  gint64 time;
+
+  salut = salut_new ();
+
+  time = g_get_monotonic_time ();
+  for (round = 0; round < rounds; round++)
+    {
+      for (n = 0; n < gesture_table_get_n_gestures (table); n++)
+        {
+          salut_set_gesture (salut,
+                             gesture_table_get_gesture (table, n),
+                             on_gesture,
+                             &detected);
+
+          for (i = 0; i < lists->len; i++)
+            {
+              salut_set_track_data (salut,
+                                    NULL,
+                                    NULL,
+                                    g_ptr_array_index (lists, i),
+                                    g_array_index (timestamps, gint64, i));
+            }
+        }
+    }
+  time = g_get_monotonic_time () - time;
+
+  salut_free (salut);
+
+  return time;
+}
+
+gint
+main (gint argc, gchar *argv[])
+{
+  DepthSynth *synth;
+  DepthFilter *filter = NULL;
+  DepthComponents *components = NULL;
+  DepthSynthMotion motion = DEPTH_SYNTH_MOTION_ALL;
+  DepthSampling sampling = DEPTH_SAMPLING_POINT;
+  const gchar *sampling_name;
+  SkeltrackSkeleton *skeleton;
+  JointFilter *joint_filter;
+  GestureTable *gestures;
+  Salut **saluts;
+  guint *detected;
+  Salut *poses[G_N_ELEMENTS (hand_poses)];
+  guint poses_detected[G_N_ELEMENTS (hand_poses)] = { 0 };
+  GPtrArray *head_lists;
+  GArray *head_timestamps;
+  gint64 stage_time[N_STAGES] = { 0 };
+  DepthBox crop = { 0, 0, 0, 0 };
+  guint64 cropped_pixels, reduced_pixels;
+  gint64 total_time;
+  guint16 *reduced, *converted, *pyramid_buffer;
+  guint64 *mask_bits;
+  guint16 *frames[SCALING_FRAMES];
+  guint16 threshold_begin, threshold_end;
+  const gchar *threads, *interval, *gestures_path;
+  gboolean disparity, following;
+  gint64 single_time, gestures_time;
+  guint n_frames, dimension_factor, frames_with_head, max_threads, n_threads, i;
+  guint tracking_interval, frames_tracked, frames_predicted, n_gestures;
+
+  if (argc > 1 && ! depth_synth_motion_from_string (argv[1], &motion))
+    {
+      g_print ("Usage: %s [motion [frames [dimension-reduction]]]\n\n"
+               "  motion is one of idle, wave, bow, kiss, curtsy or all\n",
+               argv[0]);
+      return -1;
+    }
+
+  synth = depth_synth_new (FRAME_WIDTH, FRAME_HEIGHT);
+  depth_synth_set_motion (synth, motion);
+  depth_synth_set_noise (synth, NOISE, NOISE_SEED);
+  depth_synth_set_disparity (synth, TRUE);
+
+  n_frames = argc > 2 ? atoi (argv[2]) : 4 * depth_synth_get_motion_length (synth);
+  dimension_factor = argc > 3 ? atoi (argv[3]) : 16;
+  if (n_frames == 0 || dimension_factor == 0)
+    {
+      g_print ("The number of frames and the dimension reduction must be positive\n");
+      return -1;
+    }
+
+  /* same variable as the application */
+  sampling_name = g_getenv ("MSPT_DEPTH_SAMPLING");
+  if (sampling_name != NULL &&
+      ! depth_process_sampling_from_string (sampling_name, &sampling))
+    {
+      g_print ("MSPT_DEPTH_SAMPLING must be one of point, nearest or mean\n");
+      return -1;
+    }
+
+  g_type_init ();
+
+  /* same settings SalutStream uses, which smooths joints itself */
+  skeleton = SKELTRACK_SKELETON (skeltrack_skeleton_new ());
+  g_object_set (skeleton,
+                "smoothing-factor", 0.0,
+                "joints-persistency", 0,
+                "dimension-reduction", dimension_factor,
+                NULL);
+  joint_filter = joint_filter_new (.25, 3);
+
+  /* same variable as the application */
+  gestures = gesture_table_get_default ();
+  gestures_path = g_getenv ("MSPT_GESTURES");
+  if (gestures_path != NULL)
+    {
+      GError *error = NULL;
+
+      if (! gesture_table_load_file (gestures, gestures_path, &error))
+        {
+          g_print ("Failed to load gestures: %s\n", error->message);
+          g_error_free (error);
+          return -1;
+        }
+    }
+
+  n_gestures = gesture_table_get_n_gestures (gestures);
+  saluts = g_new (Salut *, n_gestures);
+  detected = g_new0 (guint, n_gestures);
+  for (i = 0; i < n_gestures; i++)
+    {
+      saluts[i] = salut_new ();
+      salut_set_gesture (saluts[i],
+                         gesture_table_get_gesture (gestures, i),
+                         on_gesture,
+                         &detected[i]);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (hand_poses); i++)
+    {
+      poses[i] = salut_new ();
+      salut_set_gesture_to_track (poses[i], hand_poses[i], on_gesture, &poses_detected[i]);
+    }
+
+  head_lists = g_ptr_array_new ();
+  head_timestamps = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  /* optional in the application too */
+  if (g_getenv ("MSPT_DEPTH_FILTER") != NULL)
+    filter = depth_filter_new (FRAME_WIDTH, FRAME_HEIGHT);
+
+  /* on by default in the application */
+  if (g_getenv ("MSPT_DEPTH_ALL_VISITORS") == NULL)
+    components = depth_components_new (FRAME_WIDTH, FRAME_HEIGHT);
+
+  disparity = g_getenv ("MSPT_DEPTH_DISPARITY") != NULL;
+
+  interval = g_getenv ("MSPT_TRACKING_INTERVAL");
+  tracking_interval = interval != NULL ? MAX (g_ascii_strtoull (interval, NULL, 10), 1) : 1;
+  threshold_begin = THRESHOLD_BEGIN;
+  threshold_end = THRESHOLD_END;
+  if (disparity)
+    {
+      depth_process_disparity_range (THRESHOLD_BEGIN,
+                                     THRESHOLD_END,
+                                     &threshold_begin,
+                                     &threshold_end);
+    }
+
+  reduced = g_new (guint16, FRAME_WIDTH * FRAME_HEIGHT);
+  converted = g_new (guint16, FRAME_WIDTH * FRAME_HEIGHT);
+  pyramid_buffer = g_new (guint16, depth_pyramid_get_size (FRAME_WIDTH, FRAME_HEIGHT));
+  mask_bits = g_new (guint64, depth_mask_get_size (FRAME_WIDTH, FRAME_HEIGHT));
+  frames_with_head = 0;
+  frames_tracked = 0;
+  frames_predicted = 0;
+  following = FALSE;
+  cropped_pixels = 0;
+  reduced_pixels = 0;
+
+  g_print ("Running %u frames of '%s' with dimension reduction %u (%s sampling, %s)\n",
+           n_frames,
+           argc > 1 ? argv[1] : "all",
+           dimension_factor,
+           sampling_name != NULL ? sampling_name : "point",
+           disparity ? "disparity ingest" : "millimetre ingest");
+
+  total_time = g_get_monotonic_time ();
+
+  for (i = 0; i < n_frames; i++)
+    {
+      const guint16 *depth;
+      gboolean depth_disparity;
+      DepthPyramid pyramid;
+      DepthMask mask;
+      SkeltrackJointList list;
+      DepthBox foreground;
+      GError *error = NULL;
+      gint reduced_width, reduced_height;
+      gint64 time, timestamp;
+      guint n;
+
+      time = g_get_monotonic_time ();
+      depth = depth_synth_render (synth, i);
+      stage_time[STAGE_RENDER] += g_get_monotonic_time () - time;
+
+      /* the filter only works in millimetres */
+      depth_disparity = TRUE;
+      if (! disparity || filter != NULL)
+        {
+          time = g_get_monotonic_time ();
+          depth_process_disparity_to_mm (depth, converted, FRAME_WIDTH * FRAME_HEIGHT);
+          depth = converted;
+          depth_disparity = FALSE;
+          stage_time[STAGE_CONVERT] += g_get_monotonic_time () - time;
+        }
+
+      if (filter != NULL)
+        {
+          time = g_get_monotonic_time ();
+          depth = depth_filter_process (filter, depth);
+          stage_time[STAGE_FILTER] += g_get_monotonic_time () - time;
+        }
+
+      /* as the capture does, for every frame */
+      time = g_get_monotonic_time ();
+      depth_mask_build (&mask,
+                        mask_bits,
+                        depth,
+                        FRAME_WIDTH,
+                        FRAME_HEIGHT,
+                        TRUE,
+                        depth_disparity ? threshold_begin : THRESHOLD_BEGIN,
+                        depth_disparity ? threshold_end : THRESHOLD_END);
+      stage_time[STAGE_MASK] += g_get_monotonic_time () - time;
+
+      time = g_get_monotonic_time ();
+      depth_process_reduce (depth,
+                            FRAME_WIDTH,
+                            FRAME_HEIGHT,
+                            depth_disparity,
+                            TRUE,
+                            dimension_factor,
+                            sampling,
+                            depth_disparity ? threshold_begin : THRESHOLD_BEGIN,
+                            depth_disparity ? threshold_end : THRESHOLD_END,
+                            NULL,
+                            0,
+                            reduced,
+                            &reduced_width,
+                            &reduced_height,
+                            &foreground,
+                            NULL);
+      stage_time[STAGE_REDUCE] += g_get_monotonic_time () - time;
+
+      /* the synthetic visitor is alone, so this only measures the
+         cost of looking for others */
+      if (components != NULL)
+        {
+          time = g_get_monotonic_time ();
+          depth_components_isolate (components,
+                                    reduced,
+                                    reduced_width,
+                                    reduced_height,
+                                    -1,
+                                    -1,
+                                    &foreground);
+          stage_time[STAGE_ISOLATE] += g_get_monotonic_time () - time;
+        }
+
+      time = g_get_monotonic_time ();
+      depth_process_fit_crop (&foreground,
+                              reduced_width,
+                              reduced_height,
+                              &crop,
+                              &crop);
+      depth_process_crop (reduced, reduced_width, &crop);
+      stage_time[STAGE_REDUCE] += g_get_monotonic_time () - time;
+
+      reduced_pixels += reduced_width * reduced_height;
+      cropped_pixels += crop.width * crop.height;
+
+      timestamp = (gint64) i * 1000000 / DEPTH_SYNTH_FPS;
+
+      time = g_get_monotonic_time ();
+      if (following && frames_predicted + 1 < tracking_interval)
+        {
+          /* as the stream does in between tracked frames */
+          list = joint_filter_predict (joint_filter, timestamp);
+          frames_predicted++;
+        }
+      else
+        {
+          list = skeltrack_skeleton_track_joints_sync (skeleton,
+                                                       reduced,
+                                                       crop.width,
+                                                       crop.height,
+                                                       NULL,
+                                                       &error);
+          depth_process_uncrop_joints (list,
+                                       &crop,
+                                       reduced_width,
+                                       reduced_height,
+                                       dimension_factor);
+          joint_filter_apply (joint_filter, list, timestamp);
+
+          following = list != NULL &&
+            skeltrack_joint_list_get_joint (list, SKELTRACK_JOINT_ID_HEAD) != NULL;
+          frames_predicted = 0;
+          frames_tracked++;
+        }
+      stage_time[STAGE_TRACK] += g_get_monotonic_time () - time;
+
+      if (error != NULL)
+        {
+          g_print ("Error tracking frame %u: %s\n", i, error->message);
+          g_error_free (error);
+          continue;
+        }
+
+      if (list != NULL &&
+          skeltrack_joint_list_get_joint (list, SKELTRACK_JOINT_ID_HEAD) != NULL)
+        {
+          frames_with_head++;
+
+          time = g_get_monotonic_time ();
+          for (n = 0; n < n_gestures; n++)
+            salut_set_track_data (saluts[n], NULL, NULL, list, timestamp);
+          stage_time[STAGE_GESTURES] += g_get_monotonic_time () - time;
+
+          g_ptr_array_add (head_lists, copy_joint_list (list));
+          g_array_append_val (head_timestamps, timestamp);
+
+          /* the hand poses read the frame in millimetres */
+          if (depth_disparity)
+            {
+              time = g_get_monotonic_time ();
+              depth_process_disparity_to_mm (depth, converted, FRAME_WIDTH * FRAME_HEIGHT);
+              depth = converted;
+              stage_time[STAGE_CONVERT] += g_get_monotonic_time () - time;
+            }
+
+          /* built once, for all the gestures */
+          time = g_get_monotonic_time ();
+          depth_pyramid_build (&pyramid,
+                               pyramid_buffer,
+                               depth,
+                               FRAME_WIDTH,
+                               FRAME_HEIGHT,
+                               TRUE,
+                               THRESHOLD_BEGIN,
+                               THRESHOLD_END);
+          stage_time[STAGE_PYRAMID] += g_get_monotonic_time () - time;
+
+          time = g_get_monotonic_time ();
+          for (n = 0; n < G_N_ELEMENTS (hand_poses); n++)
+            salut_set_track_data (poses[n], &pyramid, &mask, list, timestamp);
+          stage_time[STAGE_POSES] += g_get_monotonic_time () - time;
+        }
+
+      skeltrack_joint_list_free (list);
+    }
+
+  total_time = g_get_monotonic_time () - total_time;
+
+  for (i = 0; i < N_STAGES; i++)
+    {
+      g_print ("  %-10s %8.3f ms/frame\n",
+               stage_names[i],
+               stage_time[i] / 1000.0 / n_frames);
+    }
+  g_print ("  %-10s %8.3f ms/frame, %.1f frames/s\n",
+           "total",
+           total_time / 1000.0 / n_frames,
+           n_frames * 1e6 / total_time);
+
+  g_print ("Tracked %.0f%% of the reduced pixels\n",
+           100.0 * cropped_pixels / reduced_pixels);
+  g_print ("Tracked %u of %u frames, one of every %u while following\n",
+           frames_tracked, n_frames, tracking_interval);
+  g_print ("Head found in %u of %u frames\n", frames_with_head, n_frames);
+  g_print ("Gestures detected:");
+  for (i = 0; i < n_gestures; i++)
+    {
+      g_print (" %s %u,",
+               gesture_table_get_gesture (gestures, i)->name,
+               detected[i]);
+    }
+  for (i = 0; i < G_N_ELEMENTS (hand_poses); i++)
+    {
+      g_print (" %s %u%s", hand_pose_names[i], poses_detected[i],
+               i + 1 < G_N_ELEMENTS (hand_poses) ? "," : "\n");
+    }
+
+  if (head_lists->len > 0)
+    {
+      gestures_time = time_gestures (gestures,
+                                     head_lists,
+                                     head_timestamps,
+                                     GESTURE_ROUNDS);
+      g_print ("Gestures evaluated in %.1f ns/frame for %u gestures\n",
+               gestures_time * 1000.0 / ((gdouble) GESTURE_ROUNDS * head_lists->len),
+               n_gestures);
+
+      print_dropouts (gestures, head_lists, head_timestamps);
+    }
+
+  /* same variable as the application, for the largest pool tried */
+  threads = g_getenv ("MSPT_DEPTH_THREADS");
+  max_threads = threads != NULL ? g_ascii_strtoull (threads, NULL, 10) : 0;
+  if (max_threads == 0)
+    max_threads = g_get_num_processors ();
+
+  for (i = 0; i < SCALING_FRAMES; i++)
+    {
+      frames[i] = g_memdup (depth_synth_render (synth, i),
+                            FRAME_WIDTH * FRAME_HEIGHT * sizeof (guint16));
+    }
+
+  g_print ("Preprocessing %u frames in millimetres:\n",
+           SCALING_FRAMES * SCALING_ROUNDS);
+
+  /* powers of 2 and the largest pool, even if it isn't one */
+  single_time = 0;
+  for (n_threads = 1; ; n_threads = MIN (n_threads * 2, max_threads))
+    {
+      gint64 time;
+
+      time = time_preprocessing (frames,
+                                 n_threads,
+                                 filter,
+                                 dimension_factor,
+                                 sampling,
+                                 converted,
+                                 mask_bits,
+                                 pyramid_buffer,
+                                 reduced);
+      if (n_threads == 1)
+        single_time = time;
+
+      g_print ("  %2u threads %8.3f ms/frame, %.2fx\n",
+               n_threads,
+               time / 1000.0 / (SCALING_FRAMES * SCALING_ROUNDS),
+               (gdouble) single_time / time);
+
+      if (n_threads == max_threads)
+        break;
+    }
+
+  for (i = 0; i < SCALING_FRAMES; i++)
+    g_free (frames[i]);
+  g_free (reduced);
+  g_free (converted);
+  g_free (pyramid_buffer);
+  g_free (mask_bits);
+  for (i = 0; i < n_gestures; i++)
+    salut_free (saluts[i]);
+  g_free (saluts);
+  g_free (detected);
+  for (i = 0; i < G_N_ELEMENTS (hand_poses); i++)
+    salut_free (poses[i]);
+  for (i = 0; i < head_lists->len; i++)
+    skeltrack_joint_list_free (g_ptr_array_index (head_lists, i));
+  g_ptr_array_free (head_lists, TRUE);
+  g_array_free (head_timestamps, TRUE);
+  g_object_unref (skeleton);
+  joint_filter_free (joint_filter);
+  depth_synth_free (synth);
+  depth_filter_free (filter);
+  depth_components_free (components);
+
+  return 0;
+}
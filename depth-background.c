@@ -0,0 +1,158 @@
+/*
+ * depth-background.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+/* Per-pixel depth of the empty scene, in the layout of the raw frames,
+   so the reduction can sample it at the same positions it samples the
+   depth. Pixels close enough to the noise of the model are averaged
+   in, pixels farther away reveal background that was hidden and
+   replace it right away, while closer ones only become background
+   once they stay still for a while (a moved chair, not a person). */
+
+#include "depth-background.h"
+
+#include <string.h>
+
+/* differences within this are taken as noise of the sensor */
+#define NOISE_MARGIN 40 /* millimetres */
+
+/* frames something closer must stay in place to become background */
+#define SETTLE_FRAMES 90
+
+/* frames learnt before the model is used at all */
+#define MIN_FRAMES 15
+
+struct _DepthBackground
+{
+  gint width;
+  gint height;
+
+  guint16 *model;
+
+  /* consecutive frames every pixel has been closer than the model */
+  guint8 *closer;
+
+  guint n_frames;
+};
+
+DepthBackground *
+depth_background_new (gint width, gint height)
+{
+  DepthBackground *self;
+
+  self = g_slice_new0 (DepthBackground);
+  self->width = width;
+  self->height = height;
+
+  self->model = g_new0 (guint16, width * height);
+  self->closer = g_new0 (guint8, width * height);
+
+  return self;
+}
+
+void
+depth_background_free (DepthBackground *self)
+{
+  if (self == NULL)
+    return;
+
+  g_free (self->model);
+  g_free (self->closer);
+
+  g_slice_free (DepthBackground, self);
+}
+
+/* Forgets everything learnt so far */
+void
+depth_background_reset (DepthBackground *self)
+{
+  memset (self->model, 0, self->width * self->height * sizeof (guint16));
+  memset (self->closer, 0, self->width * self->height);
+  self->n_frames = 0;
+}
+
+/* Learns from @depth, a raw frame of the size given at creation. To be
+   called only while nobody is in the scene. */
+void
+depth_background_update (DepthBackground *self, const guint16 *depth)
+{
+  depth_background_update_pixels (self, depth, 0, self->width * self->height);
+  depth_background_end_frame (self);
+}
+
+/* Learns from pixels [@first, @first + @length) of @depth only, so
+   that a frame can be learnt in parts, from several threads; once all
+   of them are, depth_background_end_frame() must be called */
+void
+depth_background_update_pixels (DepthBackground *self,
+                                const guint16   *depth,
+                                gint             first,
+                                gint             length)
+{
+  gint i;
+
+  for (i = first; i < first + length; i++)
+    {
+      gint value, model;
+
+      /* no reading, nothing to learn */
+      value = depth[i];
+      if (value == 0)
+        continue;
+
+      model = self->model[i];
+
+      if (model == 0 || value > model + NOISE_MARGIN)
+        {
+          self->model[i] = value;
+          self->closer[i] = 0;
+        }
+      else if (value >= model - NOISE_MARGIN)
+        {
+          self->model[i] = model + (value - model) / 8;
+          self->closer[i] = 0;
+        }
+      else if (++self->closer[i] >= SETTLE_FRAMES)
+        {
+          self->model[i] = value;
+          self->closer[i] = 0;
+        }
+    }
+}
+
+void
+depth_background_end_frame (DepthBackground *self)
+{
+  if (self->n_frames < MIN_FRAMES)
+    self->n_frames++;
+}
+
+/* Returns the model in the layout of the raw frames, 0 meaning
+   unknown, or NULL while too few frames have been learnt */
+const guint16 *
+depth_background_get_model (DepthBackground *self)
+{
+  if (self->n_frames < MIN_FRAMES)
+    return NULL;
+
+  return self->model;
+}
@@ -0,0 +1,54 @@
+/*
+ * depth-background.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_BACKGROUND_H__
+#define __DEPTH_BACKGROUND_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DepthBackground DepthBackground;
+
+DepthBackground * depth_background_new           (gint             width,
+                                                  gint             height);
+
+void              depth_background_free          (DepthBackground *self);
+
+void              depth_background_reset         (DepthBackground *self);
+
+void              depth_background_update        (DepthBackground *self,
+                                                  const guint16   *depth);
+
+void              depth_background_update_pixels (DepthBackground *self,
+                                                  const guint16   *depth,
+                                                  gint             first,
+                                                  gint             length);
+
+void              depth_background_end_frame     (DepthBackground *self);
+
+const guint16 *   depth_background_get_model     (DepthBackground *self);
+
+G_END_DECLS
+
+#endif /* __DEPTH_BACKGROUND_H__ */
@@ -0,0 +1,1201 @@
+/*
+ * depth-capture.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#include "depth-capture.h"
+#include "depth-background.h"
+#include "depth-components.h"
+#include "depth-filter.h"
+#include "depth-process.h"
+#include "depth-recording.h"
+#include "depth-synth.h"
+
+/* frames the main context holds at once by default, besides the one
+   it was last sent, while the capture thread fills another */
+#define FRAMES_HELD 1
+
+#define TRANSFORM_BUFFER TRUE
+
+/* how much closer than the background a pixel must be to be kept */
+#define BACKGROUND_MARGIN 100 /* millimetres */
+
+/* delay used when replaying a frame with no usable timestamp */
+#define REPLAY_FRAME_INTERVAL 33 /* milliseconds */
+
+struct _DepthCapture
+{
+  gint device_index;
+  GFreenectDevice *device;
+
+  /* whether the device is asked for raw disparities, and whether the
+     frames are such, whatever their source; fixed once started */
+  gboolean device_disparity;
+  gboolean disparity;
+
+  /* frames come from a recording instead of the device, if set */
+  DepthReplay *replay;
+  gboolean replay_realtime;
+
+  /* or are rendered by a generator, @synth_fps per second or as fast
+     as they are consumed if 0 */
+  DepthSynth *synth;
+  guint synth_fps;
+  guint synth_frame;
+
+  /* whether the replay or the generator stopped while the capture was
+     disabled, until it is enabled again; only touched by the capture
+     thread */
+  gboolean paused;
+
+  DepthRecorder *recorder;
+
+  /* the capture thread runs its own main context, which receives the
+     device's signals */
+  GThread *thread;
+  GMainContext *context;
+  GMainLoop *loop;
+
+  /* the context frames and readiness are reported to */
+  GMainContext *main_context;
+  GSource *frame_source;
+
+  DepthFrameRing *frame_ring;
+  DepthFrameQueue *frame_queue;
+  guint ring_size;
+  guint64 frame_seq;
+
+  /* only touched by the capture thread */
+  DepthBackground *background;
+  DepthFilter *filter;
+  guint64 filter_frame_seq;
+  DepthComponents *components;
+  DepthWorkers *workers;
+  guint workers_n_threads;
+  DepthBox crop;
+  guint crop_dimension_factor;
+  guint16 *converted;
+
+  /* preprocessing parameters, set from the main context */
+  volatile gint enabled;
+  volatile gint keep_raw;
+  volatile gint dimension_factor;
+  volatile gint threshold_begin;
+  volatile gint threshold_end;
+  volatile gint sampling;
+  volatile gint filter_enabled;
+  volatile gint subtract_background;
+  volatile gint learn_background;
+  volatile gint isolate_visitor;
+  volatile gint max_visitors;
+  volatile gint n_threads;
+  volatile gint visitor_x;
+  volatile gint visitor_y;
+
+  /* frames received from the source, each once however many times it
+     waited for a slot, and frames preprocessed out of them */
+  volatile gint frame_count;
+  volatile gint processed_count;
+  volatile gint dropped_count;
+
+  DepthCaptureFrameFunc frame_cb;
+  gpointer frame_cb_data;
+  DepthCaptureReadyFunc ready_cb;
+  gpointer ready_cb_data;
+  GError *error;
+};
+
+typedef struct
+{
+  GSource source;
+  DepthCapture *capture;
+} FrameSource;
+
+static gboolean
+frame_source_prepare (GSource *source, gint *timeout)
+{
+  FrameSource *frame_source = (FrameSource *) source;
+
+  *timeout = -1;
+
+  return ! depth_frame_queue_is_empty (frame_source->capture->frame_queue);
+}
+
+static gboolean
+frame_source_check (GSource *source)
+{
+  FrameSource *frame_source = (FrameSource *) source;
+
+  return ! depth_frame_queue_is_empty (frame_source->capture->frame_queue);
+}
+
+static gboolean
+frame_source_dispatch (GSource     *source,
+                       GSourceFunc  callback,
+                       gpointer     user_data)
+{
+  DepthCapture *self = ((FrameSource *) source)->capture;
+
+  if (self->frame_cb != NULL)
+    self->frame_cb (self, self->frame_cb_data);
+
+  return TRUE;
+}
+
+static GSourceFuncs frame_source_funcs =
+{
+  frame_source_prepare,
+  frame_source_check,
+  frame_source_dispatch,
+  NULL
+};
+
+typedef struct
+{
+  DepthCapture *capture;
+  DepthFrame *frame;
+  const guint16 *depth;
+  gboolean convert;
+  gboolean filter;
+  gboolean learn_background;
+  gboolean keep_raw;
+  guint16 threshold_begin;
+  guint16 threshold_end;
+} Preparation;
+
+/* Runs every pass over the full resolution frame, but the reduction,
+   on raw rows [@first, @last). The passes only read and write the
+   pixels of those rows. Runs in the capture thread and its workers. */
+static void
+prepare_tile (gint first, gint last, gpointer data)
+{
+  Preparation *preparation = (Preparation *) data;
+  DepthCapture *self = preparation->capture;
+  DepthFrame *frame = preparation->frame;
+  const guint16 *depth = preparation->depth;
+  gint offset, length;
+
+  offset = first * frame->width;
+  length = (last - first) * frame->width;
+
+  if (preparation->convert)
+    {
+      depth_process_disparity_to_mm (depth + offset,
+                                     self->converted + offset,
+                                     length);
+      depth = self->converted;
+    }
+
+  if (preparation->filter)
+    {
+      depth_filter_process_pixels (self->filter, depth, offset, length);
+      depth = depth_filter_get_output (self->filter);
+    }
+
+  if (preparation->learn_background)
+    depth_background_update_pixels (self->background, depth, offset, length);
+
+  depth_mask_build_rows (frame->mask_bits,
+                         depth,
+                         frame->width,
+                         first,
+                         last,
+                         preparation->threshold_begin,
+                         preparation->threshold_end);
+
+  if (preparation->keep_raw)
+    {
+      depth_pyramid_build_rows (frame->raw,
+                                depth,
+                                frame->width,
+                                frame->height,
+                                first,
+                                last,
+                                preparation->threshold_begin,
+                                preparation->threshold_end);
+    }
+}
+
+/* Splits the reduced frame into the objects that may be visitors,
+   nearest first, and copies each of them alone, in the region around
+   it, after the reduced frame, as long as they fit. The reduced frame
+   itself is left whole. Runs in the capture thread. */
+static void
+split_visitors (DepthCapture *self, DepthFrame *frame, guint max_visitors)
+{
+  guint16 *object, *end;
+  guint n_objects, i;
+
+  if (self->components == NULL)
+    self->components = depth_components_new (frame->width, frame->height);
+
+  n_objects = depth_components_split (self->components,
+                                      frame->reduced,
+                                      frame->reduced_width,
+                                      frame->reduced_height,
+                                      MIN (max_visitors, DEPTH_FRAME_MAX_REGIONS));
+
+  object = frame->reduced + frame->reduced_width * frame->reduced_height;
+  end = frame->reduced + frame->ring->capacity;
+
+  for (i = 0; i < n_objects; i++)
+    {
+      DepthRegion *region = &frame->regions[frame->n_regions];
+      DepthBox box;
+
+      depth_components_get_object (self->components,
+                                   i,
+                                   &box,
+                                   &region->area,
+                                   &region->x,
+                                   &region->y);
+
+      /* each region is cropped like the whole foreground would be */
+      depth_process_fit_crop (&box,
+                              frame->reduced_width,
+                              frame->reduced_height,
+                              NULL,
+                              &region->crop);
+      if (object + region->crop.width * region->crop.height > end)
+        break;
+
+      depth_components_copy_object (self->components,
+                                    i,
+                                    frame->reduced,
+                                    frame->reduced_width,
+                                    &region->crop,
+                                    object);
+      region->reduced = object;
+      object += region->crop.width * region->crop.height;
+      frame->n_regions++;
+    }
+}
+
+/* Preprocesses @depth into a free ring slot and queues it for the main
+   context. Returns FALSE if the frame had to be skipped because no
+   slot was free. Runs in the capture thread. */
+static gboolean
+process_depth (DepthCapture  *self,
+               const guint16 *depth,
+               gint           width,
+               gint           height)
+{
+  DepthFrame *frame;
+  const guint16 *background;
+  Preparation preparation;
+  gboolean disparity, keep_raw, filter, subtract_background, learn_background;
+  gboolean convert, isolate_visitor;
+  gint visitor_x, visitor_y;
+  guint max_visitors;
+  guint16 threshold_begin, threshold_end;
+  guint n_threads;
+
+  if (! g_atomic_int_get (&self->enabled))
+    {
+      /* the filter's history is stale once frames went by unseen */
+      self->filter_frame_seq = self->frame_seq;
+      return TRUE;
+    }
+
+  if (self->frame_ring == NULL)
+    self->frame_ring = depth_frame_ring_new (self->ring_size, width, height);
+
+  if ((gsize) (width * height) > self->frame_ring->capacity)
+    {
+      g_warning ("Depth frame of %dx%d doesn't fit in the frame ring",
+                 width, height);
+      return TRUE;
+    }
+
+  /* every slot is still held by the main context */
+  frame = depth_frame_ring_acquire (self->frame_ring);
+  if (frame == NULL)
+    return FALSE;
+
+  frame->seq = self->frame_seq++;
+  g_atomic_int_inc (&self->processed_count);
+  frame->timestamp = g_get_real_time ();
+  frame->width = width;
+  frame->height = height;
+  frame->dimension_factor = g_atomic_int_get (&self->dimension_factor);
+
+  threshold_begin = g_atomic_int_get (&self->threshold_begin);
+  threshold_end = g_atomic_int_get (&self->threshold_end);
+  keep_raw = g_atomic_int_get (&self->keep_raw);
+  filter = g_atomic_int_get (&self->filter_enabled);
+  subtract_background = g_atomic_int_get (&self->subtract_background);
+  learn_background = g_atomic_int_get (&self->learn_background);
+  isolate_visitor = g_atomic_int_get (&self->isolate_visitor);
+  max_visitors = g_atomic_int_get (&self->max_visitors);
+
+  /* settings are read once, so they stay consistent over the frame */
+  disparity = self->disparity;
+  convert = disparity &&
+    (filter || (subtract_background && learn_background) || keep_raw);
+  if (convert)
+    {
+      /* the filter, the background model and the hand poses need
+         every pixel in millimetres */
+      if (self->converted == NULL)
+        self->converted = g_new (guint16, width * height);
+      disparity = FALSE;
+    }
+  else if (disparity)
+    {
+      /* only what is sampled and within the thresholds gets
+         converted, by the reduction itself */
+      depth_process_disparity_range (threshold_begin,
+                                     threshold_end,
+                                     &threshold_begin,
+                                     &threshold_end);
+    }
+
+  /* frames skipped for lack of a slot don't break the filter's
+     history, only frames preprocessed without it do */
+  if (filter)
+    {
+      if (self->filter == NULL)
+        self->filter = depth_filter_new (width, height);
+      else if (frame->seq != self->filter_frame_seq + 1)
+        depth_filter_reset (self->filter);
+      self->filter_frame_seq = frame->seq;
+    }
+
+  if (subtract_background && self->background == NULL)
+    self->background = depth_background_new (width, height);
+
+  n_threads = g_atomic_int_get (&self->n_threads);
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+  if (self->workers == NULL || n_threads != self->workers_n_threads)
+    {
+      depth_workers_free (self->workers);
+      self->workers = depth_workers_new (n_threads);
+      self->workers_n_threads = n_threads;
+    }
+
+  /* every pass over the whole frame is done tile by tile, all of them
+     over a tile while it is in cache, by all the workers */
+  preparation.capture = self;
+  preparation.frame = frame;
+  preparation.depth = depth;
+  preparation.convert = convert;
+  preparation.filter = filter;
+  preparation.learn_background = subtract_background && learn_background;
+  preparation.keep_raw = keep_raw;
+  preparation.threshold_begin = threshold_begin;
+  preparation.threshold_end = threshold_end;
+  depth_workers_run (self->workers,
+                     height,
+                     DEPTH_PYRAMID_ALIGNMENT,
+                     prepare_tile,
+                     &preparation);
+
+  /* everything downstream, the raw copy included, sees the filtered
+     frame; only recordings keep what the device sent */
+  if (convert)
+    depth = self->converted;
+  if (filter)
+    {
+      depth = depth_filter_get_output (self->filter);
+      depth_filter_end_frame (self->filter);
+    }
+
+  background = NULL;
+  if (subtract_background)
+    {
+      if (learn_background)
+        depth_background_end_frame (self->background);
+
+      background = depth_background_get_model (self->background);
+    }
+
+  /* what is within the thresholds, for whoever doesn't need the
+     depth itself */
+  depth_mask_init (&frame->mask, frame->mask_bits, width, height, TRANSFORM_BUFFER);
+
+  /* the full resolution frame is only needed by the hand poses, which
+     read it through rotated views, so it is never rotated as a whole */
+  if (keep_raw)
+    depth_pyramid_init (&frame->pyramid, frame->raw, width, height, TRANSFORM_BUFFER);
+  else
+    depth_pyramid_init_empty (&frame->pyramid, width, height, TRANSFORM_BUFFER);
+
+  /* the reduced frame for skeltrack is produced straight from the raw
+     depth, in a single pass */
+  depth_process_reduce (depth,
+                        width,
+                        height,
+                        disparity,
+                        TRANSFORM_BUFFER,
+                        frame->dimension_factor,
+                        g_atomic_int_get (&self->sampling),
+                        threshold_begin,
+                        threshold_end,
+                        background,
+                        BACKGROUND_MARGIN,
+                        frame->reduced,
+                        &frame->reduced_width,
+                        &frame->reduced_height,
+                        &frame->foreground,
+                        self->workers);
+
+  /* with several people in view, each of them is tracked apart, or
+     only one of them is */
+  frame->n_regions = 0;
+  if (isolate_visitor && max_visitors > 1)
+    {
+      split_visitors (self, frame, max_visitors);
+    }
+  else if (isolate_visitor)
+    {
+      if (self->components == NULL)
+        self->components = depth_components_new (width, height);
+
+      /* the position may be torn between two updates, which is as
+         good a guess as either */
+      visitor_x = g_atomic_int_get (&self->visitor_x);
+      visitor_y = g_atomic_int_get (&self->visitor_y);
+      if (visitor_x >= 0 && visitor_y >= 0)
+        {
+          visitor_x /= (gint) frame->dimension_factor;
+          visitor_y /= (gint) frame->dimension_factor;
+        }
+      else
+        {
+          visitor_x = visitor_y = -1;
+        }
+
+      depth_components_isolate (self->components,
+                                frame->reduced,
+                                frame->reduced_width,
+                                frame->reduced_height,
+                                visitor_x,
+                                visitor_y,
+                                &frame->foreground);
+    }
+
+  /* skeltrack's cost goes with the pixels it is given, so it only
+     gets the region around the foreground */
+  if (self->crop_dimension_factor != frame->dimension_factor)
+    self->crop.width = 0;
+  depth_process_fit_crop (&frame->foreground,
+                          frame->reduced_width,
+                          frame->reduced_height,
+                          &self->crop,
+                          &frame->crop);
+  depth_process_crop (frame->reduced, frame->reduced_width, &frame->crop);
+
+  /* the crop holds the whole foreground, so only it is counted */
+  frame->foreground_area = depth_process_get_area (frame->reduced,
+                                                   frame->crop.width,
+                                                   frame->crop.height,
+                                                   &frame->foreground_x,
+                                                   &frame->foreground_y);
+  frame->foreground_x += frame->crop.x;
+  frame->foreground_y += frame->crop.y;
+  self->crop = frame->crop;
+  self->crop_dimension_factor = frame->dimension_factor;
+
+  /* otherwise the one visitor is all of the foreground */
+  if (! (isolate_visitor && max_visitors > 1) && frame->foreground_area > 0)
+    {
+      DepthRegion *region = &frame->regions[0];
+
+      region->crop = frame->crop;
+      region->area = frame->foreground_area;
+      region->x = frame->foreground_x;
+      region->y = frame->foreground_y;
+      region->reduced = frame->reduced;
+      frame->n_regions = 1;
+    }
+
+  if (! depth_frame_queue_push (self->frame_queue, frame))
+    {
+      depth_frame_release (frame);
+      return FALSE;
+    }
+
+  g_main_context_wakeup (self->main_context);
+
+  return TRUE;
+}
+
+/* runs in the capture thread */
+static void
+record_depth (DepthCapture  *self,
+              const guint16 *depth,
+              gint           width,
+              gint           height)
+{
+  DepthRecorder *recorder;
+  GError *error = NULL;
+
+  recorder = g_atomic_pointer_get (&self->recorder);
+  if (recorder == NULL)
+    return;
+
+  if (! depth_recorder_add_frame (recorder,
+                                  depth,
+                                  width,
+                                  height,
+                                  g_get_real_time (),
+                                  &error))
+    {
+      g_warning ("%s", error->message);
+      g_error_free (error);
+    }
+}
+
+/* runs in the capture thread */
+static void
+on_depth_frame (GFreenectDevice *device, gpointer user_data)
+{
+  DepthCapture *self;
+  GFreenectFrameMode frame_mode;
+  guint16 *depth;
+  gsize len;
+
+  self = (DepthCapture *) user_data;
+
+  depth = (guint16 *) gfreenect_device_get_depth_frame_raw (device,
+                                                            &len,
+                                                            &frame_mode);
+  if (depth == NULL)
+    return;
+
+  g_atomic_int_inc (&self->frame_count);
+
+  if (! process_depth (self, depth, frame_mode.width, frame_mode.height))
+    g_atomic_int_inc (&self->dropped_count);
+
+  record_depth (self, depth, frame_mode.width, frame_mode.height);
+}
+
+static void schedule_replay_frame (DepthCapture *self, guint delay);
+
+/* Emits the current frame of the replay in place of the device, then
+   schedules the next one. Runs in the capture thread. */
+static gboolean
+on_replay_frame (gpointer user_data)
+{
+  DepthCapture *self = (DepthCapture *) user_data;
+  const guint16 *depth;
+  gint width, height;
+  gint64 timestamp, next_timestamp;
+
+  /* nothing would use the frames, so the replay stays where it is
+     rather than spinning over the recording */
+  if (! g_atomic_int_get (&self->enabled))
+    {
+      self->paused = TRUE;
+      return FALSE;
+    }
+
+  depth = depth_replay_get_frame (self->replay, &width, &height, &timestamp);
+
+  if (depth == NULL)
+    {
+      g_warning ("Failed to decode replayed depth frame, skipping it");
+    }
+  else if (! process_depth (self, depth, width, height))
+    {
+      if (! self->replay_realtime)
+        {
+          /* at full speed, wait for a slot rather than skipping
+             recorded frames */
+          g_usleep (1000);
+          return TRUE;
+        }
+
+      g_atomic_int_inc (&self->dropped_count);
+    }
+
+  g_atomic_int_inc (&self->frame_count);
+
+  if (! depth_replay_advance (self->replay))
+    g_print ("Depth replay reached its end, starting over\n");
+
+  if (! self->replay_realtime)
+    return TRUE;
+
+  next_timestamp = depth_replay_get_timestamp (self->replay);
+  if (next_timestamp > timestamp)
+    schedule_replay_frame (self, MIN ((next_timestamp - timestamp) / 1000, 1000));
+  else
+    schedule_replay_frame (self, REPLAY_FRAME_INTERVAL);
+
+  return FALSE;
+}
+
+static void
+schedule_replay_frame (DepthCapture *self, guint delay)
+{
+  GSource *source;
+
+  if (self->replay_realtime)
+    source = g_timeout_source_new (delay);
+  else
+    source = g_idle_source_new ();
+
+  g_source_set_callback (source, on_replay_frame, self, NULL);
+  g_source_attach (source, self->context);
+  g_source_unref (source);
+}
+
+/* Renders the next frame of the generator in place of the device. Runs
+   in the capture thread. */
+static gboolean
+on_synth_frame (gpointer user_data)
+{
+  DepthCapture *self = (DepthCapture *) user_data;
+  const guint16 *depth;
+  gint width, height;
+
+  if (! g_atomic_int_get (&self->enabled))
+    {
+      self->paused = TRUE;
+      return FALSE;
+    }
+
+  depth_synth_get_size (self->synth, &width, &height);
+  depth = depth_synth_render (self->synth, self->synth_frame);
+
+  if (! process_depth (self, depth, width, height))
+    {
+      if (self->synth_fps == 0)
+        {
+          /* as fast as possible, but without skipping any frame of
+             the scripted motion */
+          g_usleep (1000);
+          return TRUE;
+        }
+
+      g_atomic_int_inc (&self->dropped_count);
+    }
+
+  g_atomic_int_inc (&self->frame_count);
+  record_depth (self, depth, width, height);
+
+  self->synth_frame++;
+
+  return TRUE;
+}
+
+static void
+start_synth (DepthCapture *self)
+{
+  GSource *source;
+
+  if (self->synth_fps > 0)
+    source = g_timeout_source_new (1000 / self->synth_fps);
+  else
+    source = g_idle_source_new ();
+
+  g_source_set_callback (source, on_synth_frame, self, NULL);
+  g_source_attach (source, self->context);
+  g_source_unref (source);
+}
+
+/* Restarts the replay or the generator if it stopped while the capture
+   was disabled. Runs in the capture thread. */
+static gboolean
+resume_frames (gpointer user_data)
+{
+  DepthCapture *self = (DepthCapture *) user_data;
+
+  if (! self->paused || ! g_atomic_int_get (&self->enabled))
+    return FALSE;
+
+  self->paused = FALSE;
+  if (self->replay != NULL)
+    schedule_replay_frame (self, 0);
+  else
+    start_synth (self);
+
+  return FALSE;
+}
+
+static gboolean
+report_ready (gpointer user_data)
+{
+  DepthCapture *self = (DepthCapture *) user_data;
+  GError *error;
+
+  error = self->error;
+  self->error = NULL;
+
+  self->ready_cb (self, error, self->ready_cb_data);
+
+  if (error != NULL)
+    g_error_free (error);
+
+  return FALSE;
+}
+
+/* runs in the capture thread */
+static void
+on_new_device (GObject      *obj,
+               GAsyncResult *res,
+               gpointer      user_data)
+{
+  DepthCapture *self = (DepthCapture *) user_data;
+  GError *error = NULL;
+
+  self->device = gfreenect_device_new_finish (res, &self->error);
+
+  if (self->device != NULL)
+    {
+      g_signal_connect (self->device,
+                        "depth-frame",
+                        G_CALLBACK (on_depth_frame),
+                        self);
+
+      if (! gfreenect_device_start_depth_stream (self->device,
+                                                 self->device_disparity ?
+                                                 GFREENECT_DEPTH_FORMAT_11BIT :
+                                                 GFREENECT_DEPTH_FORMAT_MM,
+                                                 &error))
+        {
+          g_print ("Error starting depth stream: %s\n", error->message);
+          g_error_free (error);
+        }
+
+      /* turn the kinect's led off */
+      gfreenect_device_set_led (self->device, GFREENECT_LED_OFF, NULL, NULL, NULL);
+    }
+
+  g_main_context_invoke (self->main_context, report_ready, self);
+}
+
+static gpointer
+capture_thread_func (gpointer user_data)
+{
+  DepthCapture *self = (DepthCapture *) user_data;
+
+  /* the device dispatches its signals in the thread-default context
+     it was created from */
+  g_main_context_push_thread_default (self->context);
+
+  if (self->replay != NULL)
+    {
+      schedule_replay_frame (self, 0);
+      g_main_context_invoke (self->main_context, report_ready, self);
+    }
+  else if (self->synth != NULL)
+    {
+      start_synth (self);
+      g_main_context_invoke (self->main_context, report_ready, self);
+    }
+  else
+    {
+      gfreenect_device_new (self->device_index,
+                            GFREENECT_SUBDEVICE_CAMERA,
+                            NULL,
+                            on_new_device,
+                            self);
+    }
+
+  g_main_loop_run (self->loop);
+
+  if (self->device != NULL)
+    {
+      g_object_unref (self->device);
+      self->device = NULL;
+    }
+
+  g_main_context_pop_thread_default (self->context);
+
+  return NULL;
+}
+
+static gboolean
+quit_capture_loop (gpointer user_data)
+{
+  DepthCapture *self = (DepthCapture *) user_data;
+
+  g_main_loop_quit (self->loop);
+
+  return FALSE;
+}
+
+/* whether frames are raw disparities rather than millimetres */
+static gboolean
+get_disparity (DepthCapture *self)
+{
+  if (self->replay != NULL)
+    return depth_replay_get_depth_format (self->replay) == GFREENECT_DEPTH_FORMAT_11BIT;
+  else if (self->synth != NULL)
+    return depth_synth_get_disparity (self->synth);
+  else
+    return self->device_disparity;
+}
+
+/* public methods */
+
+DepthCapture *
+depth_capture_new (gint                  device_index,
+                   DepthCaptureFrameFunc frame_cb,
+                   gpointer              user_data)
+{
+  DepthCapture *self;
+
+  self = g_slice_new0 (DepthCapture);
+  self->device_index = device_index;
+  self->frame_cb = frame_cb;
+  self->frame_cb_data = user_data;
+
+  self->enabled = FALSE;
+  self->keep_raw = FALSE;
+  self->dimension_factor = 1;
+  self->threshold_begin = 0;
+  self->threshold_end = G_MAXUINT16;
+  self->visitor_x = -1;
+  self->visitor_y = -1;
+  self->max_visitors = 1;
+
+  self->ring_size = FRAMES_HELD + 2;
+  self->frame_queue = depth_frame_queue_new (self->ring_size);
+
+  self->main_context = g_main_context_ref (g_main_context_default ());
+  self->frame_source = g_source_new (&frame_source_funcs, sizeof (FrameSource));
+  ((FrameSource *) self->frame_source)->capture = self;
+  g_source_attach (self->frame_source, self->main_context);
+
+  self->context = g_main_context_new ();
+  self->loop = g_main_loop_new (self->context, FALSE);
+
+  return self;
+}
+
+/* Makes the capture replay the recording at @path in place of opening
+   the device, either honouring the recorded timestamps or as fast as
+   frames get consumed. Must be called before depth_capture_start(). */
+gboolean
+depth_capture_set_replay (DepthCapture  *self,
+                          const gchar   *path,
+                          gboolean       realtime,
+                          GError       **error)
+{
+  DepthReplay *replay;
+
+  g_return_val_if_fail (self->thread == NULL, FALSE);
+
+  replay = depth_replay_new (path, error);
+  if (replay == NULL)
+    return FALSE;
+
+  if (depth_replay_get_depth_format (replay) != GFREENECT_DEPTH_FORMAT_MM &&
+      depth_replay_get_depth_format (replay) != GFREENECT_DEPTH_FORMAT_11BIT)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   G_FILE_ERROR_INVAL,
+                   "Depth recording '%s' is neither in millimetres nor in "
+                   "raw disparities",
+                   path);
+      depth_replay_free (replay);
+      return FALSE;
+    }
+
+  depth_replay_free (self->replay);
+  self->replay = replay;
+  self->replay_realtime = realtime;
+
+  return TRUE;
+}
+
+/* Makes the capture render frames of @synth, which it takes ownership
+   of, in place of opening the device. Frames are produced @fps times
+   per second, or as fast as they get consumed if @fps is 0. Must be
+   called before depth_capture_start(). */
+void
+depth_capture_set_synth (DepthCapture *self,
+                         DepthSynth   *synth,
+                         guint         fps)
+{
+  g_return_if_fail (self->thread == NULL);
+  g_return_if_fail (synth != NULL);
+
+  depth_synth_free (self->synth);
+  self->synth = synth;
+  self->synth_fps = MIN (fps, 1000);
+  self->synth_frame = 0;
+}
+
+/* Makes the device send its raw 11 bit disparities, which the capture
+   converts to millimetres itself, only where needed, rather than
+   having the driver convert every pixel. Replays and generators keep
+   the format of their frames. Must be called before
+   depth_capture_start(). */
+void
+depth_capture_set_disparity (DepthCapture *self, gboolean disparity)
+{
+  g_return_if_fail (self->thread == NULL);
+
+  self->device_disparity = disparity;
+}
+
+/* Starts appending every frame received from the device, or rendered
+   by the generator, to the recording at @path, losslessly compressed
+   if @compress is set. Frames are recorded in the format they come
+   in. Can be called at any time, but only once. */
+gboolean
+depth_capture_start_recording (DepthCapture  *self,
+                               const gchar   *path,
+                               gboolean       compress,
+                               GError       **error)
+{
+  DepthRecorder *recorder;
+
+  g_return_val_if_fail (self->recorder == NULL, FALSE);
+
+  recorder = depth_recorder_new (path,
+                                 get_disparity (self) ?
+                                 GFREENECT_DEPTH_FORMAT_11BIT :
+                                 GFREENECT_DEPTH_FORMAT_MM,
+                                 compress,
+                                 error);
+  if (recorder == NULL)
+    return FALSE;
+
+  /* picked up by the capture thread from its next frame on */
+  g_atomic_pointer_set (&self->recorder, recorder);
+
+  return TRUE;
+}
+
+/* Opens the device from the capture thread. @ready_cb is called in the
+   main context once the depth stream is running, or with an error if
+   the device could not be opened. */
+void
+depth_capture_start (DepthCapture          *self,
+                     DepthCaptureReadyFunc  ready_cb,
+                     gpointer               user_data)
+{
+  g_return_if_fail (ready_cb != NULL);
+  g_return_if_fail (self->thread == NULL);
+
+  self->ready_cb = ready_cb;
+  self->ready_cb_data = user_data;
+  self->disparity = get_disparity (self);
+
+  self->thread = g_thread_new ("depth-capture", capture_thread_func, self);
+}
+
+void
+depth_capture_free (DepthCapture *self)
+{
+  DepthFrame *frame;
+
+  if (self == NULL)
+    return;
+
+  if (self->thread != NULL)
+    {
+      GSource *source;
+
+      /* an idle source rather than g_main_context_invoke(), so the quit
+         can't be lost if the loop isn't running yet */
+      source = g_idle_source_new ();
+      g_source_set_callback (source, quit_capture_loop, self, NULL);
+      g_source_attach (source, self->context);
+      g_source_unref (source);
+
+      g_thread_join (self->thread);
+    }
+
+  g_main_loop_unref (self->loop);
+  g_main_context_unref (self->context);
+
+  g_source_destroy (self->frame_source);
+  g_source_unref (self->frame_source);
+  g_main_context_unref (self->main_context);
+
+  while ((frame = depth_frame_queue_pop (self->frame_queue)) != NULL)
+    depth_frame_release (frame);
+
+  depth_frame_queue_free (self->frame_queue);
+  depth_frame_ring_free (self->frame_ring);
+
+  depth_replay_free (self->replay);
+  depth_synth_free (self->synth);
+  depth_background_free (self->background);
+  depth_filter_free (self->filter);
+  depth_components_free (self->components);
+  depth_workers_free (self->workers);
+  depth_recorder_free (self->recorder);
+  g_free (self->converted);
+
+  if (self->error != NULL)
+    g_error_free (self->error);
+
+  g_slice_free (DepthCapture, self);
+}
+
+/* Returns the oldest preprocessed frame not yet consumed, or NULL.
+   The caller owns the frame until it calls depth_frame_release(). To
+   be called from the main context only. */
+DepthFrame *
+depth_capture_pop_frame (DepthCapture *self)
+{
+  return depth_frame_queue_pop (self->frame_queue);
+}
+
+/* While disabled, frames are not preprocessed, and replays and
+   generators stop where they are */
+void
+depth_capture_set_enabled (DepthCapture *self, gboolean enabled)
+{
+  GSource *source;
+
+  g_atomic_int_set (&self->enabled, enabled);
+
+  if (! enabled || (self->replay == NULL && self->synth == NULL))
+    return;
+
+  source = g_idle_source_new ();
+  g_source_set_callback (source, resume_frames, self, NULL);
+  g_source_attach (source, self->context);
+  g_source_unref (source);
+}
+
+void
+depth_capture_set_reduction (DepthCapture *self,
+                             guint         dimension_factor,
+                             guint         threshold_begin,
+                             guint         threshold_end)
+{
+  g_return_if_fail (dimension_factor > 0);
+
+  g_atomic_int_set (&self->dimension_factor, dimension_factor);
+  g_atomic_int_set (&self->threshold_begin, threshold_begin);
+  g_atomic_int_set (&self->threshold_end, threshold_end);
+}
+
+/* How blocks of depth pixels become reduced pixels, see DepthSampling */
+void
+depth_capture_set_sampling (DepthCapture *self, DepthSampling sampling)
+{
+  g_atomic_int_set (&self->sampling, sampling);
+}
+
+/* Enables the temporal filter, see depth-filter.c */
+void
+depth_capture_set_filter (DepthCapture *self, gboolean enabled)
+{
+  g_atomic_int_set (&self->filter_enabled, enabled);
+}
+
+/* With @subtract, pixels that are not in front of the learnt
+   background are dropped from the reduced frames. The background is
+   only learnt while @learn is set, which must only be the case while
+   the scene is empty. */
+void
+depth_capture_set_background (DepthCapture *self,
+                              gboolean      subtract,
+                              gboolean      learn)
+{
+  g_atomic_int_set (&self->subtract_background, subtract);
+  g_atomic_int_set (&self->learn_background, learn);
+}
+
+/* Number of threads that preprocess every frame, the capture thread
+   included, or 0 (the default) for one for every processor. Applies
+   from the next frame on. */
+void
+depth_capture_set_n_threads (DepthCapture *self, guint n_threads)
+{
+  g_atomic_int_set (&self->n_threads, n_threads);
+}
+
+/* With @isolate, only the object in the reduced frames most likely to
+   be the visitor is left for tracking, see depth-components.c */
+void
+depth_capture_set_isolate_visitor (DepthCapture *self, gboolean isolate)
+{
+  g_atomic_int_set (&self->isolate_visitor, isolate);
+}
+
+/* Up to how many visitors are tracked apart, when isolating them. Each
+   object of the reduced frames that may be a visitor, the nearest
+   ones first, is given a region of its own (see DepthRegion). With 1,
+   the default, only the visitor being followed is left in the frames
+   instead. */
+void
+depth_capture_set_max_visitors (DepthCapture *self, guint max_visitors)
+{
+  g_atomic_int_set (&self->max_visitors, max_visitors);
+}
+
+/* Where the visitor being tracked was last seen, in pixels of the
+   (rotated) full resolution frame, which the isolation keeps
+   following; negative coordinates when nobody is being tracked */
+void
+depth_capture_set_visitor_position (DepthCapture *self, gint x, gint y)
+{
+  g_atomic_int_set (&self->visitor_x, x);
+  g_atomic_int_set (&self->visitor_y, y);
+}
+
+/* How many frames the main context may hold at once, besides the
+   newest one it was sent, before frames get dropped. Must be called
+   before depth_capture_start(). */
+void
+depth_capture_set_frames_held (DepthCapture *self, guint n_frames)
+{
+  g_return_if_fail (self->thread == NULL);
+
+  self->ring_size = n_frames + 2;
+
+  depth_frame_queue_free (self->frame_queue);
+  self->frame_queue = depth_frame_queue_new (self->ring_size);
+}
+
+void
+depth_capture_set_keep_raw (DepthCapture *self, gboolean keep_raw)
+{
+  g_atomic_int_set (&self->keep_raw, keep_raw);
+}
+
+/* Number of frames received from the device, the replay or the
+   generator */
+guint
+depth_capture_get_frame_count (DepthCapture *self)
+{
+  return (guint) g_atomic_int_get (&self->frame_count);
+}
+
+/* Number of frames preprocessed, which leaves out those received while
+   disabled and those dropped */
+guint
+depth_capture_get_processed_count (DepthCapture *self)
+{
+  return (guint) g_atomic_int_get (&self->processed_count);
+}
+
+/* Number of frames skipped because the main context still held every
+   slot of the ring */
+guint
+depth_capture_get_dropped_count (DepthCapture *self)
+{
+  return (guint) g_atomic_int_get (&self->dropped_count);
+}
@@ -0,0 +1,118 @@
+/*
+ * depth-capture.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_CAPTURE_H__
+#define __DEPTH_CAPTURE_H__
+
+#include <gfreenect.h>
+#include "depth-frame.h"
+#include "depth-synth.h"
+
+G_BEGIN_DECLS
+
+typedef struct _DepthCapture DepthCapture;
+
+/* Both callbacks are invoked in the main context that created the
+   capture, never in the capture thread */
+typedef void (*DepthCaptureReadyFunc) (DepthCapture *capture,
+                                       GError       *error,
+                                       gpointer      user_data);
+
+typedef void (*DepthCaptureFrameFunc) (DepthCapture *capture,
+                                       gpointer      user_data);
+
+DepthCapture * depth_capture_new                   (gint                   device_index,
+                                                    DepthCaptureFrameFunc  frame_cb,
+                                                    gpointer               user_data);
+
+gboolean       depth_capture_set_replay            (DepthCapture          *self,
+                                                    const gchar           *path,
+                                                    gboolean               realtime,
+                                                    GError               **error);
+
+void           depth_capture_set_synth             (DepthCapture          *self,
+                                                    DepthSynth            *synth,
+                                                    guint                  fps);
+
+void           depth_capture_set_disparity         (DepthCapture          *self,
+                                                    gboolean               disparity);
+
+gboolean       depth_capture_start_recording       (DepthCapture          *self,
+                                                    const gchar           *path,
+                                                    gboolean               compress,
+                                                    GError               **error);
+
+void           depth_capture_start                 (DepthCapture          *self,
+                                                    DepthCaptureReadyFunc  ready_cb,
+                                                    gpointer               user_data);
+
+void           depth_capture_free                  (DepthCapture *self);
+
+DepthFrame *   depth_capture_pop_frame             (DepthCapture *self);
+
+void           depth_capture_set_enabled           (DepthCapture *self,
+                                                    gboolean      enabled);
+
+void           depth_capture_set_reduction         (DepthCapture *self,
+                                                    guint         dimension_factor,
+                                                    guint         threshold_begin,
+                                                    guint         threshold_end);
+
+void           depth_capture_set_sampling          (DepthCapture *self,
+                                                    DepthSampling sampling);
+
+void           depth_capture_set_filter            (DepthCapture *self,
+                                                    gboolean      enabled);
+
+void           depth_capture_set_background        (DepthCapture *self,
+                                                    gboolean      subtract,
+                                                    gboolean      learn);
+
+void           depth_capture_set_n_threads         (DepthCapture *self,
+                                                    guint         n_threads);
+
+void           depth_capture_set_isolate_visitor   (DepthCapture *self,
+                                                    gboolean      isolate);
+
+void           depth_capture_set_max_visitors      (DepthCapture *self,
+                                                    guint         max_visitors);
+
+void           depth_capture_set_visitor_position  (DepthCapture *self,
+                                                    gint          x,
+                                                    gint          y);
+
+void           depth_capture_set_frames_held       (DepthCapture *self,
+                                                    guint         n_frames);
+
+void           depth_capture_set_keep_raw          (DepthCapture *self,
+                                                    gboolean      keep_raw);
+
+guint          depth_capture_get_frame_count       (DepthCapture *self);
+
+guint          depth_capture_get_processed_count   (DepthCapture *self);
+
+guint          depth_capture_get_dropped_count     (DepthCapture *self);
+
+G_END_DECLS
+
+#endif /* __DEPTH_CAPTURE_H__ */
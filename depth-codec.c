@@ -0,0 +1,440 @@
+/*
+ * depth-codec.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#include "depth-codec.h"
+
+#include <string.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* Lossless depth frame codec.
+
+   Every pixel is predicted, from the same pixel in the previous frame
+   or, on key frames, from its left neighbour (the pixel above for the
+   first column). Residuals are zigzag encoded and then bit-packed in
+   blocks of 16: one byte holding the bit width of the block followed
+   by 16 values of that width. Runs of all-zero blocks, the static
+   background, collapse into a single byte with the high bit set and
+   the run length minus one in the low bits. */
+
+#define BLOCK_SIZE 16
+#define MAX_ZERO_RUN 128
+#define ZERO_RUN_FLAG 0x80
+
+/* a key frame every second at 30 fps, so replay can restart anywhere
+   close to where it is asked to */
+#define KEYFRAME_INTERVAL 30
+
+struct _DepthEncoder
+{
+  gint width;
+  gint height;
+  gsize n_pixels;
+
+  guint16 *previous;
+  guint16 *residuals;
+  guint frame_count;
+};
+
+struct _DepthDecoder
+{
+  gint width;
+  gint height;
+  gsize n_pixels;
+
+  guint16 *frame;
+  guint16 *residuals;
+  gboolean has_frame;
+};
+
+static inline guint16
+zigzag (guint16 residual)
+{
+  return (guint16) ((residual << 1) ^ (guint16) ((gint16) residual >> 15));
+}
+
+static inline guint16
+unzigzag (guint16 value)
+{
+  return (value >> 1) ^ (guint16) - (gint16) (value & 1);
+}
+
+static guint
+bit_width (guint16 value)
+{
+  return value == 0 ? 0 : 32 - __builtin_clz (value);
+}
+
+DepthEncoder *
+depth_encoder_new (gint width, gint height)
+{
+  DepthEncoder *self;
+
+  self = g_slice_new0 (DepthEncoder);
+  self->width = width;
+  self->height = height;
+  self->n_pixels = width * height;
+
+  /* rounded up to whole blocks, the padding is always zero */
+  self->previous = g_new0 (guint16, self->n_pixels);
+  self->residuals = g_new0 (guint16, self->n_pixels + BLOCK_SIZE);
+
+  return self;
+}
+
+void
+depth_encoder_free (DepthEncoder *self)
+{
+  if (self == NULL)
+    return;
+
+  g_free (self->previous);
+  g_free (self->residuals);
+  g_slice_free (DepthEncoder, self);
+}
+
+/* Upper bound of the encoded size of a frame */
+gsize
+depth_encoder_get_max_size (DepthEncoder *self)
+{
+  gsize n_blocks = (self->n_pixels + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+  return n_blocks * (1 + BLOCK_SIZE * sizeof (guint16));
+}
+
+static gsize
+pack_residuals (const guint16 *residuals, gsize n_pixels, guint8 *data)
+{
+  gsize i, n_blocks, p = 0;
+  guint zero_run = 0;
+
+  n_blocks = (n_pixels + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+  for (i = 0; i < n_blocks; i++)
+    {
+      const guint16 *block = residuals + i * BLOCK_SIZE;
+      guint16 all = 0;
+      guint32 acc = 0;
+      guint j, width, n_bits = 0;
+
+      for (j = 0; j < BLOCK_SIZE; j++)
+        all |= block[j];
+
+      width = bit_width (all);
+
+      if (width == 0)
+        {
+          if (++zero_run == MAX_ZERO_RUN)
+            {
+              data[p++] = ZERO_RUN_FLAG | (zero_run - 1);
+              zero_run = 0;
+            }
+          continue;
+        }
+
+      if (zero_run > 0)
+        {
+          data[p++] = ZERO_RUN_FLAG | (zero_run - 1);
+          zero_run = 0;
+        }
+
+      data[p++] = width;
+      for (j = 0; j < BLOCK_SIZE; j++)
+        {
+          acc |= (guint32) block[j] << n_bits;
+          n_bits += width;
+          while (n_bits >= 8)
+            {
+              data[p++] = acc & 0xff;
+              acc >>= 8;
+              n_bits -= 8;
+            }
+        }
+    }
+
+  if (zero_run > 0)
+    data[p++] = ZERO_RUN_FLAG | (zero_run - 1);
+
+  return p;
+}
+
+/* Encodes @depth into @data, which must hold at least
+   depth_encoder_get_max_size() bytes. Returns the encoded size, and
+   whether the frame was encoded as a key frame. */
+gsize
+depth_encoder_encode (DepthEncoder  *self,
+                      const guint16 *depth,
+                      guint8        *data,
+                      gboolean      *keyframe)
+{
+  guint16 *residuals = self->residuals;
+  gsize i;
+  gboolean key;
+
+  key = (self->frame_count % KEYFRAME_INTERVAL) == 0;
+  self->frame_count++;
+
+  if (key)
+    {
+      gint x, y;
+
+      for (y = 0; y < self->height; y++)
+        {
+          const guint16 *row = depth + y * self->width;
+          guint16 predicted = y > 0 ? row[- self->width] : 0;
+
+          for (x = 0; x < self->width; x++)
+            {
+              residuals[y * self->width + x] = zigzag (row[x] - predicted);
+              predicted = row[x];
+            }
+        }
+    }
+  else
+    {
+      for (i = 0; i < self->n_pixels; i++)
+        residuals[i] = zigzag (depth[i] - self->previous[i]);
+    }
+
+  memcpy (self->previous, depth, self->n_pixels * sizeof (guint16));
+
+  if (keyframe != NULL)
+    *keyframe = key;
+
+  return pack_residuals (residuals, self->n_pixels, data);
+}
+
+DepthDecoder *
+depth_decoder_new (gint width, gint height)
+{
+  DepthDecoder *self;
+
+  self = g_slice_new0 (DepthDecoder);
+  self->width = width;
+  self->height = height;
+  self->n_pixels = width * height;
+
+  self->frame = g_new0 (guint16, self->n_pixels);
+  self->residuals = g_new0 (guint16, self->n_pixels + BLOCK_SIZE);
+
+  return self;
+}
+
+void
+depth_decoder_free (DepthDecoder *self)
+{
+  if (self == NULL)
+    return;
+
+  g_free (self->frame);
+  g_free (self->residuals);
+  g_slice_free (DepthDecoder, self);
+}
+
+static gboolean
+unpack_residuals (const guint8 *data,
+                  gsize         size,
+                  guint16      *residuals,
+                  gsize         n_pixels)
+{
+  gsize p = 0, n = 0;
+
+  while (n < n_pixels)
+    {
+      guint token, width, j, n_bits = 0;
+      guint64 acc = 0, mask;
+
+      if (p >= size)
+        return FALSE;
+
+      token = data[p++];
+
+      if (token & ZERO_RUN_FLAG)
+        {
+          gsize run = ((token & ~ZERO_RUN_FLAG) + 1) * BLOCK_SIZE;
+
+          if (n + run > n_pixels + BLOCK_SIZE)
+            return FALSE;
+
+          memset (residuals + n, 0, run * sizeof (guint16));
+          n += run;
+          continue;
+        }
+
+      width = token;
+      if (width > 16 || p + width * 2 > size)
+        return FALSE;
+
+      mask = (G_GUINT64_CONSTANT (1) << width) - 1;
+      for (j = 0; j < BLOCK_SIZE; j++)
+        {
+          while (n_bits < width)
+            {
+              acc |= (guint64) data[p++] << n_bits;
+              n_bits += 8;
+            }
+          residuals[n + j] = acc & mask;
+          acc >>= width;
+          n_bits -= width;
+        }
+      n += BLOCK_SIZE;
+    }
+
+  return TRUE;
+}
+
+static void
+apply_delta_scalar (guint16 *frame, const guint16 *residuals, gsize n_pixels)
+{
+  gsize i;
+
+  for (i = 0; i < n_pixels; i++)
+    frame[i] += unzigzag (residuals[i]);
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__ ((target ("sse2")))
+static void
+apply_delta_sse2 (guint16 *frame, const guint16 *residuals, gsize n_pixels)
+{
+  __m128i one, zero;
+  gsize i;
+
+  one = _mm_set1_epi16 (1);
+  zero = _mm_setzero_si128 ();
+
+  for (i = 0; i + 8 <= n_pixels; i += 8)
+    {
+      __m128i value, delta;
+
+      value = _mm_loadu_si128 ((__m128i *) (residuals + i));
+      delta = _mm_xor_si128 (_mm_srli_epi16 (value, 1),
+                             _mm_sub_epi16 (zero, _mm_and_si128 (value, one)));
+      _mm_storeu_si128 ((__m128i *) (frame + i),
+                        _mm_add_epi16 (_mm_loadu_si128 ((__m128i *) (frame + i)),
+                                       delta));
+    }
+
+  apply_delta_scalar (frame + i, residuals + i, n_pixels - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+apply_delta_avx2 (guint16 *frame, const guint16 *residuals, gsize n_pixels)
+{
+  __m256i one, zero;
+  gsize i;
+
+  one = _mm256_set1_epi16 (1);
+  zero = _mm256_setzero_si256 ();
+
+  for (i = 0; i + 16 <= n_pixels; i += 16)
+    {
+      __m256i value, delta;
+
+      value = _mm256_loadu_si256 ((__m256i *) (residuals + i));
+      delta = _mm256_xor_si256 (_mm256_srli_epi16 (value, 1),
+                                _mm256_sub_epi16 (zero,
+                                                  _mm256_and_si256 (value, one)));
+      _mm256_storeu_si256 ((__m256i *) (frame + i),
+                           _mm256_add_epi16 (_mm256_loadu_si256 ((__m256i *) (frame + i)),
+                                             delta));
+    }
+
+  apply_delta_sse2 (frame + i, residuals + i, n_pixels - i);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static void
+apply_delta (guint16 *frame, const guint16 *residuals, gsize n_pixels)
+{
+#ifdef HAVE_X86_SIMD
+  static gint level = -1;
+
+  if (level < 0)
+    {
+      __builtin_cpu_init ();
+      level = __builtin_cpu_supports ("avx2") ? 2 :
+        __builtin_cpu_supports ("sse2") ? 1 : 0;
+    }
+
+  if (level == 2)
+    apply_delta_avx2 (frame, residuals, n_pixels);
+  else if (level == 1)
+    apply_delta_sse2 (frame, residuals, n_pixels);
+  else
+#endif
+    apply_delta_scalar (frame, residuals, n_pixels);
+}
+
+/* Decodes the next frame of a sequence. Frames must be decoded in the
+   order they were encoded, starting at a key frame. Returns the
+   decoded frame, owned by the decoder and valid until the next call,
+   or NULL if the data is corrupt or no key frame was seen yet. */
+const guint16 *
+depth_decoder_decode (DepthDecoder *self,
+                      const guint8 *data,
+                      gsize         size,
+                      gboolean      keyframe)
+{
+  if (! keyframe && ! self->has_frame)
+    return NULL;
+
+  if (! unpack_residuals (data, size, self->residuals, self->n_pixels))
+    {
+      self->has_frame = FALSE;
+      return NULL;
+    }
+
+  if (keyframe)
+    {
+      gint x, y;
+
+      for (y = 0; y < self->height; y++)
+        {
+          guint16 *row = self->frame + y * self->width;
+          const guint16 *residuals = self->residuals + y * self->width;
+          guint16 value = y > 0 ? row[- self->width] : 0;
+
+          for (x = 0; x < self->width; x++)
+            {
+              value += unzigzag (residuals[x]);
+              row[x] = value;
+            }
+        }
+    }
+  else
+    {
+      /* the previous frame is the prediction, update it in place */
+      apply_delta (self->frame, self->residuals, self->n_pixels);
+    }
+
+  self->has_frame = TRUE;
+
+  return self->frame;
+}
@@ -0,0 +1,58 @@
+/*
+ * depth-codec.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_CODEC_H__
+#define __DEPTH_CODEC_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DepthEncoder DepthEncoder;
+typedef struct _DepthDecoder DepthDecoder;
+
+DepthEncoder * depth_encoder_new          (gint           width,
+                                           gint           height);
+
+void           depth_encoder_free         (DepthEncoder  *self);
+
+gsize          depth_encoder_get_max_size (DepthEncoder  *self);
+
+gsize          depth_encoder_encode       (DepthEncoder  *self,
+                                           const guint16 *depth,
+                                           guint8        *data,
+                                           gboolean      *keyframe);
+
+DepthDecoder * depth_decoder_new          (gint           width,
+                                           gint           height);
+
+void           depth_decoder_free         (DepthDecoder  *self);
+
+const guint16 *depth_decoder_decode       (DepthDecoder  *self,
+                                           const guint8  *data,
+                                           gsize          size,
+                                           gboolean       keyframe);
+
+G_END_DECLS
+
+#endif /* __DEPTH_CODEC_H__ */
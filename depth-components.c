@@ -0,0 +1,467 @@
+/*
+ * depth-components.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+/* Splits a reduced frame into the separate objects in it, so that when
+   several people stand in front of the installation only one of them
+   is tracked, or each of them on their own. Pixels belong to the same
+   object when they touch, diagonals included, and their depths are
+   close enough; labels come from a single union-find pass followed by
+   a flattening one. */
+
+#include "depth-components.h"
+
+/* neighbours further apart than this in depth are different objects,
+   in millimetres: steeper than any slope of a body at the coarsest
+   reduction, shallower than the gap between two people */
+#define DEPTH_STEP 200
+
+/* objects smaller than this part of the largest one are noise, not
+   visitors */
+#define MIN_AREA_RATIO .25
+
+#define NO_LABEL G_MAXUINT32
+
+typedef struct
+{
+  guint area;
+  guint64 depth_sum;
+  gint64 x_sum;
+  gint64 y_sum;
+  gint left;
+  gint top;
+  gint right;
+  gint bottom;
+} Component;
+
+struct _DepthComponents
+{
+  /* for every pixel, the union-find parent and, once flattened, the
+     label of its component */
+  guint32 *labels;
+  gsize n_pixels;
+
+  GArray *components;
+
+  /* labels of the objects the frame was split into, nearest first */
+  GArray *objects;
+};
+
+static guint32
+find_root (guint32 *parents, guint32 i)
+{
+  while (parents[i] != i)
+    {
+      /* path halving */
+      parents[i] = parents[parents[i]];
+      i = parents[i];
+    }
+
+  return i;
+}
+
+/* The root of a set is always its lowest index, which the flattening
+   relies upon */
+static void
+join (guint32 *parents, guint32 a, guint32 b)
+{
+  a = find_root (parents, a);
+  b = find_root (parents, b);
+
+  if (a < b)
+    parents[b] = a;
+  else if (b < a)
+    parents[a] = b;
+}
+
+static gboolean
+are_connected (guint16 a, guint16 b)
+{
+  return b != 0 && ABS ((gint) a - (gint) b) <= DEPTH_STEP;
+}
+
+/* Labels every pixel with depth, and returns the number of labels */
+static guint
+label (DepthComponents *self,
+       const guint16   *reduced,
+       gint             width,
+       gint             height)
+{
+  guint32 *labels = self->labels;
+  guint32 n_labels, i;
+  gint x, y;
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      {
+        guint16 value;
+
+        i = y * width + x;
+        value = reduced[i];
+        if (value == 0)
+          {
+            labels[i] = NO_LABEL;
+            continue;
+          }
+
+        labels[i] = i;
+
+        /* only the neighbours already visited */
+        if (x > 0 && are_connected (value, reduced[i - 1]))
+          join (labels, i, i - 1);
+        if (y > 0)
+          {
+            if (x > 0 && are_connected (value, reduced[i - width - 1]))
+              join (labels, i, i - width - 1);
+            if (are_connected (value, reduced[i - width]))
+              join (labels, i, i - width);
+            if (x + 1 < width && are_connected (value, reduced[i - width + 1]))
+              join (labels, i, i - width + 1);
+          }
+      }
+
+  /* parents come before their children, so a single pass in order
+     replaces every parent by the label its root got */
+  n_labels = 0;
+  for (i = 0; i < (guint32) (width * height); i++)
+    {
+      if (labels[i] == NO_LABEL)
+        continue;
+
+      if (labels[i] == i)
+        labels[i] = n_labels++;
+      else
+        labels[i] = labels[labels[i]];
+    }
+
+  return n_labels;
+}
+
+static void
+measure (DepthComponents *self,
+         const guint16   *reduced,
+         gint             width,
+         gint             height,
+         guint            n_labels)
+{
+  Component *components;
+  guint l;
+  gint x, y;
+
+  g_array_set_size (self->components, n_labels);
+  components = (Component *) self->components->data;
+
+  for (l = 0; l < n_labels; l++)
+    {
+      Component *component = &components[l];
+
+      component->area = 0;
+      component->depth_sum = 0;
+      component->x_sum = 0;
+      component->y_sum = 0;
+      component->left = width;
+      component->top = height;
+      component->right = -1;
+      component->bottom = -1;
+    }
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      {
+        guint32 i = y * width + x;
+        Component *component;
+
+        if (self->labels[i] == NO_LABEL)
+          continue;
+
+        component = &components[self->labels[i]];
+        component->area++;
+        component->depth_sum += reduced[i];
+        component->x_sum += x;
+        component->y_sum += y;
+        component->left = MIN (component->left, x);
+        component->top = MIN (component->top, y);
+        component->right = MAX (component->right, x);
+        component->bottom = MAX (component->bottom, y);
+      }
+}
+
+/* Among the objects big enough to be a visitor, the one under the
+   target or, failing that, closest to it; without a target, the
+   nearest to the camera */
+static guint
+choose (DepthComponents *self,
+        gint             width,
+        gint             height,
+        gint             target_x,
+        gint             target_y)
+{
+  const Component *components;
+  guint l, largest_area, chosen;
+  gdouble best;
+  gboolean has_target;
+
+  components = (const Component *) self->components->data;
+
+  largest_area = 0;
+  for (l = 0; l < self->components->len; l++)
+    largest_area = MAX (largest_area, components[l].area);
+
+  has_target = target_x >= 0 && target_x < width &&
+    target_y >= 0 && target_y < height;
+
+  if (has_target)
+    {
+      guint32 target_label = self->labels[target_y * width + target_x];
+
+      if (target_label != NO_LABEL &&
+          components[target_label].area >= largest_area * MIN_AREA_RATIO)
+        {
+          return target_label;
+        }
+    }
+
+  chosen = 0;
+  best = G_MAXDOUBLE;
+  for (l = 0; l < self->components->len; l++)
+    {
+      const Component *component = &components[l];
+      gdouble cost;
+
+      if (component->area < largest_area * MIN_AREA_RATIO)
+        continue;
+
+      if (has_target)
+        {
+          gdouble dx, dy;
+
+          dx = (gdouble) component->x_sum / component->area - target_x;
+          dy = (gdouble) component->y_sum / component->area - target_y;
+          cost = dx * dx + dy * dy;
+        }
+      else
+        {
+          cost = (gdouble) component->depth_sum / component->area;
+        }
+
+      if (cost < best)
+        {
+          best = cost;
+          chosen = l;
+        }
+    }
+
+  return chosen;
+}
+
+static gint
+compare_depth (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  const Component *components = (const Component *) user_data;
+  const Component *component_a = &components[*(const guint *) a];
+  const Component *component_b = &components[*(const guint *) b];
+  gdouble depth_a, depth_b;
+
+  depth_a = (gdouble) component_a->depth_sum / component_a->area;
+  depth_b = (gdouble) component_b->depth_sum / component_b->area;
+
+  return depth_a < depth_b ? -1 : depth_a > depth_b;
+}
+
+/* public methods */
+
+/* Creates the scratch space to split reduced frames of up to @width x
+   @height pixels */
+DepthComponents *
+depth_components_new (gint width, gint height)
+{
+  DepthComponents *self;
+
+  self = g_slice_new0 (DepthComponents);
+  self->n_pixels = width * height;
+  self->labels = g_new (guint32, self->n_pixels);
+  self->components = g_array_new (FALSE, FALSE, sizeof (Component));
+  self->objects = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  return self;
+}
+
+void
+depth_components_free (DepthComponents *self)
+{
+  if (self == NULL)
+    return;
+
+  g_free (self->labels);
+  g_array_free (self->components, TRUE);
+  g_array_free (self->objects, TRUE);
+
+  g_slice_free (DepthComponents, self);
+}
+
+/* Leaves in the thresholded, reduced frame only the object most likely
+   to be the visitor and clears the rest. (@target_x, @target_y) is
+   where the visitor was last seen, in reduced pixels, or outside the
+   frame if nobody is being followed. @foreground is set to the
+   bounding box of what is left, with a width of 0 if nothing is.
+   Returns the number of objects the frame had. */
+guint
+depth_components_isolate (DepthComponents *self,
+                          guint16         *reduced,
+                          gint             width,
+                          gint             height,
+                          gint             target_x,
+                          gint             target_y,
+                          DepthBox        *foreground)
+{
+  const Component *component;
+  guint n_labels, chosen;
+  gint i;
+
+  g_return_val_if_fail ((gsize) (width * height) <= self->n_pixels, 0);
+
+  n_labels = label (self, reduced, width, height);
+  if (n_labels == 0)
+    {
+      foreground->x = foreground->y = 0;
+      foreground->width = foreground->height = 0;
+      return 0;
+    }
+
+  measure (self, reduced, width, height, n_labels);
+  chosen = choose (self, width, height, target_x, target_y);
+
+  if (n_labels > 1)
+    {
+      for (i = 0; i < width * height; i++)
+        {
+          if (self->labels[i] != chosen)
+            reduced[i] = 0;
+        }
+    }
+
+  component = &g_array_index (self->components, Component, chosen);
+  foreground->x = component->left;
+  foreground->y = component->top;
+  foreground->width = component->right - component->left + 1;
+  foreground->height = component->bottom - component->top + 1;
+
+  return n_labels;
+}
+
+/* Splits the thresholded, reduced frame into the objects big enough to
+   be visitors, keeping the @max_objects nearest to the camera. The
+   frame is left as it is; every object can then be measured with
+   depth_components_get_object() and copied apart with
+   depth_components_copy_object(), the nearest being object 0.
+   Returns the number of objects kept. */
+guint
+depth_components_split (DepthComponents *self,
+                        const guint16   *reduced,
+                        gint             width,
+                        gint             height,
+                        guint            max_objects)
+{
+  const Component *components;
+  guint n_labels, largest_area, l;
+
+  g_return_val_if_fail ((gsize) (width * height) <= self->n_pixels, 0);
+
+  g_array_set_size (self->objects, 0);
+
+  n_labels = label (self, reduced, width, height);
+  if (n_labels == 0)
+    return 0;
+
+  measure (self, reduced, width, height, n_labels);
+  components = (const Component *) self->components->data;
+
+  largest_area = 0;
+  for (l = 0; l < n_labels; l++)
+    largest_area = MAX (largest_area, components[l].area);
+
+  for (l = 0; l < n_labels; l++)
+    {
+      if (components[l].area >= largest_area * MIN_AREA_RATIO)
+        g_array_append_val (self->objects, l);
+    }
+
+  g_array_sort_with_data (self->objects, compare_depth, (gpointer) components);
+  if (self->objects->len > max_objects)
+    g_array_set_size (self->objects, max_objects);
+
+  return self->objects->len;
+}
+
+/* The bounding box of object @n of the last split, how many pixels it
+   has and their centre, in pixels of the frame split */
+void
+depth_components_get_object (DepthComponents *self,
+                             guint            n,
+                             DepthBox        *box,
+                             guint           *area,
+                             gfloat          *x,
+                             gfloat          *y)
+{
+  const Component *component;
+
+  g_return_if_fail (n < self->objects->len);
+
+  component = &g_array_index (self->components,
+                              Component,
+                              g_array_index (self->objects, guint, n));
+
+  box->x = component->left;
+  box->y = component->top;
+  box->width = component->right - component->left + 1;
+  box->height = component->bottom - component->top + 1;
+  *area = component->area;
+  *x = (gfloat) component->x_sum / component->area;
+  *y = (gfloat) component->y_sum / component->area;
+}
+
+/* Copies the @box region of the last split of @reduced, @width pixels
+   wide, packed into @object, with everything but object @n cleared */
+void
+depth_components_copy_object (DepthComponents *self,
+                              guint            n,
+                              const guint16   *reduced,
+                              gint             width,
+                              const DepthBox  *box,
+                              guint16         *object)
+{
+  guint32 object_label;
+  gint x, y;
+
+  g_return_if_fail (n < self->objects->len);
+
+  object_label = g_array_index (self->objects, guint, n);
+
+  for (y = box->y; y < box->y + box->height; y++)
+    {
+      const guint32 *labels = self->labels + y * width;
+      const guint16 *row = reduced + y * width;
+
+      for (x = box->x; x < box->x + box->width; x++)
+        *object++ = labels[x] == object_label ? row[x] : 0;
+    }
+}
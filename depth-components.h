@@ -0,0 +1,69 @@
+/*
+ * depth-components.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_COMPONENTS_H__
+#define __DEPTH_COMPONENTS_H__
+
+#include <glib.h>
+#include "depth-process.h"
+
+G_BEGIN_DECLS
+
+typedef struct _DepthComponents DepthComponents;
+
+DepthComponents * depth_components_new     (gint             width,
+                                            gint             height);
+
+void              depth_components_free    (DepthComponents *self);
+
+guint             depth_components_isolate (DepthComponents *self,
+                                            guint16         *reduced,
+                                            gint             width,
+                                            gint             height,
+                                            gint             target_x,
+                                            gint             target_y,
+                                            DepthBox        *foreground);
+
+guint             depth_components_split   (DepthComponents *self,
+                                            const guint16   *reduced,
+                                            gint             width,
+                                            gint             height,
+                                            guint            max_objects);
+
+void              depth_components_get_object (DepthComponents *self,
+                                               guint            n,
+                                               DepthBox        *box,
+                                               guint           *area,
+                                               gfloat          *x,
+                                               gfloat          *y);
+
+void              depth_components_copy_object (DepthComponents *self,
+                                                guint            n,
+                                                const guint16   *reduced,
+                                                gint             width,
+                                                const DepthBox  *box,
+                                                guint16         *object);
+
+G_END_DECLS
+
+#endif /* __DEPTH_COMPONENTS_H__ */
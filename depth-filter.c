@@ -0,0 +1,284 @@
+/*
+ * depth-filter.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+/* Temporal filter over the last three raw frames: every pixel becomes
+   the median of its three samples, which removes the flicker along
+   edges, after filling the samples with no reading (0) from the
+   others, which fills the holes of the current frame from the most
+   recent valid reading. The history lives in two preallocated
+   frames, the oldest of which is overwritten with the current frame
+   in the same pass. */
+
+#include "depth-filter.h"
+
+#include <string.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef void (*FilterFunc) (const guint16 *current,
+                            const guint16 *previous,
+                            guint16       *oldest,
+                            guint16       *output,
+                            gint           length);
+
+struct _DepthFilter
+{
+  gint n_pixels;
+
+  /* @history[newest] is the previous frame, the other one the frame
+     before it */
+  guint16 *history[2];
+  guint newest;
+
+  guint16 *output;
+};
+
+static void
+filter_scalar (const guint16 *current,
+               const guint16 *previous,
+               guint16       *oldest,
+               guint16       *output,
+               gint           length)
+{
+  gint i;
+
+  for (i = 0; i < length; i++)
+    {
+      guint a, b, c;
+
+      a = current[i];
+      b = previous[i];
+      c = oldest[i];
+
+      oldest[i] = a;
+
+      a = a != 0 ? a : (b != 0 ? b : c);
+      b = b != 0 ? b : a;
+      c = c != 0 ? c : a;
+
+      output[i] = MAX (MIN (a, b), MIN (MAX (a, b), c));
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* SSE2 only has signed 16 bit min/max, so values are biased by 0x8000
+   to keep their unsigned order */
+
+__attribute__ ((target ("sse2")))
+static void
+filter_sse2 (const guint16 *current,
+             const guint16 *previous,
+             guint16       *oldest,
+             guint16       *output,
+             gint           length)
+{
+  __m128i bias;
+  gint i;
+
+  bias = _mm_set1_epi16 ((gint16) 0x8000);
+
+  for (i = 0; i + 8 <= length; i += 8)
+    {
+      __m128i raw, a, b, c, hole_a, hole_b, hole_c, filled, median;
+
+      raw = _mm_loadu_si128 ((__m128i *) (current + i));
+      a = _mm_xor_si128 (raw, bias);
+      b = _mm_xor_si128 (_mm_loadu_si128 ((__m128i *) (previous + i)), bias);
+      c = _mm_xor_si128 (_mm_loadu_si128 ((__m128i *) (oldest + i)), bias);
+
+      _mm_storeu_si128 ((__m128i *) (oldest + i), raw);
+
+      /* a 0 reading is 0x8000 once biased */
+      hole_a = _mm_cmpeq_epi16 (a, bias);
+      hole_b = _mm_cmpeq_epi16 (b, bias);
+      hole_c = _mm_cmpeq_epi16 (c, bias);
+
+      filled = _mm_or_si128 (_mm_and_si128 (hole_b, c),
+                             _mm_andnot_si128 (hole_b, b));
+      a = _mm_or_si128 (_mm_and_si128 (hole_a, filled),
+                        _mm_andnot_si128 (hole_a, a));
+      b = _mm_or_si128 (_mm_and_si128 (hole_b, a),
+                        _mm_andnot_si128 (hole_b, b));
+      c = _mm_or_si128 (_mm_and_si128 (hole_c, a),
+                        _mm_andnot_si128 (hole_c, c));
+
+      median = _mm_max_epi16 (_mm_min_epi16 (a, b),
+                              _mm_min_epi16 (_mm_max_epi16 (a, b), c));
+
+      _mm_storeu_si128 ((__m128i *) (output + i), _mm_xor_si128 (median, bias));
+    }
+
+  filter_scalar (current + i, previous + i, oldest + i, output + i, length - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+filter_avx2 (const guint16 *current,
+             const guint16 *previous,
+             guint16       *oldest,
+             guint16       *output,
+             gint           length)
+{
+  __m256i zero;
+  gint i;
+
+  zero = _mm256_setzero_si256 ();
+
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m256i a, b, c, hole_a, hole_b, hole_c, filled, median;
+
+      a = _mm256_loadu_si256 ((__m256i *) (current + i));
+      b = _mm256_loadu_si256 ((__m256i *) (previous + i));
+      c = _mm256_loadu_si256 ((__m256i *) (oldest + i));
+
+      _mm256_storeu_si256 ((__m256i *) (oldest + i), a);
+
+      hole_a = _mm256_cmpeq_epi16 (a, zero);
+      hole_b = _mm256_cmpeq_epi16 (b, zero);
+      hole_c = _mm256_cmpeq_epi16 (c, zero);
+
+      filled = _mm256_blendv_epi8 (b, c, hole_b);
+      a = _mm256_blendv_epi8 (a, filled, hole_a);
+      b = _mm256_blendv_epi8 (b, a, hole_b);
+      c = _mm256_blendv_epi8 (c, a, hole_c);
+
+      median = _mm256_max_epu16 (_mm256_min_epu16 (a, b),
+                                 _mm256_min_epu16 (_mm256_max_epu16 (a, b), c));
+
+      _mm256_storeu_si256 ((__m256i *) (output + i), median);
+    }
+
+  filter_sse2 (current + i, previous + i, oldest + i, output + i, length - i);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static FilterFunc
+get_filter_func (void)
+{
+  static FilterFunc func = NULL;
+
+  if (func != NULL)
+    return func;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    func = filter_avx2;
+  else if (__builtin_cpu_supports ("sse2"))
+    func = filter_sse2;
+  else
+#endif
+    func = filter_scalar;
+
+  return func;
+}
+
+/* public methods */
+
+DepthFilter *
+depth_filter_new (gint width, gint height)
+{
+  DepthFilter *self;
+
+  self = g_slice_new0 (DepthFilter);
+  self->n_pixels = width * height;
+
+  self->history[0] = g_new0 (guint16, self->n_pixels);
+  self->history[1] = g_new0 (guint16, self->n_pixels);
+  self->output = g_new0 (guint16, self->n_pixels);
+
+  return self;
+}
+
+void
+depth_filter_free (DepthFilter *self)
+{
+  if (self == NULL)
+    return;
+
+  g_free (self->history[0]);
+  g_free (self->history[1]);
+  g_free (self->output);
+
+  g_slice_free (DepthFilter, self);
+}
+
+/* Forgets the previous frames, for when the stream is interrupted */
+void
+depth_filter_reset (DepthFilter *self)
+{
+  memset (self->history[0], 0, self->n_pixels * sizeof (guint16));
+  memset (self->history[1], 0, self->n_pixels * sizeof (guint16));
+}
+
+/* Filters @depth, a frame of the size given at creation, against the
+   previous ones. The returned frame belongs to @self and is
+   overwritten by the next call. */
+const guint16 *
+depth_filter_process (DepthFilter *self, const guint16 *depth)
+{
+  depth_filter_process_pixels (self, depth, 0, self->n_pixels);
+  depth_filter_end_frame (self);
+
+  return self->output;
+}
+
+/* Filters pixels [@first, @first + @length) of @depth into the output
+   frame, so that a frame can be filtered in parts, from several
+   threads; once all of them are, depth_filter_end_frame() must be
+   called */
+void
+depth_filter_process_pixels (DepthFilter   *self,
+                             const guint16 *depth,
+                             gint           first,
+                             gint           length)
+{
+  guint oldest;
+
+  oldest = 1 - self->newest;
+  get_filter_func () (depth + first,
+                      self->history[self->newest] + first,
+                      self->history[oldest] + first,
+                      self->output + first,
+                      length);
+}
+
+void
+depth_filter_end_frame (DepthFilter *self)
+{
+  /* the oldest frame now holds the current one */
+  self->newest = 1 - self->newest;
+}
+
+/* The frame filtered last, or being filtered */
+const guint16 *
+depth_filter_get_output (DepthFilter *self)
+{
+  return self->output;
+}
@@ -0,0 +1,54 @@
+/*
+ * depth-filter.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_FILTER_H__
+#define __DEPTH_FILTER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DepthFilter DepthFilter;
+
+DepthFilter *   depth_filter_new            (gint           width,
+                                             gint           height);
+
+void            depth_filter_free           (DepthFilter   *self);
+
+void            depth_filter_reset          (DepthFilter   *self);
+
+const guint16 * depth_filter_process        (DepthFilter   *self,
+                                             const guint16 *depth);
+
+void            depth_filter_process_pixels (DepthFilter   *self,
+                                             const guint16 *depth,
+                                             gint           first,
+                                             gint           length);
+
+void            depth_filter_end_frame      (DepthFilter   *self);
+
+const guint16 * depth_filter_get_output     (DepthFilter   *self);
+
+G_END_DECLS
+
+#endif /* __DEPTH_FILTER_H__ */
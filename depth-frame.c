@@ -0,0 +1,205 @@
+/*
+ * depth-frame.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#include "depth-frame.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_BUFFER_ALIGNMENT 64
+
+static gpointer
+alloc_frame_buffer (gsize size)
+{
+  gpointer buffer = NULL;
+
+  if (posix_memalign (&buffer, FRAME_BUFFER_ALIGNMENT, size) != 0)
+    g_error ("Failed to allocate depth frame buffer");
+
+  /* touch every page now, so it doesn't fault in while streaming */
+  memset (buffer, 0, size);
+
+  return buffer;
+}
+
+/* Creates a ring of @n_frames preallocated frame slots, each able to
+   hold a @width x @height frame and any reduction of it. */
+DepthFrameRing *
+depth_frame_ring_new (guint n_frames, gint width, gint height)
+{
+  DepthFrameRing *ring;
+  guint i;
+
+  g_return_val_if_fail (n_frames > 0, NULL);
+
+  ring = g_slice_new0 (DepthFrameRing);
+  ring->n_frames = n_frames;
+  ring->capacity = width * height;
+  ring->frames = g_new0 (DepthFrame, n_frames);
+
+  for (i = 0; i < n_frames; i++)
+    {
+      DepthFrame *frame = &ring->frames[i];
+
+      frame->ring = ring;
+      frame->raw = alloc_frame_buffer (depth_pyramid_get_size (width, height) *
+                                       sizeof (guint16));
+      frame->reduced = alloc_frame_buffer (ring->capacity * sizeof (guint16));
+      frame->mask_bits = alloc_frame_buffer (depth_mask_get_size (width, height) *
+                                             sizeof (guint64));
+    }
+
+  return ring;
+}
+
+void
+depth_frame_ring_free (DepthFrameRing *ring)
+{
+  guint i;
+
+  if (ring == NULL)
+    return;
+
+  for (i = 0; i < ring->n_frames; i++)
+    {
+      free (ring->frames[i].raw);
+      free (ring->frames[i].reduced);
+      free (ring->frames[i].mask_bits);
+    }
+
+  g_free (ring->frames);
+  g_slice_free (DepthFrameRing, ring);
+}
+
+/* Returns the next free slot in the ring, with a reference held on
+   it, or NULL if all of them are still held by in-flight jobs. */
+DepthFrame *
+depth_frame_ring_acquire (DepthFrameRing *ring)
+{
+  guint i;
+
+  for (i = 0; i < ring->n_frames; i++)
+    {
+      DepthFrame *frame;
+
+      frame = &ring->frames[(ring->next + i) % ring->n_frames];
+      if (g_atomic_int_compare_and_exchange (&frame->in_use, 0, 1))
+        {
+          ring->next = (ring->next + i + 1) % ring->n_frames;
+          return frame;
+        }
+    }
+
+  return NULL;
+}
+
+/* Takes one more reference on a frame already held, for another job
+   to hold it until it calls depth_frame_release() */
+DepthFrame *
+depth_frame_ref (DepthFrame *frame)
+{
+  g_atomic_int_inc (&frame->in_use);
+
+  return frame;
+}
+
+/* The slot goes back to the ring once every reference is released */
+void
+depth_frame_release (DepthFrame *frame)
+{
+  if (frame == NULL)
+    return;
+
+  g_atomic_int_add (&frame->in_use, -1);
+}
+
+DepthFrameQueue *
+depth_frame_queue_new (guint size)
+{
+  DepthFrameQueue *queue;
+
+  g_return_val_if_fail (size > 0, NULL);
+
+  queue = g_slice_new0 (DepthFrameQueue);
+
+  /* one entry is always left empty to tell a full queue from an
+     empty one */
+  queue->size = size + 1;
+  queue->frames = g_new0 (DepthFrame *, queue->size);
+
+  return queue;
+}
+
+void
+depth_frame_queue_free (DepthFrameQueue *queue)
+{
+  if (queue == NULL)
+    return;
+
+  g_free (queue->frames);
+  g_slice_free (DepthFrameQueue, queue);
+}
+
+/* Producer side. Returns FALSE if the queue is full, in which case
+   the frame is still owned by the caller. */
+gboolean
+depth_frame_queue_push (DepthFrameQueue *queue, DepthFrame *frame)
+{
+  gint tail, next;
+
+  tail = g_atomic_int_get (&queue->tail);
+  next = (tail + 1) % queue->size;
+
+  if (next == g_atomic_int_get (&queue->head))
+    return FALSE;
+
+  queue->frames[tail] = frame;
+
+  /* publishes the frame to the consumer */
+  g_atomic_int_set (&queue->tail, next);
+
+  return TRUE;
+}
+
+/* Consumer side. Returns NULL if the queue is empty. */
+DepthFrame *
+depth_frame_queue_pop (DepthFrameQueue *queue)
+{
+  DepthFrame *frame;
+  gint head;
+
+  head = g_atomic_int_get (&queue->head);
+  if (head == g_atomic_int_get (&queue->tail))
+    return NULL;
+
+  frame = queue->frames[head];
+  g_atomic_int_set (&queue->head, (head + 1) % queue->size);
+
+  return frame;
+}
+
+gboolean
+depth_frame_queue_is_empty (DepthFrameQueue *queue)
+{
+  return g_atomic_int_get (&queue->head) == g_atomic_int_get (&queue->tail);
+}
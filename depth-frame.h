@@ -0,0 +1,151 @@
+/*
+ * depth-frame.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_FRAME_H__
+#define __DEPTH_FRAME_H__
+
+#include <glib.h>
+#include "depth-mask.h"
+#include "depth-pyramid.h"
+#include "depth-process.h"
+
+G_BEGIN_DECLS
+
+typedef struct _DepthFrame DepthFrame;
+typedef struct _DepthFrameRing DepthFrameRing;
+typedef struct _DepthFrameQueue DepthFrameQueue;
+
+/* separate objects of a frame tracked as visitors at most */
+#define DEPTH_FRAME_MAX_REGIONS 4
+
+/* one of the separate objects of a reduced frame, likely a visitor */
+typedef struct
+{
+  /* where it is in the reduced frame, how many pixels it has and
+     their centre, in reduced pixels */
+  DepthBox crop;
+  guint area;
+  gfloat x;
+  gfloat y;
+
+  /* the object alone within @crop, packed, somewhere in the frame's
+     @reduced */
+  guint16 *reduced;
+} DepthRegion;
+
+struct _DepthFrame
+{
+  DepthFrameRing *ring;
+
+  /* references held on the frame, the slot being free at 0 */
+  volatile gint in_use;
+
+  guint64 seq;
+  gint64 timestamp;
+
+  /* thresholded pyramid of the frame as delivered by the device, only
+     built, into @raw, when someone needs full resolution depth */
+  guint16 *raw;
+  gint width;
+  gint height;
+  DepthPyramid pyramid;
+
+  /* the pixels of the frame within the thresholds, into @mask_bits,
+     built for every frame */
+  guint64 *mask_bits;
+  DepthMask mask;
+
+  /* thresholded, reduced (and rotated) frame for skeltrack, of which
+     only the @crop region around the foreground is kept, packed at
+     the beginning of @reduced */
+  guint16 *reduced;
+  gint reduced_width;
+  gint reduced_height;
+  guint dimension_factor;
+  DepthBox crop;
+
+  /* bounding box of what is left after thresholding, in the reduced
+     frame before cropping, how many pixels that is and their centre */
+  DepthBox foreground;
+  guint foreground_area;
+  gfloat foreground_x;
+  gfloat foreground_y;
+
+  /* the objects in the foreground, nearest first, which are all of it
+     unless the visitors are split apart (see
+     depth_capture_set_max_visitors()) */
+  DepthRegion regions[DEPTH_FRAME_MAX_REGIONS];
+  guint n_regions;
+
+  gpointer user_data;
+};
+
+struct _DepthFrameRing
+{
+  DepthFrame *frames;
+  guint n_frames;
+  guint next;
+
+  /* capacity of every buffer, in pixels */
+  gsize capacity;
+};
+
+/* Bounded single-producer/single-consumer queue of frames, used to
+   hand frames over from the capture thread to the main loop without
+   taking locks. */
+struct _DepthFrameQueue
+{
+  DepthFrame **frames;
+  guint size;
+
+  /* @head is only written by the consumer, @tail by the producer */
+  volatile gint head;
+  volatile gint tail;
+};
+
+DepthFrameRing * depth_frame_ring_new      (guint           n_frames,
+                                            gint            width,
+                                            gint            height);
+
+void             depth_frame_ring_free     (DepthFrameRing *ring);
+
+DepthFrame *     depth_frame_ring_acquire  (DepthFrameRing *ring);
+
+DepthFrame *     depth_frame_ref           (DepthFrame     *frame);
+
+void             depth_frame_release       (DepthFrame     *frame);
+
+DepthFrameQueue *depth_frame_queue_new     (guint            size);
+
+void             depth_frame_queue_free    (DepthFrameQueue *queue);
+
+gboolean         depth_frame_queue_push    (DepthFrameQueue *queue,
+                                            DepthFrame      *frame);
+
+DepthFrame *     depth_frame_queue_pop     (DepthFrameQueue *queue);
+
+gboolean         depth_frame_queue_is_empty (DepthFrameQueue *queue);
+
+G_END_DECLS
+
+#endif /* __DEPTH_FRAME_H__ */
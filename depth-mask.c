@@ -0,0 +1,265 @@
+/*
+ * depth-mask.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#include "depth-mask.h"
+
+#define WORD_BITS 64
+
+static gint
+get_stride (gint width)
+{
+  return (width + WORD_BITS - 1) / WORD_BITS;
+}
+
+/* bits [begin, end) of a raw row, begin < end */
+static guint
+count_row (const guint64 *row, gint begin, gint end)
+{
+  guint64 first_mask, last_mask;
+  gint first, last, i;
+  guint count;
+
+  first = begin / WORD_BITS;
+  last = (end - 1) / WORD_BITS;
+  first_mask = ~G_GUINT64_CONSTANT (0) << (begin % WORD_BITS);
+  last_mask = ~G_GUINT64_CONSTANT (0) >> (WORD_BITS - 1 - (end - 1) % WORD_BITS);
+
+  if (first == last)
+    return __builtin_popcountll (row[first] & first_mask & last_mask);
+
+  count = __builtin_popcountll (row[first] & first_mask);
+  for (i = first + 1; i < last; i++)
+    count += __builtin_popcountll (row[i]);
+  count += __builtin_popcountll (row[last] & last_mask);
+
+  return count;
+}
+
+/* public methods */
+
+/* Number of 64 bit words a buffer for the mask of a @width x @height
+   frame must hold */
+gsize
+depth_mask_get_size (gint width, gint height)
+{
+  return get_stride (width) * height;
+}
+
+/* Builds the mask of the raw @depth frame into @bits, which must hold
+   depth_mask_get_size() words and outlive @mask */
+void
+depth_mask_build (DepthMask     *mask,
+                  guint64       *bits,
+                  const guint16 *depth,
+                  gint           width,
+                  gint           height,
+                  gboolean       rotated,
+                  guint16        threshold_begin,
+                  guint16        threshold_end)
+{
+  depth_mask_build_rows (bits,
+                         depth,
+                         width,
+                         0,
+                         height,
+                         threshold_begin,
+                         threshold_end);
+  depth_mask_init (mask, bits, width, height, rotated);
+}
+
+/* Builds the bits of raw rows [@first_row, @last_row) only, so that a
+   frame can be built in parts, from several threads */
+void
+depth_mask_build_rows (guint64       *bits,
+                       const guint16 *depth,
+                       gint           width,
+                       gint           first_row,
+                       gint           last_row,
+                       guint16        threshold_begin,
+                       guint16        threshold_end)
+{
+  gint stride, j;
+
+  stride = get_stride (width);
+  for (j = first_row; j < last_row; j++)
+    {
+      depth_process_threshold_mask (depth + j * width,
+                                    width,
+                                    threshold_begin,
+                                    threshold_end,
+                                    bits + j * stride);
+    }
+}
+
+/* Presents the mask built in @bits through @mask */
+void
+depth_mask_init (DepthMask     *mask,
+                 const guint64 *bits,
+                 gint           width,
+                 gint           height,
+                 gboolean       rotated)
+{
+  mask->bits = bits;
+  mask->raw_width = width;
+  mask->raw_height = height;
+  mask->stride = get_stride (width);
+  mask->rotated = rotated;
+
+  if (rotated)
+    {
+      mask->width = height;
+      mask->height = width;
+    }
+  else
+    {
+      mask->width = width;
+      mask->height = height;
+    }
+}
+
+/* The mask of a frame of the given size, without bits */
+void
+depth_mask_init_empty (DepthMask *mask,
+                       gint       width,
+                       gint       height,
+                       gboolean   rotated)
+{
+  depth_mask_init (mask, NULL, width, height, rotated);
+}
+
+/* Number of pixels set, that is, the area of what is within the
+   thresholds */
+guint
+depth_mask_count (const DepthMask *mask)
+{
+  gsize i, size;
+  guint count = 0;
+
+  /* the padding bits are always clear */
+  size = (gsize) mask->stride * mask->raw_height;
+  for (i = 0; i < size; i++)
+    count += __builtin_popcountll (mask->bits[i]);
+
+  return count;
+}
+
+/* Number of pixels set within @box, which is clipped to the mask */
+guint
+depth_mask_count_box (const DepthMask *mask, const DepthBox *box)
+{
+  gint left, top, right, bottom, raw_left, raw_top, raw_right, raw_bottom;
+  gint j;
+  guint count = 0;
+
+  left = MAX (box->x, 0);
+  top = MAX (box->y, 0);
+  right = MIN (box->x + box->width, mask->width);
+  bottom = MIN (box->y + box->height, mask->height);
+  if (left >= right || top >= bottom)
+    return 0;
+
+  /* the same box in the raw frame, where rows are contiguous */
+  if (mask->rotated)
+    {
+      raw_left = mask->raw_width - bottom;
+      raw_right = mask->raw_width - top;
+      raw_top = mask->raw_height - right;
+      raw_bottom = mask->raw_height - left;
+    }
+  else
+    {
+      raw_left = left;
+      raw_right = right;
+      raw_top = top;
+      raw_bottom = bottom;
+    }
+
+  for (j = raw_top; j < raw_bottom; j++)
+    count += count_row (mask->bits + j * mask->stride, raw_left, raw_right);
+
+  return count;
+}
+
+/* Sets @bounds to the bounding box of the pixels set and returns TRUE,
+   or sets its width to 0 and returns FALSE if there are none */
+gboolean
+depth_mask_get_bounds (const DepthMask *mask, DepthBox *bounds)
+{
+  gint left, top, right, bottom, i, j;
+
+  left = mask->raw_width;
+  right = -1;
+  top = -1;
+  bottom = -1;
+
+  for (j = 0; j < mask->raw_height; j++)
+    {
+      const guint64 *row = mask->bits + j * mask->stride;
+      gint first = -1, last = -1;
+
+      for (i = 0; i < mask->stride; i++)
+        {
+          if (row[i] == 0)
+            continue;
+
+          if (first < 0)
+            first = i * WORD_BITS + __builtin_ctzll (row[i]);
+          last = i * WORD_BITS + WORD_BITS - 1 - __builtin_clzll (row[i]);
+        }
+
+      if (first < 0)
+        continue;
+
+      if (top < 0)
+        top = j;
+      bottom = j;
+      left = MIN (left, first);
+      right = MAX (right, last);
+    }
+
+  if (top < 0)
+    {
+      bounds->x = 0;
+      bounds->y = 0;
+      bounds->width = 0;
+      bounds->height = 0;
+      return FALSE;
+    }
+
+  if (mask->rotated)
+    {
+      bounds->x = mask->raw_height - 1 - bottom;
+      bounds->y = mask->raw_width - 1 - right;
+      bounds->width = bottom - top + 1;
+      bounds->height = right - left + 1;
+    }
+  else
+    {
+      bounds->x = left;
+      bounds->y = top;
+      bounds->width = right - left + 1;
+      bounds->height = bottom - top + 1;
+    }
+
+  return TRUE;
+}
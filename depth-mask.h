@@ -0,0 +1,111 @@
+/*
+ * depth-mask.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_MASK_H__
+#define __DEPTH_MASK_H__
+
+#include <glib.h>
+#include "depth-process.h"
+
+G_BEGIN_DECLS
+
+/* One bit per pixel of a depth frame, set for the pixels within the
+   thresholds, so that whoever only asks whether a pixel is there
+   reads 1/16 of the memory the depth takes. Bits keep the layout of
+   the raw frame, each row padded to whole 64 bit words, and like a
+   DepthView the mask is presented rotated if the frame is: the
+   coordinates and boxes the functions take and return are always in
+   the presented (@width x @height) space. */
+typedef struct
+{
+  const guint64 *bits;
+  gint raw_width;
+  gint raw_height;
+  gint stride; /* words per raw row */
+  gboolean rotated;
+
+  gint width;
+  gint height;
+} DepthMask;
+
+gsize    depth_mask_get_size          (gint             width,
+                                       gint             height);
+
+void     depth_mask_build             (DepthMask       *mask,
+                                       guint64         *bits,
+                                       const guint16   *depth,
+                                       gint             width,
+                                       gint             height,
+                                       gboolean         rotated,
+                                       guint16          threshold_begin,
+                                       guint16          threshold_end);
+
+void     depth_mask_build_rows        (guint64         *bits,
+                                       const guint16   *depth,
+                                       gint             width,
+                                       gint             first_row,
+                                       gint             last_row,
+                                       guint16          threshold_begin,
+                                       guint16          threshold_end);
+
+void     depth_mask_init              (DepthMask       *mask,
+                                       const guint64   *bits,
+                                       gint             width,
+                                       gint             height,
+                                       gboolean         rotated);
+
+void     depth_mask_init_empty        (DepthMask       *mask,
+                                       gint             width,
+                                       gint             height,
+                                       gboolean         rotated);
+
+guint    depth_mask_count             (const DepthMask *mask);
+
+guint    depth_mask_count_box         (const DepthMask *mask,
+                                       const DepthBox  *box);
+
+gboolean depth_mask_get_bounds        (const DepthMask *mask,
+                                       DepthBox        *bounds);
+
+static inline gboolean
+depth_mask_get (const DepthMask *mask, gint x, gint y)
+{
+  gint raw_x, raw_y;
+
+  if (mask->rotated)
+    {
+      raw_x = mask->raw_width - 1 - y;
+      raw_y = mask->raw_height - 1 - x;
+    }
+  else
+    {
+      raw_x = x;
+      raw_y = y;
+    }
+
+  return (mask->bits[raw_y * mask->stride + raw_x / 64] >> (raw_x % 64)) & 1;
+}
+
+G_END_DECLS
+
+#endif /* __DEPTH_MASK_H__ */
@@ -0,0 +1,187 @@
+/*
+ * depth-presence.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+/* Tells whether someone is in front of the installation from what is
+   left of the reduced frames once the background is removed, which
+   the capture measures anyway, so skeletons are only looked for once
+   someone is there. Someone enters when enough of the frame is
+   foreground for a while and it moved meanwhile, as still foreground
+   is rather something the background model hasn't learnt yet; and
+   leaves when the foreground is gone for a while, or stood perfectly
+   still for so long that it must have been left behind, unless a
+   skeleton is still being found in it. */
+
+#include "depth-presence.h"
+
+#include <math.h>
+
+/* parts of the reduced frame the foreground must cover to enter, and
+   may cover while leaving */
+#define ENTER_AREA .03
+#define LEAVE_AREA .015
+
+#define ENTER_TIME 150 /* milliseconds */
+#define LEAVE_TIME 300 /* milliseconds */
+
+/* how far the centre of the foreground must move to be moving, in
+   pixels of the full resolution frame */
+#define MIN_MOTION 20
+
+#define STILL_TIME 20000 /* milliseconds */
+
+struct _DepthPresence
+{
+  gboolean present;
+
+  /* while entering, since when the foreground is large enough, where
+     it was then and whether it moved since */
+  gint64 enter_time;
+  gfloat enter_x;
+  gfloat enter_y;
+  gboolean moved;
+
+  /* while present, since when the foreground is too small, if it is,
+     and where and when it last moved */
+  gint64 leave_time;
+  gfloat motion_x;
+  gfloat motion_y;
+  gint64 motion_time;
+};
+
+static gboolean
+has_moved (gfloat x, gfloat y, gfloat from_x, gfloat from_y)
+{
+  return hypot (x - from_x, y - from_y) >= MIN_MOTION;
+}
+
+/* public methods */
+
+DepthPresence *
+depth_presence_new (void)
+{
+  return g_slice_new0 (DepthPresence);
+}
+
+void
+depth_presence_free (DepthPresence *self)
+{
+  if (self == NULL)
+    return;
+
+  g_slice_free (DepthPresence, self);
+}
+
+/* Back to nobody being there, for when the stream is interrupted */
+void
+depth_presence_reset (DepthPresence *self)
+{
+  self->present = FALSE;
+  self->enter_time = 0;
+  self->moved = FALSE;
+}
+
+/* Takes the measures of one more frame, and returns whether someone is
+   there as of it */
+gboolean
+depth_presence_update (DepthPresence *self, const DepthFrame *frame)
+{
+  gdouble area;
+  gfloat x, y;
+  gint64 time;
+
+  area = (gdouble) frame->foreground_area /
+    (frame->reduced_width * frame->reduced_height);
+  x = frame->foreground_x * frame->dimension_factor;
+  y = frame->foreground_y * frame->dimension_factor;
+  time = frame->timestamp;
+
+  if (! self->present)
+    {
+      if (area < ENTER_AREA)
+        {
+          self->enter_time = 0;
+          self->moved = FALSE;
+          return FALSE;
+        }
+
+      if (self->enter_time == 0)
+        {
+          self->enter_time = time;
+          self->enter_x = x;
+          self->enter_y = y;
+        }
+      self->moved = self->moved ||
+        has_moved (x, y, self->enter_x, self->enter_y);
+
+      if (self->moved && time - self->enter_time >= ENTER_TIME * 1000)
+        {
+          self->present = TRUE;
+          self->leave_time = 0;
+          self->motion_x = x;
+          self->motion_y = y;
+          self->motion_time = time;
+        }
+
+      return self->present;
+    }
+
+  if (area < LEAVE_AREA)
+    {
+      if (self->leave_time == 0)
+        self->leave_time = time;
+    }
+  else
+    {
+      self->leave_time = 0;
+    }
+
+  if (has_moved (x, y, self->motion_x, self->motion_y))
+    {
+      self->motion_x = x;
+      self->motion_y = y;
+      self->motion_time = time;
+    }
+
+  if ((self->leave_time != 0 && time - self->leave_time >= LEAVE_TIME * 1000) ||
+      time - self->motion_time >= STILL_TIME * 1000)
+    {
+      depth_presence_reset (self);
+    }
+
+  return self->present;
+}
+
+/* Someone is known to be there as of @time, as their skeleton was
+   found, however still they stand */
+void
+depth_presence_keep (DepthPresence *self, gint64 time)
+{
+  if (self->present)
+    self->motion_time = MAX (self->motion_time, time);
+}
+
+gboolean
+depth_presence_is_present (DepthPresence *self)
+{
+  return self->present;
+}
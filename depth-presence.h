@@ -0,0 +1,50 @@
+/*
+ * depth-presence.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_PRESENCE_H__
+#define __DEPTH_PRESENCE_H__
+
+#include <glib.h>
+#include "depth-frame.h"
+
+G_BEGIN_DECLS
+
+typedef struct _DepthPresence DepthPresence;
+
+DepthPresence * depth_presence_new        (void);
+
+void            depth_presence_free       (DepthPresence    *self);
+
+void            depth_presence_reset      (DepthPresence    *self);
+
+gboolean        depth_presence_update     (DepthPresence    *self,
+                                           const DepthFrame *frame);
+
+void            depth_presence_keep       (DepthPresence    *self,
+                                           gint64            time);
+
+gboolean        depth_presence_is_present (DepthPresence    *self);
+
+G_END_DECLS
+
+#endif /* __DEPTH_PRESENCE_H__ */
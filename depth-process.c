@@ -0,0 +1,1188 @@
+/*
+ * depth-process.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#include "depth-process.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined (__x86_64__) || defined (__i386__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* same constants skeltrack uses to convert screen coordinates */
+#define SCALE_FACTOR .0021
+#define MIN_DISTANCE -10.0
+
+/* room left around the foreground when cropping, in reduced pixels */
+#define CROP_MARGIN 2
+
+/* approximation of the driver's conversion from raw disparities to
+   millimetres, mm = DEPTH * tan (raw / SCALE + OFFSET) */
+#define DISPARITY_SCALE 2842.5
+#define DISPARITY_OFFSET 1.1863
+#define DISPARITY_DEPTH 123.6
+#define DISPARITY_MAX_DEPTH 10000 /* millimetres */
+
+static guint16 disparity_lut[DEPTH_DISPARITY_LEVELS];
+
+typedef void (*ThresholdRowFunc) (guint16 *row,
+                                  gint     length,
+                                  guint16  threshold_begin,
+                                  guint16  threshold_end);
+
+typedef void (*MaskRowFunc)      (guint64       *bits,
+                                  const guint16 *row,
+                                  gint           length,
+                                  guint16        threshold_begin,
+                                  guint16        threshold_end);
+
+typedef void (*SubtractRowFunc)  (guint16       *row,
+                                  const guint16 *background,
+                                  gint           length,
+                                  guint16        margin);
+
+typedef void (*MinRowFunc)       (guint16       *nearest,
+                                  const guint16 *row,
+                                  gint           length);
+
+typedef void (*SumRowFunc)       (guint32       *sum,
+                                  guint16       *count,
+                                  const guint16 *row,
+                                  gint           length);
+
+typedef struct
+{
+  ThresholdRowFunc threshold;
+  MaskRowFunc mask;
+  SubtractRowFunc subtract;
+  MinRowFunc accumulate_nearest;
+  SumRowFunc accumulate_sum;
+} RowFuncs;
+
+/* everything a reduction needs, shared by the threads reducing its
+   parts */
+typedef struct
+{
+  const RowFuncs *funcs;
+  DepthSampling sampling;
+  const guint16 *depth;
+  gint width;
+  gint height;
+  const guint16 *disparity_lut;
+  gboolean rotate;
+  gint factor;
+  guint16 threshold_begin;
+  guint16 threshold_end;
+  const guint16 *background;
+  guint16 background_margin;
+  guint16 *reduced;
+  gint out_width;
+  gint out_height;
+} Reduction;
+
+static void
+threshold_row_scalar (guint16 *row,
+                      gint     length,
+                      guint16  threshold_begin,
+                      guint16  threshold_end)
+{
+  gint i;
+
+  for (i = 0; i < length; i++)
+    {
+      if (row[i] < threshold_begin || row[i] > threshold_end)
+        row[i] = 0;
+    }
+}
+
+/* Bit i % 64 of word i / 64 is set iff row[i] is within the
+   thresholds; the bits past @length in the last word are cleared */
+static void
+mask_row_scalar (guint64       *bits,
+                 const guint16 *row,
+                 gint           length,
+                 guint16        threshold_begin,
+                 guint16        threshold_end)
+{
+  gint i;
+
+  for (i = 0; i < length; i += 64)
+    bits[i / 64] = 0;
+
+  for (i = 0; i < length; i++)
+    {
+      if (row[i] >= threshold_begin && row[i] <= threshold_end)
+        bits[i / 64] |= G_GUINT64_CONSTANT (1) << (i % 64);
+    }
+}
+
+static void
+subtract_row_scalar (guint16       *row,
+                     const guint16 *background,
+                     gint           length,
+                     guint16        margin)
+{
+  gint i;
+
+  for (i = 0; i < length; i++)
+    {
+      if (background[i] != 0 && (guint) row[i] + margin >= background[i])
+        row[i] = 0;
+    }
+}
+
+/* Pixels with no depth (0) wrap around to the largest value when
+   decreased by one, so a plain unsigned minimum skips them, and a
+   block with no depth at all comes back to 0 when increased again */
+static void
+nearest_row_scalar (guint16       *nearest,
+                    const guint16 *row,
+                    gint           length)
+{
+  gint i;
+
+  for (i = 0; i < length; i++)
+    nearest[i] = MIN (nearest[i], (guint16) (row[i] - 1));
+}
+
+static void
+sum_row_scalar (guint32       *sum,
+                guint16       *count,
+                const guint16 *row,
+                gint           length)
+{
+  gint i;
+
+  for (i = 0; i < length; i++)
+    {
+      sum[i] += row[i];
+      count[i] += row[i] != 0;
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+
+/* A value is inside [begin, end] iff both saturated differences
+   (begin - value) and (value - end) are zero, which avoids the lack
+   of unsigned 16 bit compares in SSE2/AVX2 */
+
+__attribute__ ((target ("sse2")))
+static void
+threshold_row_sse2 (guint16 *row,
+                    gint     length,
+                    guint16  threshold_begin,
+                    guint16  threshold_end)
+{
+  __m128i begin, end, zero;
+  gint i;
+
+  begin = _mm_set1_epi16 ((gint16) threshold_begin);
+  end = _mm_set1_epi16 ((gint16) threshold_end);
+  zero = _mm_setzero_si128 ();
+
+  for (i = 0; i + 8 <= length; i += 8)
+    {
+      __m128i value, outside, mask;
+
+      value = _mm_loadu_si128 ((__m128i *) (row + i));
+      outside = _mm_or_si128 (_mm_subs_epu16 (begin, value),
+                              _mm_subs_epu16 (value, end));
+      mask = _mm_cmpeq_epi16 (outside, zero);
+      _mm_storeu_si128 ((__m128i *) (row + i), _mm_and_si128 (value, mask));
+    }
+
+  threshold_row_scalar (row + i, length - i, threshold_begin, threshold_end);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+threshold_row_avx2 (guint16 *row,
+                    gint     length,
+                    guint16  threshold_begin,
+                    guint16  threshold_end)
+{
+  __m256i begin, end, zero;
+  gint i;
+
+  begin = _mm256_set1_epi16 ((gint16) threshold_begin);
+  end = _mm256_set1_epi16 ((gint16) threshold_end);
+  zero = _mm256_setzero_si256 ();
+
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m256i value, outside, mask;
+
+      value = _mm256_loadu_si256 ((__m256i *) (row + i));
+      outside = _mm256_or_si256 (_mm256_subs_epu16 (begin, value),
+                                 _mm256_subs_epu16 (value, end));
+      mask = _mm256_cmpeq_epi16 (outside, zero);
+      _mm256_storeu_si256 ((__m256i *) (row + i),
+                           _mm256_and_si256 (value, mask));
+    }
+
+  threshold_row_sse2 (row + i, length - i, threshold_begin, threshold_end);
+}
+
+/* same compare, the 16 bit results packed to bytes so that movemask
+   gives one bit per pixel */
+
+__attribute__ ((target ("sse2")))
+static void
+mask_row_sse2 (guint64       *bits,
+               const guint16 *row,
+               gint           length,
+               guint16        threshold_begin,
+               guint16        threshold_end)
+{
+  __m128i begin, end, zero;
+  gint i, k;
+
+  begin = _mm_set1_epi16 ((gint16) threshold_begin);
+  end = _mm_set1_epi16 ((gint16) threshold_end);
+  zero = _mm_setzero_si128 ();
+
+  for (i = 0; i + 64 <= length; i += 64)
+    {
+      guint64 word = 0;
+
+      for (k = 0; k < 64; k += 8)
+        {
+          __m128i value, outside, inside;
+
+          value = _mm_loadu_si128 ((__m128i *) (row + i + k));
+          outside = _mm_or_si128 (_mm_subs_epu16 (begin, value),
+                                  _mm_subs_epu16 (value, end));
+          inside = _mm_cmpeq_epi16 (outside, zero);
+          word |= (guint64) _mm_movemask_epi8 (_mm_packs_epi16 (inside, zero)) << k;
+        }
+
+      bits[i / 64] = word;
+    }
+
+  mask_row_scalar (bits + i / 64, row + i, length - i,
+                   threshold_begin, threshold_end);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+mask_row_avx2 (guint64       *bits,
+               const guint16 *row,
+               gint           length,
+               guint16        threshold_begin,
+               guint16        threshold_end)
+{
+  __m256i begin, end, zero;
+  gint i, k;
+
+  begin = _mm256_set1_epi16 ((gint16) threshold_begin);
+  end = _mm256_set1_epi16 ((gint16) threshold_end);
+  zero = _mm256_setzero_si256 ();
+
+  for (i = 0; i + 64 <= length; i += 64)
+    {
+      guint64 word = 0;
+
+      for (k = 0; k < 64; k += 16)
+        {
+          __m256i value, outside, inside;
+          __m128i packed;
+
+          value = _mm256_loadu_si256 ((__m256i *) (row + i + k));
+          outside = _mm256_or_si256 (_mm256_subs_epu16 (begin, value),
+                                     _mm256_subs_epu16 (value, end));
+          inside = _mm256_cmpeq_epi16 (outside, zero);
+
+          /* packing within the 256 bit register would interleave
+             the lanes, so the halves are packed together instead */
+          packed = _mm_packs_epi16 (_mm256_castsi256_si128 (inside),
+                                    _mm256_extracti128_si256 (inside, 1));
+          word |= (guint64) (guint16) _mm_movemask_epi8 (packed) << k;
+        }
+
+      bits[i / 64] = word;
+    }
+
+  mask_row_scalar (bits + i / 64, row + i, length - i,
+                   threshold_begin, threshold_end);
+}
+
+/* same trick: a pixel is kept iff (background - (value + margin)),
+   saturated, is not zero, or there is no background */
+
+__attribute__ ((target ("sse2")))
+static void
+subtract_row_sse2 (guint16       *row,
+                   const guint16 *background,
+                   gint           length,
+                   guint16        margin)
+{
+  __m128i offset, zero;
+  gint i;
+
+  offset = _mm_set1_epi16 ((gint16) margin);
+  zero = _mm_setzero_si128 ();
+
+  for (i = 0; i + 8 <= length; i += 8)
+    {
+      __m128i value, model, drop;
+
+      value = _mm_loadu_si128 ((__m128i *) (row + i));
+      model = _mm_loadu_si128 ((__m128i *) (background + i));
+      drop = _mm_andnot_si128 (_mm_cmpeq_epi16 (model, zero),
+                               _mm_cmpeq_epi16 (_mm_subs_epu16 (model,
+                                                                _mm_adds_epu16 (value, offset)),
+                                                zero));
+      _mm_storeu_si128 ((__m128i *) (row + i), _mm_andnot_si128 (drop, value));
+    }
+
+  subtract_row_scalar (row + i, background + i, length - i, margin);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+subtract_row_avx2 (guint16       *row,
+                   const guint16 *background,
+                   gint           length,
+                   guint16        margin)
+{
+  __m256i offset, zero;
+  gint i;
+
+  offset = _mm256_set1_epi16 ((gint16) margin);
+  zero = _mm256_setzero_si256 ();
+
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m256i value, model, drop;
+
+      value = _mm256_loadu_si256 ((__m256i *) (row + i));
+      model = _mm256_loadu_si256 ((__m256i *) (background + i));
+      drop = _mm256_andnot_si256 (_mm256_cmpeq_epi16 (model, zero),
+                                  _mm256_cmpeq_epi16 (_mm256_subs_epu16 (model,
+                                                                         _mm256_adds_epu16 (value, offset)),
+                                                      zero));
+      _mm256_storeu_si256 ((__m256i *) (row + i),
+                           _mm256_andnot_si256 (drop, value));
+    }
+
+  subtract_row_sse2 (row + i, background + i, length - i, margin);
+}
+
+/* SSE2 only has a signed 16 bit minimum, so values are biased by
+   0x8000 to keep their unsigned order */
+
+__attribute__ ((target ("sse2")))
+static void
+nearest_row_sse2 (guint16       *nearest,
+                  const guint16 *row,
+                  gint           length)
+{
+  __m128i bias, one;
+  gint i;
+
+  bias = _mm_set1_epi16 ((gint16) 0x8000);
+  one = _mm_set1_epi16 (1);
+
+  for (i = 0; i + 8 <= length; i += 8)
+    {
+      __m128i value, current;
+
+      value = _mm_sub_epi16 (_mm_loadu_si128 ((__m128i *) (row + i)), one);
+      current = _mm_loadu_si128 ((__m128i *) (nearest + i));
+      current = _mm_min_epi16 (_mm_xor_si128 (current, bias),
+                               _mm_xor_si128 (value, bias));
+      _mm_storeu_si128 ((__m128i *) (nearest + i), _mm_xor_si128 (current, bias));
+    }
+
+  nearest_row_scalar (nearest + i, row + i, length - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+nearest_row_avx2 (guint16       *nearest,
+                  const guint16 *row,
+                  gint           length)
+{
+  __m256i one;
+  gint i;
+
+  one = _mm256_set1_epi16 (1);
+
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m256i value, current;
+
+      value = _mm256_sub_epi16 (_mm256_loadu_si256 ((__m256i *) (row + i)), one);
+      current = _mm256_loadu_si256 ((__m256i *) (nearest + i));
+      _mm256_storeu_si256 ((__m256i *) (nearest + i),
+                           _mm256_min_epu16 (current, value));
+    }
+
+  nearest_row_sse2 (nearest + i, row + i, length - i);
+}
+
+/* sums are widened to 32 bits, counts stay in 16 bits: a valid pixel
+   adds one by subtracting the all-ones "not zero" mask */
+
+__attribute__ ((target ("sse2")))
+static void
+sum_row_sse2 (guint32       *sum,
+              guint16       *count,
+              const guint16 *row,
+              gint           length)
+{
+  __m128i zero, ones;
+  gint i;
+
+  zero = _mm_setzero_si128 ();
+  ones = _mm_cmpeq_epi16 (zero, zero);
+
+  for (i = 0; i + 8 <= length; i += 8)
+    {
+      __m128i value, valid, low, high;
+
+      value = _mm_loadu_si128 ((__m128i *) (row + i));
+      valid = _mm_xor_si128 (_mm_cmpeq_epi16 (value, zero), ones);
+      _mm_storeu_si128 ((__m128i *) (count + i),
+                        _mm_sub_epi16 (_mm_loadu_si128 ((__m128i *) (count + i)),
+                                       valid));
+
+      low = _mm_add_epi32 (_mm_loadu_si128 ((__m128i *) (sum + i)),
+                           _mm_unpacklo_epi16 (value, zero));
+      high = _mm_add_epi32 (_mm_loadu_si128 ((__m128i *) (sum + i + 4)),
+                            _mm_unpackhi_epi16 (value, zero));
+      _mm_storeu_si128 ((__m128i *) (sum + i), low);
+      _mm_storeu_si128 ((__m128i *) (sum + i + 4), high);
+    }
+
+  sum_row_scalar (sum + i, count + i, row + i, length - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+sum_row_avx2 (guint32       *sum,
+              guint16       *count,
+              const guint16 *row,
+              gint           length)
+{
+  __m256i zero, ones;
+  gint i;
+
+  zero = _mm256_setzero_si256 ();
+  ones = _mm256_cmpeq_epi16 (zero, zero);
+
+  for (i = 0; i + 16 <= length; i += 16)
+    {
+      __m256i value, valid, low, high;
+
+      value = _mm256_loadu_si256 ((__m256i *) (row + i));
+      valid = _mm256_xor_si256 (_mm256_cmpeq_epi16 (value, zero), ones);
+      _mm256_storeu_si256 ((__m256i *) (count + i),
+                           _mm256_sub_epi16 (_mm256_loadu_si256 ((__m256i *) (count + i)),
+                                             valid));
+
+      /* widened per 128 bit half, to keep the order of the values */
+      low = _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *) (sum + i)),
+                              _mm256_cvtepu16_epi32 (_mm256_castsi256_si128 (value)));
+      high = _mm256_add_epi32 (_mm256_loadu_si256 ((__m256i *) (sum + i + 8)),
+                               _mm256_cvtepu16_epi32 (_mm256_extracti128_si256 (value, 1)));
+      _mm256_storeu_si256 ((__m256i *) (sum + i), low);
+      _mm256_storeu_si256 ((__m256i *) (sum + i + 8), high);
+    }
+
+  sum_row_sse2 (sum + i, count + i, row + i, length - i);
+}
+
+#endif /* HAVE_X86_SIMD */
+
+static const RowFuncs *
+get_row_funcs (void)
+{
+  static const RowFuncs scalar_funcs =
+    {
+      threshold_row_scalar,
+      mask_row_scalar,
+      subtract_row_scalar,
+      nearest_row_scalar,
+      sum_row_scalar
+    };
+#ifdef HAVE_X86_SIMD
+  static const RowFuncs sse2_funcs =
+    {
+      threshold_row_sse2,
+      mask_row_sse2,
+      subtract_row_sse2,
+      nearest_row_sse2,
+      sum_row_sse2
+    };
+  static const RowFuncs avx2_funcs =
+    {
+      threshold_row_avx2,
+      mask_row_avx2,
+      subtract_row_avx2,
+      nearest_row_avx2,
+      sum_row_avx2
+    };
+#endif
+  static const RowFuncs *funcs = NULL;
+
+  if (funcs != NULL)
+    return funcs;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    funcs = &avx2_funcs;
+  else if (__builtin_cpu_supports ("sse2"))
+    funcs = &sse2_funcs;
+  else
+#endif
+    funcs = &scalar_funcs;
+
+  return funcs;
+}
+
+/* One pixel per block, gathered straight from the raw frame */
+static void
+convert_row (guint16       *row,
+             gint           length,
+             const guint16 *lut)
+{
+  gint i;
+
+  for (i = 0; i < length; i++)
+    row[i] = lut[row[i]];
+}
+
+static void
+reduce_point (gint     first,
+              gint     last,
+              gpointer data)
+{
+  const Reduction *r = (const Reduction *) data;
+  gint i, j;
+
+  for (j = first; j < last; j++)
+    {
+      guint16 *row = r->reduced + j * r->out_width;
+      gint src_offset, src_step;
+
+      if (r->rotate)
+        {
+          /* rotated (i, j) comes from raw column (width - 1 - j),
+             row (height - 1 - i) */
+          src_offset = (r->height - 1) * r->width + (r->width - 1 - j * r->factor);
+          src_step = - r->width * r->factor;
+        }
+      else
+        {
+          src_offset = j * r->factor * r->width;
+          src_step = r->factor;
+        }
+
+      if (r->disparity_lut != NULL)
+        {
+          const guint16 *src = r->depth + src_offset;
+
+          for (i = 0; i < r->out_width; i++)
+            row[i] = src[i * src_step];
+
+          /* thresholds are disparities too, so only the pixels kept
+             are looked up, and only then compared to the background */
+          r->funcs->threshold (row,
+                               r->out_width,
+                               r->threshold_begin,
+                               r->threshold_end);
+          convert_row (row, r->out_width, r->disparity_lut);
+
+          if (r->background != NULL)
+            {
+              const guint16 *bg = r->background + src_offset;
+
+              for (i = 0; i < r->out_width; i++)
+                {
+                  guint model = bg[i * src_step];
+
+                  if (model != 0 && (guint) row[i] + r->background_margin >= model)
+                    row[i] = 0;
+                }
+            }
+
+          continue;
+        }
+
+      if (r->background == NULL)
+        {
+          const guint16 *src = r->depth + src_offset;
+
+          for (i = 0; i < r->out_width; i++)
+            row[i] = src[i * src_step];
+        }
+      else
+        {
+          const guint16 *src = r->depth + src_offset;
+          const guint16 *bg = r->background + src_offset;
+
+          /* sampled at the very same positions, while the gather is
+             scalar anyway */
+          for (i = 0; i < r->out_width; i++)
+            {
+              guint value = src[i * src_step];
+              guint model = bg[i * src_step];
+
+              row[i] = (model == 0 || value + r->background_margin < model) ?
+                value : 0;
+            }
+        }
+
+      /* the row is still hot in cache, threshold it right away */
+      r->funcs->threshold (row,
+                           r->out_width,
+                           r->threshold_begin,
+                           r->threshold_end);
+    }
+}
+
+/* Every pixel of the block counts. Raw rows are thresholded and
+   accumulated a whole row at a time, and only then every block is
+   collapsed into its reduced pixel. Blocks are laid out from the
+   corner that the point sampling reads, so both modes see the same
+   grid. */
+static void
+reduce_pooled (gint     first,
+               gint     last,
+               gpointer data)
+{
+  const Reduction *r = (const Reduction *) data;
+  guint16 *row, *nearest, *count;
+  guint32 *sum;
+  gint i, j, k, block_x, block_y, n_blocks_x;
+
+  row = g_alloca (r->width * sizeof (guint16));
+  nearest = g_alloca (r->width * sizeof (guint16));
+  count = g_alloca (r->width * sizeof (guint16));
+  sum = g_alloca (r->width * sizeof (guint32));
+
+  n_blocks_x = r->width / r->factor;
+
+  for (block_y = first; block_y < last; block_y++)
+    {
+      gint first_row;
+
+      first_row = r->rotate ?
+        r->height - (block_y + 1) * r->factor : block_y * r->factor;
+
+      if (r->sampling == DEPTH_SAMPLING_NEAREST)
+        {
+          memset (nearest, 0xff, r->width * sizeof (guint16));
+        }
+      else
+        {
+          memset (sum, 0, r->width * sizeof (guint32));
+          memset (count, 0, r->width * sizeof (guint16));
+        }
+
+      for (j = first_row; j < first_row + r->factor; j++)
+        {
+          memcpy (row, r->depth + j * r->width, r->width * sizeof (guint16));
+
+          r->funcs->threshold (row,
+                               r->width,
+                               r->threshold_begin,
+                               r->threshold_end);
+          if (r->disparity_lut != NULL)
+            convert_row (row, r->width, r->disparity_lut);
+          if (r->background != NULL)
+            {
+              r->funcs->subtract (row,
+                                  r->background + j * r->width,
+                                  r->width,
+                                  r->background_margin);
+            }
+
+          if (r->sampling == DEPTH_SAMPLING_NEAREST)
+            r->funcs->accumulate_nearest (nearest, row, r->width);
+          else
+            r->funcs->accumulate_sum (sum, count, row, r->width);
+        }
+
+      for (block_x = 0; block_x < n_blocks_x; block_x++)
+        {
+          gint first_column;
+          guint16 value;
+
+          first_column = r->rotate ?
+            r->width - (block_x + 1) * r->factor : block_x * r->factor;
+
+          if (r->sampling == DEPTH_SAMPLING_NEAREST)
+            {
+              guint16 min = G_MAXUINT16;
+
+              for (i = first_column; i < first_column + r->factor; i++)
+                min = MIN (min, nearest[i]);
+
+              value = min + 1;
+            }
+          else
+            {
+              guint32 block_sum = 0;
+              guint block_count = 0;
+
+              for (i = first_column; i < first_column + r->factor; i++)
+                {
+                  block_sum += sum[i];
+                  block_count += count[i];
+                }
+
+              value = block_count > 0 ?
+                (block_sum + block_count / 2) / block_count : 0;
+            }
+
+          /* rotated (block_y, block_x) */
+          k = r->rotate ?
+            block_x * r->out_width + block_y : block_y * r->out_width + block_x;
+          r->reduced[k] = value;
+        }
+    }
+}
+
+static void
+find_foreground (const guint16 *reduced,
+                 gint           width,
+                 gint           height,
+                 DepthBox      *foreground)
+{
+  gint i, j, left, right, top, bottom;
+
+  left = width;
+  right = -1;
+  top = height;
+  bottom = -1;
+
+  for (j = 0; j < height; j++)
+    {
+      const guint16 *row = reduced + j * width;
+
+      for (i = 0; i < width && row[i] == 0; i++);
+      if (i == width)
+        continue;
+
+      left = MIN (left, i);
+      for (i = width - 1; row[i] == 0; i--);
+      right = MAX (right, i);
+
+      top = MIN (top, j);
+      bottom = j;
+    }
+
+  if (right < left)
+    {
+      foreground->x = foreground->y = 0;
+      foreground->width = foreground->height = 0;
+    }
+  else
+    {
+      foreground->x = left;
+      foreground->y = top;
+      foreground->width = right - left + 1;
+      foreground->height = bottom - top + 1;
+    }
+}
+
+/* Returns the number of pixels with depth in the @width x @height
+   @reduced frame, and sets (@centre_x, @centre_y) to their centre, or
+   to the centre of the frame if there are none */
+guint
+depth_process_get_area (const guint16 *reduced,
+                        gint           width,
+                        gint           height,
+                        gfloat        *centre_x,
+                        gfloat        *centre_y)
+{
+  guint64 x_sum, y_sum;
+  guint area;
+  gint i, j;
+
+  area = 0;
+  x_sum = 0;
+  y_sum = 0;
+
+  for (j = 0; j < height; j++)
+    {
+      const guint16 *row = reduced + j * width;
+      guint row_area = 0;
+
+      for (i = 0; i < width; i++)
+        {
+          if (row[i] != 0)
+            {
+              row_area++;
+              x_sum += i;
+            }
+        }
+
+      area += row_area;
+      y_sum += (guint64) row_area * j;
+    }
+
+  if (area == 0)
+    {
+      *centre_x = width / 2.0;
+      *centre_y = height / 2.0;
+    }
+  else
+    {
+      *centre_x = (gfloat) x_sum / area;
+      *centre_y = (gfloat) y_sum / area;
+    }
+
+  return area;
+}
+
+/* Sets the values of @row outside [threshold_begin, threshold_end] to
+   0, with the fastest kernel the CPU has */
+void
+depth_process_threshold (guint16 *row,
+                         gint     length,
+                         guint16  threshold_begin,
+                         guint16  threshold_end)
+{
+  get_row_funcs ()->threshold (row, length, threshold_begin, threshold_end);
+}
+
+/* Writes to @bits one bit per value of @row, set if it is within
+   [threshold_begin, threshold_end]. @bits must hold (length + 63) /
+   64 words; the bits past @length are cleared. */
+void
+depth_process_threshold_mask (const guint16 *row,
+                              gint           length,
+                              guint16        threshold_begin,
+                              guint16        threshold_end,
+                              guint64       *bits)
+{
+  get_row_funcs ()->mask (bits, row, length, threshold_begin, threshold_end);
+}
+
+/* Reads the raw depth frame once and writes the (optionally rotated)
+   reduced and thresholded frame straight into @reduced, which must
+   hold at least (width / dimension_factor) * (height /
+   dimension_factor) values. The rotation matches the one the stream
+   used to apply on the full frame: the rotated image is @height
+   pixels wide and @width pixels high.
+
+   @sampling tells how every dimension_factor x dimension_factor block
+   becomes a reduced pixel: by picking one of its pixels, which is the
+   cheapest but loses anything thinner than a block, or from all of
+   its pixels within the thresholds (see DepthSampling).
+
+   With @disparity, @depth holds the raw 11 bit disparities of the
+   device and the thresholds are disparities as well (see
+   depth_process_disparity_range()); pixels are only converted to
+   millimetres once they are sampled and within the thresholds.
+
+   If @background is given, a frame of the same layout as @depth with
+   the depth of the empty scene in millimetres, pixels that are not at least
+   @background_margin closer than it are dropped too.
+
+   If @foreground is given, it is set to the bounding box of the
+   pixels left, with a width of 0 if there are none.
+
+   If @workers are given, the frame is reduced by all of them, in
+   horizontal tiles. */
+void
+depth_process_reduce (const guint16 *depth,
+                      gint           width,
+                      gint           height,
+                      gboolean       disparity,
+                      gboolean       rotate,
+                      guint          dimension_factor,
+                      DepthSampling  sampling,
+                      guint16        threshold_begin,
+                      guint16        threshold_end,
+                      const guint16 *background,
+                      guint16        background_margin,
+                      guint16       *reduced,
+                      gint          *reduced_width,
+                      gint          *reduced_height,
+                      DepthBox      *foreground,
+                      DepthWorkers  *workers)
+{
+  Reduction r;
+
+  g_return_if_fail (depth != NULL && reduced != NULL);
+  g_return_if_fail (dimension_factor > 0);
+
+  r.funcs = get_row_funcs ();
+  r.sampling = sampling;
+  r.depth = depth;
+  r.width = width;
+  r.height = height;
+  r.disparity_lut = NULL;
+  r.rotate = rotate;
+  r.factor = (gint) dimension_factor;
+  r.threshold_begin = threshold_begin;
+  r.threshold_end = threshold_end;
+  r.background = background;
+  r.background_margin = background_margin;
+  r.reduced = reduced;
+
+  if (disparity)
+    {
+      r.disparity_lut = depth_process_get_disparity_lut ();
+
+      /* also keeps lookups within the table */
+      r.threshold_end = MIN (threshold_end, DEPTH_DISPARITY_INVALID - 1);
+    }
+
+  if (rotate)
+    {
+      r.out_width = height / r.factor;
+      r.out_height = width / r.factor;
+    }
+  else
+    {
+      r.out_width = width / r.factor;
+      r.out_height = height / r.factor;
+    }
+
+  /* every reduced row, or row of blocks, is written by one thread */
+  if (sampling == DEPTH_SAMPLING_POINT || r.factor == 1)
+    depth_workers_run (workers, r.out_height, 1, reduce_point, &r);
+  else
+    depth_workers_run (workers, height / r.factor, 1, reduce_pooled, &r);
+
+  *reduced_width = r.out_width;
+  *reduced_height = r.out_height;
+
+  if (foreground != NULL)
+    find_foreground (reduced, r.out_width, r.out_height, foreground);
+}
+
+/* Returns the table converting the device's raw disparities to
+   millimetres, DEPTH_DISPARITY_LEVELS entries long. Disparities with
+   no valid depth, DEPTH_DISPARITY_INVALID among them, map to 0, and
+   so does 0 itself, which is what thresholded pixels become. Depth
+   grows with the disparity over the valid ones. */
+const guint16 *
+depth_process_get_disparity_lut (void)
+{
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      gint i;
+
+      for (i = 1; i < DEPTH_DISPARITY_INVALID; i++)
+        {
+          gdouble angle, depth;
+
+          angle = i / DISPARITY_SCALE + DISPARITY_OFFSET;
+          depth = angle < G_PI_2 ? DISPARITY_DEPTH * tan (angle) : 0.0;
+
+          if (depth > 0.0 && depth <= DISPARITY_MAX_DEPTH)
+            disparity_lut[i] = (guint16) (depth + .5);
+          else
+            disparity_lut[i] = 0;
+        }
+
+      disparity_lut[0] = 0;
+      disparity_lut[DEPTH_DISPARITY_INVALID] = 0;
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return disparity_lut;
+}
+
+/* Turns depth thresholds in millimetres into the range of disparities
+   that convert to depths within them. If there is none, the range
+   returned is empty, with @disparity_begin above @disparity_end. */
+void
+depth_process_disparity_range (guint16  threshold_begin,
+                               guint16  threshold_end,
+                               guint16 *disparity_begin,
+                               guint16 *disparity_end)
+{
+  const guint16 *lut;
+  gint i;
+
+  lut = depth_process_get_disparity_lut ();
+
+  *disparity_begin = DEPTH_DISPARITY_INVALID;
+  *disparity_end = 0;
+
+  for (i = 1; i < DEPTH_DISPARITY_INVALID; i++)
+    {
+      if (lut[i] == 0 || lut[i] < threshold_begin || lut[i] > threshold_end)
+        continue;
+
+      *disparity_begin = MIN (*disparity_begin, i);
+      *disparity_end = i;
+    }
+}
+
+/* Converts a whole frame of raw disparities, for whatever needs every
+   pixel in millimetres */
+void
+depth_process_disparity_to_mm (const guint16 *disparity,
+                               guint16       *depth,
+                               gint           length)
+{
+  const guint16 *lut;
+  gint i;
+
+  lut = depth_process_get_disparity_lut ();
+
+  for (i = 0; i < length; i++)
+    depth[i] = lut[disparity[i] & DEPTH_DISPARITY_INVALID];
+}
+
+/* Parses a sampling name, "point", "nearest" or "mean" */
+gboolean
+depth_process_sampling_from_string (const gchar *name, DepthSampling *sampling)
+{
+  if (g_strcmp0 (name, "point") == 0)
+    *sampling = DEPTH_SAMPLING_POINT;
+  else if (g_strcmp0 (name, "nearest") == 0)
+    *sampling = DEPTH_SAMPLING_NEAREST;
+  else if (g_strcmp0 (name, "mean") == 0)
+    *sampling = DEPTH_SAMPLING_MEAN;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Chooses the region of a reduced frame of @width x @height worth
+   tracking, given the @foreground bounding box. The region keeps the
+   aspect ratio of the whole frame, to the nearest pixel, as skeltrack
+   derives its millimetre conversion from it; the joints found are
+   converted again with the frame's own aspect anyway, see
+   depth_process_uncrop_joints(). The @previous region (if any) is
+   kept as long as the foreground fits comfortably in it, so the
+   region doesn't wobble with every frame. */
+void
+depth_process_fit_crop (const DepthBox *foreground,
+                        gint            width,
+                        gint            height,
+                        const DepthBox *previous,
+                        DepthBox       *crop)
+{
+  DepthBox box;
+
+  if (foreground->width == 0)
+    {
+      crop->x = crop->y = 0;
+      crop->width = width;
+      crop->height = height;
+      return;
+    }
+
+  box.x = MAX (0, foreground->x - CROP_MARGIN);
+  box.y = MAX (0, foreground->y - CROP_MARGIN);
+  box.width = MIN (width, foreground->x + foreground->width + CROP_MARGIN) - box.x;
+  box.height = MIN (height, foreground->y + foreground->height + CROP_MARGIN) - box.y;
+
+  if (previous != NULL &&
+      previous->width > 0 &&
+      previous->x <= box.x &&
+      previous->y <= box.y &&
+      previous->x + previous->width >= box.x + box.width &&
+      previous->y + previous->height >= box.y + box.height &&
+      previous->width * previous->height <= 2 * box.width * box.height)
+    {
+      *crop = *previous;
+      return;
+    }
+
+  /* as tall as the box needs, or as its width needs with the frame's
+     aspect, and as wide as that height needs; neither can exceed the
+     frame, as the box doesn't */
+  crop->height = MAX (box.height, (box.width * height + width - 1) / width);
+  crop->width = MAX (box.width, (crop->height * width + height / 2) / height);
+
+  /* centred on the foreground, but inside the frame */
+  crop->x = CLAMP (box.x + box.width / 2 - crop->width / 2,
+                   0,
+                   width - crop->width);
+  crop->y = CLAMP (box.y + box.height / 2 - crop->height / 2,
+                   0,
+                   height - crop->height);
+}
+
+/* Moves the @crop region of the reduced frame, @width pixels wide, to
+   the beginning of @reduced, as a contiguous frame of its own */
+void
+depth_process_crop (guint16 *reduced, gint width, const DepthBox *crop)
+{
+  gint j;
+
+  if (crop->width == width && crop->x == 0 && crop->y == 0)
+    return;
+
+  /* rows only ever move backwards */
+  for (j = 0; j < crop->height; j++)
+    {
+      memmove (reduced + j * crop->width,
+               reduced + (crop->y + j) * width + crop->x,
+               crop->width * sizeof (guint16));
+    }
+}
+
+/* Translates the joints skeltrack found in the @crop region back to
+   the whole reduced frame of @width x @height, recomputing their
+   millimetre coordinates the way skeltrack does for whole frames */
+void
+depth_process_uncrop_joints (SkeltrackJointList list,
+                             const DepthBox    *crop,
+                             gint               width,
+                             gint               height,
+                             guint              dimension_factor)
+{
+  gfloat relation;
+  gint i;
+
+  if (list == NULL)
+    return;
+
+  relation = width > height ?
+    (gfloat) width / height : (gfloat) height / width;
+
+  for (i = 0; i < SKELTRACK_JOINT_MAX_JOINTS; i++)
+    {
+      SkeltrackJoint *joint = list[i];
+
+      if (joint == NULL)
+        continue;
+
+      joint->screen_x += crop->x * dimension_factor;
+      joint->screen_y += crop->y * dimension_factor;
+
+      joint->x = round ((joint->screen_x - width * dimension_factor / 2.0) *
+                        (joint->z + MIN_DISTANCE) * SCALE_FACTOR * relation);
+      joint->y = round ((joint->screen_y - height * dimension_factor / 2.0) *
+                        (joint->z + MIN_DISTANCE) * SCALE_FACTOR);
+    }
+}
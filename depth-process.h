@@ -0,0 +1,125 @@
+/*
+ * depth-process.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_PROCESS_H__
+#define __DEPTH_PROCESS_H__
+
+#include <glib.h>
+#include <skeltrack-joint.h>
+#include "depth-workers.h"
+
+G_BEGIN_DECLS
+
+/* the device's raw depth is an 11 bit disparity, this one meaning no
+   reading */
+#define DEPTH_DISPARITY_LEVELS 2048
+#define DEPTH_DISPARITY_INVALID (DEPTH_DISPARITY_LEVELS - 1)
+
+/* how a block of pixels becomes a reduced pixel */
+typedef enum
+{
+  /* one pixel of the block */
+  DEPTH_SAMPLING_POINT,
+
+  /* the nearest pixel with depth, keeps limbs thinner than a block */
+  DEPTH_SAMPLING_NEAREST,
+
+  /* the mean of the pixels with depth */
+  DEPTH_SAMPLING_MEAN
+} DepthSampling;
+
+typedef struct
+{
+  gint x;
+  gint y;
+  gint width;
+  gint height;
+} DepthBox;
+
+void    depth_process_threshold       (guint16       *row,
+                                       gint           length,
+                                       guint16        threshold_begin,
+                                       guint16        threshold_end);
+
+void    depth_process_threshold_mask  (const guint16 *row,
+                                       gint           length,
+                                       guint16        threshold_begin,
+                                       guint16        threshold_end,
+                                       guint64       *bits);
+
+void    depth_process_reduce          (const guint16 *depth,
+                                       gint           width,
+                                       gint           height,
+                                       gboolean       disparity,
+                                       gboolean       rotate,
+                                       guint          dimension_factor,
+                                       DepthSampling  sampling,
+                                       guint16        threshold_begin,
+                                       guint16        threshold_end,
+                                       const guint16 *background,
+                                       guint16        background_margin,
+                                       guint16       *reduced,
+                                       gint          *reduced_width,
+                                       gint          *reduced_height,
+                                       DepthBox      *foreground,
+                                       DepthWorkers  *workers);
+
+guint   depth_process_get_area        (const guint16 *reduced,
+                                       gint           width,
+                                       gint           height,
+                                       gfloat        *centre_x,
+                                       gfloat        *centre_y);
+
+const guint16 * depth_process_get_disparity_lut (void);
+
+void    depth_process_disparity_range (guint16        threshold_begin,
+                                       guint16        threshold_end,
+                                       guint16       *disparity_begin,
+                                       guint16       *disparity_end);
+
+void    depth_process_disparity_to_mm (const guint16 *disparity,
+                                       guint16       *depth,
+                                       gint           length);
+
+gboolean depth_process_sampling_from_string (const gchar   *name,
+                                            DepthSampling *sampling);
+
+void    depth_process_fit_crop        (const DepthBox *foreground,
+                                       gint            width,
+                                       gint            height,
+                                       const DepthBox *previous,
+                                       DepthBox       *crop);
+
+void    depth_process_crop            (guint16        *reduced,
+                                       gint            width,
+                                       const DepthBox *crop);
+
+void    depth_process_uncrop_joints   (SkeltrackJointList list,
+                                       const DepthBox    *crop,
+                                       gint               width,
+                                       gint               height,
+                                       guint              dimension_factor);
+
+G_END_DECLS
+
+#endif /* __DEPTH_PROCESS_H__ */
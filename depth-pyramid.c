@@ -0,0 +1,203 @@
+/*
+ * depth-pyramid.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#include "depth-pyramid.h"
+#include "depth-process.h"
+
+#include <string.h>
+
+static void
+get_level_size (gint  width,
+                gint  height,
+                guint level,
+                gint *level_width,
+                gint *level_height)
+{
+  *level_width = width >> level;
+  *level_height = height >> level;
+}
+
+/* Every pixel of @dst is the nearest valid one of a 2x2 block of @src.
+   Invalid pixels (0) wrap around when decreased by one, so the plain
+   unsigned minimum skips them, as in depth-process.c. */
+static void
+reduce_level (const guint16 *src,
+              gint           src_width,
+              guint16       *dst,
+              gint           width,
+              gint           height)
+{
+  gint i, j;
+
+  for (j = 0; j < height; j++)
+    {
+      const guint16 *top = src + 2 * j * src_width;
+      const guint16 *bottom = top + src_width;
+      guint16 *row = dst + j * width;
+
+      for (i = 0; i < width; i++)
+        {
+          guint16 a, b;
+
+          a = MIN ((guint16) (top[2 * i] - 1), (guint16) (top[2 * i + 1] - 1));
+          b = MIN ((guint16) (bottom[2 * i] - 1), (guint16) (bottom[2 * i + 1] - 1));
+          row[i] = MIN (a, b) + 1;
+        }
+    }
+}
+
+/* public methods */
+
+/* Number of pixels a buffer for the pyramid of a @width x @height
+   frame must hold */
+gsize
+depth_pyramid_get_size (gint width, gint height)
+{
+  gsize size = 0;
+  guint level;
+
+  for (level = 0; level < DEPTH_PYRAMID_LEVELS; level++)
+    {
+      gint level_width, level_height;
+
+      get_level_size (width, height, level, &level_width, &level_height);
+      size += level_width * level_height;
+    }
+
+  return size;
+}
+
+/* Builds the pyramid of the raw @depth frame into @buffer, which must
+   hold depth_pyramid_get_size() pixels and outlive @pyramid. Pixels
+   outside the thresholds are set to 0 on every level. */
+void
+depth_pyramid_build (DepthPyramid  *pyramid,
+                     guint16       *buffer,
+                     const guint16 *depth,
+                     gint           width,
+                     gint           height,
+                     gboolean       rotated,
+                     guint16        threshold_begin,
+                     guint16        threshold_end)
+{
+  depth_pyramid_build_rows (buffer,
+                            depth,
+                            width,
+                            height,
+                            0,
+                            height,
+                            threshold_begin,
+                            threshold_end);
+  depth_pyramid_init (pyramid, buffer, width, height, rotated);
+}
+
+/* Builds the part of the pyramid in @buffer that comes from raw rows
+   [@first_row, @last_row) of @depth, on every level, so that a frame
+   can be built in parts, from several threads. Both rows must be
+   multiples of DEPTH_PYRAMID_ALIGNMENT, unless @last_row is @height,
+   for the parts not to share pixels of the coarser levels. */
+void
+depth_pyramid_build_rows (guint16       *buffer,
+                          const guint16 *depth,
+                          gint           width,
+                          gint           height,
+                          gint           first_row,
+                          gint           last_row,
+                          guint16        threshold_begin,
+                          guint16        threshold_end)
+{
+  guint16 *finer, *level_data;
+  gint finer_width, level_width, level_height, j;
+  guint level;
+
+  /* the copy the hand poses used to take, thresholded on the way */
+  for (j = first_row; j < last_row; j++)
+    {
+      guint16 *row = buffer + j * width;
+
+      memcpy (row, depth + j * width, width * sizeof (guint16));
+      depth_process_threshold (row, width, threshold_begin, threshold_end);
+    }
+
+  finer = buffer;
+  finer_width = width;
+  level_data = buffer + width * height;
+  for (level = 1; level < DEPTH_PYRAMID_LEVELS; level++)
+    {
+      gint first, last;
+
+      get_level_size (width, height, level, &level_width, &level_height);
+
+      first = first_row >> level;
+      last = last_row == height ? level_height : last_row >> level;
+      if (first < last)
+        {
+          reduce_level (finer + 2 * first * finer_width,
+                        finer_width,
+                        level_data + first * level_width,
+                        level_width,
+                        last - first);
+        }
+
+      finer = level_data;
+      finer_width = level_width;
+      level_data += level_width * level_height;
+    }
+}
+
+/* Presents the pyramid built in @buffer through @pyramid */
+void
+depth_pyramid_init (DepthPyramid  *pyramid,
+                    const guint16 *buffer,
+                    gint           width,
+                    gint           height,
+                    gboolean       rotated)
+{
+  guint level;
+
+  for (level = 0; level < DEPTH_PYRAMID_LEVELS; level++)
+    {
+      gint level_width, level_height;
+
+      get_level_size (width, height, level, &level_width, &level_height);
+      depth_view_init (&pyramid->levels[level],
+                       buffer,
+                       level_width,
+                       level_height,
+                       rotated);
+
+      if (buffer != NULL)
+        buffer += level_width * level_height;
+    }
+}
+
+/* For frames nobody needs at full resolution: every level has the
+   size it would have, but no data */
+void
+depth_pyramid_init_empty (DepthPyramid *pyramid,
+                          gint          width,
+                          gint          height,
+                          gboolean      rotated)
+{
+  depth_pyramid_init (pyramid, NULL, width, height, rotated);
+}
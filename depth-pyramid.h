@@ -0,0 +1,89 @@
+/*
+ * depth-pyramid.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_PYRAMID_H__
+#define __DEPTH_PYRAMID_H__
+
+#include <glib.h>
+#include "depth-view.h"
+
+G_BEGIN_DECLS
+
+#define DEPTH_PYRAMID_LEVELS 3
+
+/* rows a pyramid can be built in parts of must be multiples of this */
+#define DEPTH_PYRAMID_ALIGNMENT (1 << (DEPTH_PYRAMID_LEVELS - 1))
+
+/* A thresholded depth frame at full, 1/2 and 1/4 resolution, built
+   once per frame for everything that reads depth at full resolution.
+   Every level keeps, for each 2x2 block of the previous one, the
+   nearest depth within the thresholds, so a coarse level never misses
+   a close object a finer one has. Levels are presented through views,
+   rotated as the frame is, and level @n pixel (x, y) covers the 2^n x
+   2^n block at (x * 2^n, y * 2^n) of level 0. */
+typedef struct
+{
+  DepthView levels[DEPTH_PYRAMID_LEVELS];
+} DepthPyramid;
+
+gsize   depth_pyramid_get_size        (gint           width,
+                                       gint           height);
+
+void    depth_pyramid_build           (DepthPyramid  *pyramid,
+                                       guint16       *buffer,
+                                       const guint16 *depth,
+                                       gint           width,
+                                       gint           height,
+                                       gboolean       rotated,
+                                       guint16        threshold_begin,
+                                       guint16        threshold_end);
+
+void    depth_pyramid_build_rows      (guint16       *buffer,
+                                       const guint16 *depth,
+                                       gint           width,
+                                       gint           height,
+                                       gint           first_row,
+                                       gint           last_row,
+                                       guint16        threshold_begin,
+                                       guint16        threshold_end);
+
+void    depth_pyramid_init            (DepthPyramid  *pyramid,
+                                       const guint16 *buffer,
+                                       gint           width,
+                                       gint           height,
+                                       gboolean       rotated);
+
+void    depth_pyramid_init_empty      (DepthPyramid  *pyramid,
+                                       gint           width,
+                                       gint           height,
+                                       gboolean       rotated);
+
+static inline const DepthView *
+depth_pyramid_get_level (const DepthPyramid *pyramid, guint level)
+{
+  return &pyramid->levels[level];
+}
+
+G_END_DECLS
+
+#endif /* __DEPTH_PYRAMID_H__ */
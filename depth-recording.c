@@ -0,0 +1,549 @@
+/*
+ * depth-recording.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#include "depth-recording.h"
+#include "depth-codec.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Recordings are append-only: a fixed header followed by one record
+   per frame. Every record is a FrameHeader plus the frame data,
+   padded to 8 bytes so the data of every frame stays aligned within
+   the mapping. Values are stored in host byte order. */
+
+#define RECORDING_MAGIC "MSPTDREC"
+#define RECORDING_VERSION 1
+
+/* the recording file grows by this much each time it gets full */
+#define RECORDING_CHUNK_SIZE (64 * 1024 * 1024)
+
+#define RECORD_ALIGN(size) (((size) + 7) & ~((gsize) 7))
+
+typedef struct
+{
+  gchar magic[8];
+  guint32 version;
+  guint32 header_size;
+  guint32 depth_format;
+  guint32 reserved[11];
+} RecordingHeader;
+
+typedef struct
+{
+  guint32 record_size;
+  guint16 width;
+  guint16 height;
+  gint64 timestamp;
+  guint32 encoding;
+  guint32 data_size;
+} FrameHeader;
+
+typedef enum
+{
+  FRAME_ENCODING_RAW = 0,
+  FRAME_ENCODING_KEY,
+  FRAME_ENCODING_DELTA
+} FrameEncoding;
+
+struct _DepthRecorder
+{
+  gchar *path;
+  gint fd;
+
+  guint8 *map;
+  gsize capacity;
+  gsize length;
+
+  guint n_frames;
+
+  /* compression, and its figures for the final report */
+  gboolean compress;
+  DepthEncoder *encoder;
+  gint encoder_width;
+  gint encoder_height;
+  guint64 raw_bytes;
+  guint64 stored_bytes;
+  gint64 encode_time;
+};
+
+struct _DepthReplay
+{
+  GMappedFile *file;
+  const guint8 *data;
+  gsize length;
+
+  guint depth_format;
+
+  /* offset of every complete record in the file */
+  GArray *offsets;
+  guint current;
+
+  /* compressed recordings are decoded into the decoder's buffer, which
+     holds the frame at @decoded */
+  DepthDecoder *decoder;
+  gint decoder_width;
+  gint decoder_height;
+  gint decoded;
+  guint64 decoded_bytes;
+  gint64 decode_time;
+};
+
+static void
+set_io_error (GError      **error,
+              gint          errsv,
+              const gchar  *action,
+              const gchar  *path)
+{
+  g_set_error (error,
+               G_FILE_ERROR,
+               g_file_error_from_errno (errsv),
+               "Failed to %s '%s': %s",
+               action,
+               path,
+               strerror (errsv));
+}
+
+static gboolean
+recorder_grow (DepthRecorder *self, gsize needed, GError **error)
+{
+  gsize capacity;
+  gpointer map;
+
+  if (needed <= self->capacity)
+    return TRUE;
+
+  capacity = self->capacity;
+  while (capacity < needed)
+    capacity += RECORDING_CHUNK_SIZE;
+
+  if (ftruncate (self->fd, capacity) != 0)
+    {
+      set_io_error (error, errno, "grow recording", self->path);
+      return FALSE;
+    }
+
+  if (self->map != NULL)
+    munmap (self->map, self->capacity);
+
+  map = mmap (NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+  if (map == MAP_FAILED)
+    {
+      self->map = NULL;
+      self->capacity = 0;
+      set_io_error (error, errno, "map recording", self->path);
+      return FALSE;
+    }
+
+  self->map = map;
+  self->capacity = capacity;
+
+  return TRUE;
+}
+
+/* Creates (or truncates) the recording at @path. @depth_format is the
+   GFreenectDepthFormat of the frames that will be added. With
+   @compress, frames are stored losslessly compressed (see
+   depth-codec.c). */
+DepthRecorder *
+depth_recorder_new (const gchar  *path,
+                    guint         depth_format,
+                    gboolean      compress,
+                    GError      **error)
+{
+  DepthRecorder *self;
+  RecordingHeader *header;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  self = g_slice_new0 (DepthRecorder);
+  self->path = g_strdup (path);
+  self->compress = compress;
+  self->fd = open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+  if (self->fd < 0)
+    {
+      set_io_error (error, errno, "create recording", path);
+      depth_recorder_free (self);
+      return NULL;
+    }
+
+  if (! recorder_grow (self, sizeof (RecordingHeader), error))
+    {
+      depth_recorder_free (self);
+      return NULL;
+    }
+
+  header = (RecordingHeader *) self->map;
+  memcpy (header->magic, RECORDING_MAGIC, sizeof (header->magic));
+  header->version = RECORDING_VERSION;
+  header->header_size = sizeof (RecordingHeader);
+  header->depth_format = depth_format;
+
+  self->length = sizeof (RecordingHeader);
+
+  return self;
+}
+
+gboolean
+depth_recorder_add_frame (DepthRecorder  *self,
+                          const guint16  *depth,
+                          gint            width,
+                          gint            height,
+                          gint64          timestamp,
+                          GError        **error)
+{
+  FrameHeader *frame_header;
+  FrameEncoding encoding;
+  guint8 *data;
+  gsize data_size, max_size, record_size;
+
+  g_return_val_if_fail (self != NULL && depth != NULL, FALSE);
+
+  data_size = width * height * sizeof (guint16);
+  max_size = data_size;
+
+  if (self->compress)
+    {
+      if (self->encoder == NULL ||
+          self->encoder_width != width ||
+          self->encoder_height != height)
+        {
+          depth_encoder_free (self->encoder);
+          self->encoder = depth_encoder_new (width, height);
+          self->encoder_width = width;
+          self->encoder_height = height;
+        }
+
+      max_size = depth_encoder_get_max_size (self->encoder);
+    }
+
+  if (! recorder_grow (self,
+                       self->length + sizeof (FrameHeader) +
+                       RECORD_ALIGN (max_size),
+                       error))
+    return FALSE;
+
+  data = self->map + self->length + sizeof (FrameHeader);
+
+  if (self->compress)
+    {
+      gint64 start_time;
+      gboolean keyframe;
+
+      /* encoded straight into the mapping */
+      start_time = g_get_monotonic_time ();
+      data_size = depth_encoder_encode (self->encoder, depth, data, &keyframe);
+      self->encode_time += g_get_monotonic_time () - start_time;
+
+      encoding = keyframe ? FRAME_ENCODING_KEY : FRAME_ENCODING_DELTA;
+    }
+  else
+    {
+      memcpy (data, depth, data_size);
+      encoding = FRAME_ENCODING_RAW;
+    }
+
+  record_size = sizeof (FrameHeader) + RECORD_ALIGN (data_size);
+
+  frame_header = (FrameHeader *) (self->map + self->length);
+  frame_header->width = width;
+  frame_header->height = height;
+  frame_header->timestamp = timestamp;
+  frame_header->encoding = encoding;
+  frame_header->data_size = data_size;
+
+  /* written last, a record with no size marks the end of the file if
+     the application dies half way */
+  frame_header->record_size = record_size;
+
+  self->length += record_size;
+  self->n_frames++;
+  self->raw_bytes += width * height * sizeof (guint16);
+  self->stored_bytes += record_size;
+
+  return TRUE;
+}
+
+void
+depth_recorder_free (DepthRecorder *self)
+{
+  if (self == NULL)
+    return;
+
+  if (self->map != NULL)
+    munmap (self->map, self->capacity);
+
+  if (self->fd >= 0)
+    {
+      /* drop the unused tail of the last chunk */
+      if (self->length > 0 && ftruncate (self->fd, self->length) != 0)
+        g_warning ("Failed to truncate recording '%s'", self->path);
+
+      close (self->fd);
+
+      g_print ("Recorded %u depth frames to %s: %.1f MB raw, %.1f MB stored",
+               self->n_frames,
+               self->path,
+               self->raw_bytes / 1e6,
+               self->stored_bytes / 1e6);
+      if (self->compress && self->stored_bytes > 0 && self->encode_time > 0)
+        {
+          g_print (" (ratio %.2f, encoding at %.0f MB/s)",
+                   (gdouble) self->raw_bytes / self->stored_bytes,
+                   self->raw_bytes / (gdouble) self->encode_time);
+        }
+      g_print ("\n");
+    }
+
+  depth_encoder_free (self->encoder);
+  g_free (self->path);
+  g_slice_free (DepthRecorder, self);
+}
+
+/* Maps the recording at @path. Frames are returned straight from the
+   mapping, without copying. */
+DepthReplay *
+depth_replay_new (const gchar *path, GError **error)
+{
+  DepthReplay *self;
+  const RecordingHeader *header;
+  gsize offset;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  self = g_slice_new0 (DepthReplay);
+  self->offsets = g_array_new (FALSE, FALSE, sizeof (gsize));
+  self->decoded = -1;
+
+  self->file = g_mapped_file_new (path, FALSE, error);
+  if (self->file == NULL)
+    {
+      depth_replay_free (self);
+      return NULL;
+    }
+
+  self->data = (const guint8 *) g_mapped_file_get_contents (self->file);
+  self->length = g_mapped_file_get_length (self->file);
+
+  header = (const RecordingHeader *) self->data;
+  if (self->length < sizeof (RecordingHeader) ||
+      memcmp (header->magic, RECORDING_MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != RECORDING_VERSION)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   G_FILE_ERROR_INVAL,
+                   "'%s' is not a depth recording",
+                   path);
+      depth_replay_free (self);
+      return NULL;
+    }
+
+  self->depth_format = header->depth_format;
+
+  /* index the complete records, a truncated tail is ignored */
+  offset = header->header_size;
+  while (offset + sizeof (FrameHeader) <= self->length)
+    {
+      const FrameHeader *frame_header;
+
+      frame_header = (const FrameHeader *) (self->data + offset);
+      if (frame_header->record_size < sizeof (FrameHeader) ||
+          offset + frame_header->record_size > self->length ||
+          frame_header->data_size > frame_header->record_size -
+          sizeof (FrameHeader))
+        break;
+
+      if (frame_header->encoding == FRAME_ENCODING_RAW)
+        {
+          if (frame_header->data_size < (gsize) frame_header->width *
+              frame_header->height * sizeof (guint16))
+            break;
+        }
+      else if (frame_header->encoding != FRAME_ENCODING_KEY &&
+               frame_header->encoding != FRAME_ENCODING_DELTA)
+        {
+          break;
+        }
+
+      g_array_append_val (self->offsets, offset);
+      offset += frame_header->record_size;
+    }
+
+  if (self->offsets->len == 0)
+    {
+      g_set_error (error,
+                   G_FILE_ERROR,
+                   G_FILE_ERROR_INVAL,
+                   "Depth recording '%s' has no frames",
+                   path);
+      depth_replay_free (self);
+      return NULL;
+    }
+
+  return self;
+}
+
+void
+depth_replay_free (DepthReplay *self)
+{
+  if (self == NULL)
+    return;
+
+  if (self->decode_time > 0)
+    {
+      g_print ("Depth replay decoded %.1f MB at %.0f MB/s\n",
+               self->decoded_bytes / 1e6,
+               self->decoded_bytes / (gdouble) self->decode_time);
+    }
+
+  if (self->file != NULL)
+    g_mapped_file_unref (self->file);
+
+  depth_decoder_free (self->decoder);
+
+  g_array_free (self->offsets, TRUE);
+  g_slice_free (DepthReplay, self);
+}
+
+guint
+depth_replay_get_depth_format (DepthReplay *self)
+{
+  return self->depth_format;
+}
+
+static const FrameHeader *
+get_frame_header (DepthReplay *self, guint index)
+{
+  return (const FrameHeader *) (self->data +
+                                g_array_index (self->offsets, gsize, index));
+}
+
+static const guint16 *
+decode_frame (DepthReplay *self, guint index)
+{
+  const FrameHeader *frame_header;
+  const guint16 *depth = NULL;
+  gint64 start_time;
+  guint first;
+
+  frame_header = get_frame_header (self, index);
+
+  if (self->decoder == NULL ||
+      self->decoder_width != frame_header->width ||
+      self->decoder_height != frame_header->height)
+    {
+      depth_decoder_free (self->decoder);
+      self->decoder = depth_decoder_new (frame_header->width,
+                                         frame_header->height);
+      self->decoder_width = frame_header->width;
+      self->decoder_height = frame_header->height;
+      self->decoded = -1;
+    }
+
+  /* delta frames need every frame since the last key frame */
+  if (self->decoded >= 0 && (guint) self->decoded + 1 == index)
+    {
+      first = index;
+    }
+  else
+    {
+      first = index;
+      while (first > 0 &&
+             get_frame_header (self, first)->encoding != FRAME_ENCODING_KEY)
+        first--;
+    }
+
+  start_time = g_get_monotonic_time ();
+
+  for (; first <= index; first++)
+    {
+      frame_header = get_frame_header (self, first);
+      depth = depth_decoder_decode (self->decoder,
+                                    (const guint8 *) (frame_header + 1),
+                                    frame_header->data_size,
+                                    frame_header->encoding == FRAME_ENCODING_KEY);
+      if (depth == NULL)
+        break;
+
+      self->decoded_bytes += frame_header->width * frame_header->height *
+        sizeof (guint16);
+    }
+
+  self->decode_time += g_get_monotonic_time () - start_time;
+  self->decoded = depth != NULL ? (gint) index : -1;
+
+  return depth;
+}
+
+/* Returns the current frame, pointing into the mapped file for raw
+   recordings or into the decoder's buffer for compressed ones. NULL
+   is returned if a compressed frame can't be decoded. */
+const guint16 *
+depth_replay_get_frame (DepthReplay *self,
+                        gint        *width,
+                        gint        *height,
+                        gint64      *timestamp)
+{
+  const FrameHeader *frame_header;
+
+  frame_header = get_frame_header (self, self->current);
+
+  if (width != NULL)
+    *width = frame_header->width;
+  if (height != NULL)
+    *height = frame_header->height;
+  if (timestamp != NULL)
+    *timestamp = frame_header->timestamp;
+
+  if (frame_header->encoding == FRAME_ENCODING_RAW)
+    return (const guint16 *) (frame_header + 1);
+
+  return decode_frame (self, self->current);
+}
+
+gint64
+depth_replay_get_timestamp (DepthReplay *self)
+{
+  return get_frame_header (self, self->current)->timestamp;
+}
+
+/* Moves on to the next frame. Returns FALSE when the recording wrapped
+   around to its first frame. */
+gboolean
+depth_replay_advance (DepthReplay *self)
+{
+  self->current++;
+
+  if (self->current >= self->offsets->len)
+    {
+      self->current = 0;
+      return FALSE;
+    }
+
+  return TRUE;
+}
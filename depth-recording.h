@@ -0,0 +1,66 @@
+/*
+ * depth-recording.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_RECORDING_H__
+#define __DEPTH_RECORDING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DepthRecorder DepthRecorder;
+typedef struct _DepthReplay DepthReplay;
+
+DepthRecorder * depth_recorder_new          (const gchar    *path,
+                                             guint           depth_format,
+                                             gboolean        compress,
+                                             GError        **error);
+
+gboolean        depth_recorder_add_frame    (DepthRecorder  *self,
+                                             const guint16  *depth,
+                                             gint            width,
+                                             gint            height,
+                                             gint64          timestamp,
+                                             GError        **error);
+
+void            depth_recorder_free         (DepthRecorder  *self);
+
+DepthReplay *   depth_replay_new            (const gchar    *path,
+                                             GError        **error);
+
+void            depth_replay_free           (DepthReplay    *self);
+
+guint           depth_replay_get_depth_format (DepthReplay  *self);
+
+const guint16 * depth_replay_get_frame      (DepthReplay    *self,
+                                             gint           *width,
+                                             gint           *height,
+                                             gint64         *timestamp);
+
+gint64          depth_replay_get_timestamp  (DepthReplay    *self);
+
+gboolean        depth_replay_advance        (DepthReplay    *self);
+
+G_END_DECLS
+
+#endif /* __DEPTH_RECORDING_H__ */
@@ -0,0 +1,710 @@
+/*
+ * depth-synth.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+/* Renders a person made of capsules into depth frames in millimetres
+   (or raw disparities, see depth_synth_set_disparity()), as the
+   Kinect lying on its side would see it, so the frames can go through
+   the very same rotation and reduction as the device's. The
+   projection is the inverse of the one skeltrack uses to turn pixels
+   into millimetres, so the joints it reports follow the scripted
+   ones. World coordinates are in millimetres, x to the right and y
+   down as seen in the rotated image, z away from the camera. */
+
+#include "depth-synth.h"
+#include "depth-process.h"
+
+#include <math.h>
+#include <string.h>
+
+/* same constants skeltrack uses to convert screen coordinates */
+#define SCALE_FACTOR .0021
+#define MIN_DISTANCE -10.0
+
+#define HEAD_RADIUS 100
+#define NECK_RADIUS 50
+#define TORSO_RADIUS 110
+#define ARM_RADIUS 45
+#define HAND_RADIUS 55
+#define LEG_RADIUS 70
+
+/* length of each motion, in frames at DEPTH_SYNTH_FPS */
+#define IDLE_LENGTH 30
+#define WAVE_LENGTH 90
+#define BOW_LENGTH 60
+#define KISS_LENGTH 75
+#define CURTSY_LENGTH 75
+
+#define LEFT 0
+#define RIGHT 1
+
+typedef struct
+{
+  gfloat x;
+  gfloat y;
+  gfloat z;
+} Point;
+
+typedef struct
+{
+  Point head;
+  Point neck;
+  Point shoulder[2];
+  Point elbow[2];
+  Point hand[2];
+  Point hip[2];
+  Point knee[2];
+  Point foot[2];
+} Pose;
+
+struct _DepthSynth
+{
+  gint width;
+  gint height;
+
+  DepthSynthMotion motion;
+  guint distance;
+  guint background;
+  guint noise;
+  guint32 seed;
+
+  /* the scene is drawn upright, then rotated into @frame */
+  guint16 *scene;
+  gint scene_width;
+  gint scene_height;
+  guint16 *frame;
+
+  /* millimetres to raw disparities, if frames are rendered as such */
+  guint16 *to_disparity;
+};
+
+static const struct
+{
+  DepthSynthMotion motion;
+  const gchar *name;
+  guint length;
+} motions[] =
+{
+  { DEPTH_SYNTH_MOTION_IDLE, "idle", IDLE_LENGTH },
+  { DEPTH_SYNTH_MOTION_WAVE, "wave", WAVE_LENGTH },
+  { DEPTH_SYNTH_MOTION_BOW, "bow", BOW_LENGTH },
+  { DEPTH_SYNTH_MOTION_KISS, "kiss", KISS_LENGTH },
+  { DEPTH_SYNTH_MOTION_CURTSY, "curtsy", CURTSY_LENGTH }
+};
+
+/* what DEPTH_SYNTH_MOTION_ALL goes through */
+static const DepthSynthMotion script[] =
+{
+  DEPTH_SYNTH_MOTION_IDLE,
+  DEPTH_SYNTH_MOTION_WAVE,
+  DEPTH_SYNTH_MOTION_IDLE,
+  DEPTH_SYNTH_MOTION_BOW,
+  DEPTH_SYNTH_MOTION_IDLE,
+  DEPTH_SYNTH_MOTION_KISS,
+  DEPTH_SYNTH_MOTION_IDLE,
+  DEPTH_SYNTH_MOTION_CURTSY
+};
+
+static Point
+point (gfloat x, gfloat y, gfloat z)
+{
+  Point p = { x, y, z };
+
+  return p;
+}
+
+static Point
+lerp (Point a, Point b, gfloat t)
+{
+  return point (a.x + (b.x - a.x) * t,
+                a.y + (b.y - a.y) * t,
+                a.z + (b.z - a.z) * t);
+}
+
+/* 0 at the ends of the motion, 1 in the middle */
+static gfloat
+ease (gfloat t)
+{
+  return sin (G_PI * CLAMP (t, 0.0, 1.0));
+}
+
+/* goes from 0 to 1 between @begin and @end */
+static gfloat
+step (gfloat t, gfloat begin, gfloat end)
+{
+  t = CLAMP ((t - begin) / (end - begin), 0.0, 1.0);
+
+  return t * t * (3 - 2 * t);
+}
+
+static void
+rest_pose (Pose *pose, gfloat d)
+{
+  gint side;
+
+  pose->head = point (0, -600, d);
+  pose->neck = point (0, -470, d);
+
+  for (side = LEFT; side <= RIGHT; side++)
+    {
+      gfloat s = side == LEFT ? -1 : 1;
+
+      pose->shoulder[side] = point (s * 190, -420, d);
+      pose->elbow[side] = point (s * 215, -140, d);
+      pose->hand[side] = point (s * 225, 110, d);
+      pose->hip[side] = point (s * 100, 130, d);
+      pose->knee[side] = point (s * 105, 500, d);
+      pose->foot[side] = point (s * 110, 880, d);
+    }
+}
+
+/* the right arm goes up and the hand sways across the elbow three
+   times, as hello_gesture() expects */
+static void
+pose_wave (Pose *pose, gfloat d, gfloat t)
+{
+  gfloat raise, swing;
+
+  raise = step (t, 0.0, 0.2) * (1 - step (t, 0.8, 1.0));
+  swing = 160 * sin (2 * G_PI * 3 * step (t, 0.2, 0.8));
+
+  pose->elbow[RIGHT] = lerp (pose->elbow[RIGHT],
+                             point (300, -430, d - 80),
+                             raise);
+  pose->hand[RIGHT] = lerp (pose->hand[RIGHT],
+                            point (300 + swing, -720, d - 120),
+                            raise);
+}
+
+/* everything above the hips leans towards the camera */
+static void
+pose_bow (Pose *pose, gfloat d, gfloat t)
+{
+  Point *points = (Point *) pose;
+  gfloat angle, pivot_y;
+  guint i;
+
+  angle = G_PI / 180 * 50 * ease (t);
+  pivot_y = pose->hip[LEFT].y;
+
+  for (i = 0; i < sizeof (Pose) / sizeof (Point); i++)
+    {
+      gfloat dy, dz;
+
+      if (points[i].y >= pivot_y)
+        continue;
+
+      dy = points[i].y - pivot_y;
+      dz = points[i].z - d;
+      points[i].y = pivot_y + dy * cos (angle) - dz * sin (angle);
+      points[i].z = d + dy * sin (angle) + dz * cos (angle);
+    }
+}
+
+/* the right hand goes to the mouth, then is thrown towards the
+   camera in a wide enough movement for kiss_gesture() */
+static void
+pose_kiss (Pose *pose, gfloat d, gfloat t)
+{
+  Point elbow, hand;
+
+  elbow = pose->elbow[RIGHT];
+  hand = pose->hand[RIGHT];
+
+  if (t < 0.45)
+    {
+      gfloat to_mouth = step (t, 0.0, 0.35);
+
+      pose->elbow[RIGHT] = lerp (elbow, point (150, -300, d - 150), to_mouth);
+      pose->hand[RIGHT] = lerp (hand, point (40, -540, d - 140), to_mouth);
+    }
+  else if (t < 0.75)
+    {
+      gfloat throw = step (t, 0.45, 0.75);
+
+      pose->elbow[RIGHT] = lerp (point (150, -300, d - 150),
+                                 point (200, -440, d - 380),
+                                 throw);
+      pose->hand[RIGHT] = lerp (point (40, -540, d - 140),
+                                point (150, -350, d - 750),
+                                throw);
+    }
+  else
+    {
+      gfloat back = step (t, 0.75, 1.0);
+
+      pose->elbow[RIGHT] = lerp (point (200, -440, d - 380), elbow, back);
+      pose->hand[RIGHT] = lerp (point (150, -350, d - 750), hand, back);
+    }
+}
+
+/* the knees bend and the body goes straight down and up again, with
+   the hands below the head and inside the elbows as curtsy_gesture()
+   requires */
+static void
+pose_curtsy (Pose *pose, gfloat d, gfloat t)
+{
+  Point *points = (Point *) pose;
+  gfloat drop, arms;
+  gint side;
+  guint i;
+
+  arms = MIN (1.0, 4 * ease (t));
+
+  for (side = LEFT; side <= RIGHT; side++)
+    {
+      gfloat s = side == LEFT ? -1 : 1;
+
+      pose->elbow[side] = lerp (pose->elbow[side],
+                                point (s * 300, -150, d),
+                                arms);
+      pose->hand[side] = lerp (pose->hand[side],
+                               point (s * 230, 80, d - 60),
+                               arms);
+    }
+
+  drop = 260 * ease (t);
+
+  for (i = 0; i < sizeof (Pose) / sizeof (Point); i++)
+    {
+      if (points[i].y < pose->knee[LEFT].y)
+        points[i].y += drop;
+    }
+
+  /* the knees go forward to make up for the drop */
+  for (side = LEFT; side <= RIGHT; side++)
+    pose->knee[side].z -= drop / 2;
+}
+
+static void
+get_pose (DepthSynth *self, guint frame_index, Pose *pose)
+{
+  DepthSynthMotion motion;
+  guint length, i;
+  gfloat d, t;
+
+  d = self->distance;
+  rest_pose (pose, d);
+
+  motion = self->motion;
+  length = depth_synth_get_motion_length (self);
+  frame_index %= length;
+
+  if (motion == DEPTH_SYNTH_MOTION_ALL)
+    {
+      for (i = 0; i < G_N_ELEMENTS (script); i++)
+        {
+          length = motions[script[i]].length;
+          if (frame_index < length)
+            break;
+
+          frame_index -= length;
+        }
+
+      motion = script[i];
+    }
+
+  t = (gfloat) frame_index / length;
+
+  switch (motion)
+    {
+    case DEPTH_SYNTH_MOTION_WAVE:
+      pose_wave (pose, d, t);
+      break;
+
+    case DEPTH_SYNTH_MOTION_BOW:
+      pose_bow (pose, d, t);
+      break;
+
+    case DEPTH_SYNTH_MOTION_KISS:
+      pose_kiss (pose, d, t);
+      break;
+
+    case DEPTH_SYNTH_MOTION_CURTSY:
+      pose_curtsy (pose, d, t);
+      break;
+
+    default:
+      break;
+    }
+}
+
+/* millimetres per pixel, vertically, at depth @z */
+static gfloat
+mm_per_pixel (gfloat z)
+{
+  return (z + MIN_DISTANCE) * SCALE_FACTOR;
+}
+
+/* Draws the capsule going from @a to @b, keeping the nearest depth of
+   every pixel. Pixels are widened horizontally by the same aspect
+   relation skeltrack applies. */
+static void
+draw_capsule (DepthSynth *self, Point a, Point b, gfloat radius)
+{
+  gfloat aspect, ax, ay, bx, by, dx, dy, len2, reach;
+  gint x, y, x0, x1, y0, y1;
+
+  aspect = (gfloat) self->scene_height / self->scene_width;
+
+  ax = a.x / (mm_per_pixel (a.z) * aspect) + self->scene_width / 2.0;
+  ay = a.y / mm_per_pixel (a.z) + self->scene_height / 2.0;
+  bx = b.x / (mm_per_pixel (b.z) * aspect) + self->scene_width / 2.0;
+  by = b.y / mm_per_pixel (b.z) + self->scene_height / 2.0;
+
+  /* the segment in isotropic units, where x is scaled as y */
+  dx = (bx - ax) * aspect;
+  dy = by - ay;
+  len2 = dx * dx + dy * dy;
+
+  reach = radius / mm_per_pixel (MIN (a.z, b.z)) + 1;
+  x0 = MAX (0, (gint) floor (MIN (ax, bx) - reach / aspect));
+  x1 = MIN (self->scene_width - 1, (gint) ceil (MAX (ax, bx) + reach / aspect));
+  y0 = MAX (0, (gint) floor (MIN (ay, by) - reach));
+  y1 = MIN (self->scene_height - 1, (gint) ceil (MAX (ay, by) + reach));
+
+  for (y = y0; y <= y1; y++)
+    {
+      guint16 *row = self->scene + y * self->scene_width;
+
+      for (x = x0; x <= x1; x++)
+        {
+          gfloat px, py, t, z, dist, depth;
+
+          px = (x - ax) * aspect;
+          py = y - ay;
+
+          t = len2 > 0 ? CLAMP ((px * dx + py * dy) / len2, 0.0, 1.0) : 0.0;
+          z = a.z + (b.z - a.z) * t;
+
+          px -= dx * t;
+          py -= dy * t;
+          dist = sqrt (px * px + py * py) * mm_per_pixel (z);
+          if (dist >= radius)
+            continue;
+
+          depth = z - sqrt (radius * radius - dist * dist);
+          if (depth < 1)
+            continue;
+
+          if (row[x] == 0 || depth < row[x])
+            row[x] = (guint16) depth;
+        }
+    }
+}
+
+static void
+draw_pose (DepthSynth *self, const Pose *pose)
+{
+  Point torso_top, torso_bottom;
+  gint side;
+
+  for (side = LEFT; side <= RIGHT; side++)
+    {
+      draw_capsule (self, pose->hip[side], pose->knee[side], LEG_RADIUS);
+      draw_capsule (self, pose->knee[side], pose->foot[side], LEG_RADIUS);
+
+      /* the torso is two capsules side by side */
+      torso_top = lerp (pose->neck, pose->shoulder[side], 0.5);
+      torso_top.y += TORSO_RADIUS / 2;
+      torso_bottom = pose->hip[side];
+      torso_bottom.x *= 0.9;
+      draw_capsule (self, torso_top, torso_bottom, TORSO_RADIUS);
+
+      draw_capsule (self, pose->shoulder[side], pose->elbow[side], ARM_RADIUS);
+      draw_capsule (self, pose->elbow[side], pose->hand[side], ARM_RADIUS);
+      draw_capsule (self, pose->hand[side], pose->hand[side], HAND_RADIUS);
+    }
+
+  draw_capsule (self, pose->neck, pose->head, NECK_RADIUS);
+  draw_capsule (self, pose->head, pose->head, HEAD_RADIUS);
+}
+
+/* cheap and reproducible, the noise must not depend on the platform */
+static guint32
+xorshift (guint32 *state)
+{
+  guint32 x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+
+  return x;
+}
+
+static void
+add_noise (DepthSynth *self, guint frame_index)
+{
+  guint32 state;
+  gint i, n_pixels;
+
+  state = (self->seed ^ (frame_index * 2654435761u)) | 1;
+  n_pixels = self->scene_width * self->scene_height;
+
+  for (i = 0; i < n_pixels; i++)
+    {
+      gint value;
+
+      if (self->scene[i] == 0 || self->scene[i] == self->background)
+        continue;
+
+      value = self->scene[i] +
+        (gint) (xorshift (&state) % (2 * self->noise + 1)) - (gint) self->noise;
+      self->scene[i] = CLAMP (value, 1, G_MAXUINT16);
+    }
+}
+
+/* the inverse of the rotation the capture applies, see
+   depth_process_reduce() */
+static void
+rotate_scene (DepthSynth *self)
+{
+  gint i, j;
+
+  for (j = 0; j < self->height; j++)
+    {
+      guint16 *row = self->frame + j * self->width;
+      const guint16 *src = self->scene + (self->scene_width - 1 - j) +
+        (self->width - 1) * self->scene_width;
+
+      if (self->to_disparity != NULL)
+        {
+          for (i = 0; i < self->width; i++)
+            row[i] = self->to_disparity[src[- i * self->scene_width]];
+        }
+      else
+        {
+          for (i = 0; i < self->width; i++)
+            row[i] = src[- i * self->scene_width];
+        }
+    }
+}
+
+/* Every depth goes to the disparity that converts back the closest to
+   it, depths out of the device's range to no reading at all */
+static guint16 *
+create_disparity_table (void)
+{
+  const guint16 *lut;
+  guint16 *table;
+  gint depth, disparity, last;
+
+  lut = depth_process_get_disparity_lut ();
+  table = g_new (guint16, G_MAXUINT16 + 1);
+
+  for (last = 1; last + 1 < DEPTH_DISPARITY_INVALID && lut[last + 1] != 0; last++);
+
+  disparity = 1;
+  for (depth = 0; depth <= G_MAXUINT16; depth++)
+    {
+      if (depth < lut[1] || depth > lut[last])
+        {
+          table[depth] = DEPTH_DISPARITY_INVALID;
+          continue;
+        }
+
+      while (disparity < last &&
+             ABS (lut[disparity + 1] - depth) <= ABS (lut[disparity] - depth))
+        disparity++;
+
+      table[depth] = disparity;
+    }
+
+  return table;
+}
+
+/* public methods */
+
+/* Creates a generator of @width x @height frames, the size of the raw
+   frames of the device */
+DepthSynth *
+depth_synth_new (gint width, gint height)
+{
+  DepthSynth *self;
+
+  self = g_slice_new0 (DepthSynth);
+  self->width = width;
+  self->height = height;
+
+  self->motion = DEPTH_SYNTH_MOTION_ALL;
+  self->distance = 1500;
+  self->background = 0;
+  self->noise = 0;
+  self->seed = 1;
+
+  self->scene_width = height;
+  self->scene_height = width;
+  self->scene = g_new (guint16, width * height);
+  self->frame = g_new (guint16, width * height);
+
+  return self;
+}
+
+void
+depth_synth_free (DepthSynth *self)
+{
+  if (self == NULL)
+    return;
+
+  g_free (self->scene);
+  g_free (self->frame);
+  g_free (self->to_disparity);
+
+  g_slice_free (DepthSynth, self);
+}
+
+void
+depth_synth_set_motion (DepthSynth *self, DepthSynthMotion motion)
+{
+  g_return_if_fail (motion <= DEPTH_SYNTH_MOTION_ALL);
+
+  self->motion = motion;
+}
+
+/* Distance from the camera the person stands at, in millimetres */
+void
+depth_synth_set_distance (DepthSynth *self, guint distance)
+{
+  g_return_if_fail (distance > 500);
+
+  self->distance = distance;
+}
+
+/* Depth of the wall behind the person, or 0 for none */
+void
+depth_synth_set_background (DepthSynth *self, guint background)
+{
+  self->background = MIN (background, G_MAXUINT16);
+}
+
+/* Adds up to +/- @noise millimetres to every pixel of the person. The
+   noise only depends on @seed and the frame index. */
+void
+depth_synth_set_noise (DepthSynth *self, guint noise, guint32 seed)
+{
+  self->noise = noise;
+  self->seed = seed;
+}
+
+/* Whether frames are rendered as the raw 11 bit disparities of the
+   device, see depth_process_get_disparity_lut(), instead of in
+   millimetres */
+void
+depth_synth_set_disparity (DepthSynth *self, gboolean disparity)
+{
+  if (disparity && self->to_disparity == NULL)
+    {
+      self->to_disparity = create_disparity_table ();
+    }
+  else if (! disparity)
+    {
+      g_free (self->to_disparity);
+      self->to_disparity = NULL;
+    }
+}
+
+gboolean
+depth_synth_get_disparity (DepthSynth *self)
+{
+  return self->to_disparity != NULL;
+}
+
+/* Renders frame @frame_index of the motion, which loops every
+   depth_synth_get_motion_length() frames. The returned frame belongs
+   to @self and is overwritten by the next call. */
+const guint16 *
+depth_synth_render (DepthSynth *self, guint frame_index)
+{
+  Pose pose;
+  gint i, n_pixels;
+
+  n_pixels = self->scene_width * self->scene_height;
+
+  if (self->background == 0)
+    {
+      memset (self->scene, 0, n_pixels * sizeof (guint16));
+    }
+  else
+    {
+      for (i = 0; i < n_pixels; i++)
+        self->scene[i] = self->background;
+    }
+
+  get_pose (self, frame_index, &pose);
+  draw_pose (self, &pose);
+
+  if (self->noise > 0)
+    add_noise (self, frame_index);
+
+  rotate_scene (self);
+
+  return self->frame;
+}
+
+void
+depth_synth_get_size (DepthSynth *self, gint *width, gint *height)
+{
+  *width = self->width;
+  *height = self->height;
+}
+
+/* Number of frames after which the motion starts over */
+guint
+depth_synth_get_motion_length (DepthSynth *self)
+{
+  guint i, length;
+
+  if (self->motion != DEPTH_SYNTH_MOTION_ALL)
+    return motions[self->motion].length;
+
+  length = 0;
+  for (i = 0; i < G_N_ELEMENTS (script); i++)
+    length += motions[script[i]].length;
+
+  return length;
+}
+
+/* Parses a motion name such as "bow", or "all" */
+gboolean
+depth_synth_motion_from_string (const gchar *name, DepthSynthMotion *motion)
+{
+  guint i;
+
+  if (g_strcmp0 (name, "all") == 0)
+    {
+      *motion = DEPTH_SYNTH_MOTION_ALL;
+      return TRUE;
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (motions); i++)
+    {
+      if (g_strcmp0 (name, motions[i].name) == 0)
+        {
+          *motion = motions[i].motion;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
@@ -0,0 +1,86 @@
+/*
+ * depth-synth.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_SYNTH_H__
+#define __DEPTH_SYNTH_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* the frame rate the scripted motions are timed against, regardless
+   of how fast frames are actually rendered */
+#define DEPTH_SYNTH_FPS 30
+
+typedef enum
+{
+  DEPTH_SYNTH_MOTION_IDLE,
+  DEPTH_SYNTH_MOTION_WAVE,
+  DEPTH_SYNTH_MOTION_BOW,
+  DEPTH_SYNTH_MOTION_KISS,
+  DEPTH_SYNTH_MOTION_CURTSY,
+
+  /* goes through all of the above in turn */
+  DEPTH_SYNTH_MOTION_ALL
+} DepthSynthMotion;
+
+typedef struct _DepthSynth DepthSynth;
+
+DepthSynth *     depth_synth_new                 (gint              width,
+                                                  gint              height);
+
+void             depth_synth_free                (DepthSynth       *self);
+
+void             depth_synth_set_motion          (DepthSynth       *self,
+                                                  DepthSynthMotion  motion);
+
+void             depth_synth_set_distance        (DepthSynth       *self,
+                                                  guint             distance);
+
+void             depth_synth_set_background      (DepthSynth       *self,
+                                                  guint             background);
+
+void             depth_synth_set_noise           (DepthSynth       *self,
+                                                  guint             noise,
+                                                  guint32           seed);
+
+void             depth_synth_set_disparity       (DepthSynth       *self,
+                                                  gboolean          disparity);
+
+gboolean         depth_synth_get_disparity       (DepthSynth       *self);
+
+const guint16 *  depth_synth_render              (DepthSynth       *self,
+                                                  guint             frame_index);
+
+void             depth_synth_get_size            (DepthSynth       *self,
+                                                  gint             *width,
+                                                  gint             *height);
+
+guint            depth_synth_get_motion_length   (DepthSynth       *self);
+
+gboolean         depth_synth_motion_from_string  (const gchar      *name,
+                                                  DepthSynthMotion *motion);
+
+G_END_DECLS
+
+#endif /* __DEPTH_SYNTH_H__ */
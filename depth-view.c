@@ -0,0 +1,48 @@
+/*
+ * depth-view.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#include "depth-view.h"
+
+void
+depth_view_init (DepthView     *view,
+                 const guint16 *data,
+                 gint           raw_width,
+                 gint           raw_height,
+                 gboolean       rotated)
+{
+  view->data = data;
+  view->raw_width = raw_width;
+  view->raw_height = raw_height;
+  view->rotated = rotated;
+
+  if (rotated)
+    {
+      view->width = raw_height;
+      view->height = raw_width;
+    }
+  else
+    {
+      view->width = raw_width;
+      view->height = raw_height;
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ * depth-view.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_VIEW_H__
+#define __DEPTH_VIEW_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A read-only window over a raw depth frame, which optionally presents
+   it rotated by 90 degrees (as the installation's Kinect is mounted)
+   without materializing the rotated copy. Coordinates passed to the
+   accessors are always in the presented (@width x @height) space. */
+typedef struct
+{
+  const guint16 *data;
+  gint raw_width;
+  gint raw_height;
+  gboolean rotated;
+
+  gint width;
+  gint height;
+} DepthView;
+
+void    depth_view_init               (DepthView     *view,
+                                       const guint16 *data,
+                                       gint           raw_width,
+                                       gint           raw_height,
+                                       gboolean       rotated);
+
+static inline guint16
+depth_view_get (const DepthView *view, gint x, gint y)
+{
+  if (view->rotated)
+    return view->data[(view->raw_height - 1 - x) * view->raw_width +
+                      (view->raw_width - 1 - y)];
+  else
+    return view->data[y * view->raw_width + x];
+}
+
+G_END_DECLS
+
+#endif /* __DEPTH_VIEW_H__ */
@@ -0,0 +1,181 @@
+/*
+ * depth-workers.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+/* A few threads, started once, that split the rows of a frame between
+   them: the thread running a job takes the first tile itself and
+   waits for the others, so a job returns with all of its rows done
+   and no thread is created or destroyed per frame. */
+
+#include "depth-workers.h"
+
+/* tiles smaller than this are not worth waking a thread for */
+#define MIN_TILE_ITEMS 16
+
+typedef struct
+{
+  DepthWorkers *workers;
+  DepthWorkersFunc func;
+  gpointer data;
+  gint first;
+  gint last;
+} Tile;
+
+struct _DepthWorkers
+{
+  guint n_threads;
+
+  /* all but the calling thread */
+  GThreadPool *pool;
+
+  GMutex lock;
+  GCond done;
+  guint pending;
+};
+
+static void
+run_tile (gpointer tile_data, gpointer user_data)
+{
+  Tile *tile = (Tile *) tile_data;
+  DepthWorkers *self = tile->workers;
+
+  tile->func (tile->first, tile->last, tile->data);
+
+  g_mutex_lock (&self->lock);
+  if (--self->pending == 0)
+    g_cond_signal (&self->done);
+  g_mutex_unlock (&self->lock);
+}
+
+/* public methods */
+
+/* Creates a pool of @n_threads, the thread running the jobs included,
+   or one for every processor if @n_threads is 0 */
+DepthWorkers *
+depth_workers_new (guint n_threads)
+{
+  DepthWorkers *self;
+  GError *error = NULL;
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+
+  self = g_slice_new0 (DepthWorkers);
+  self->n_threads = n_threads;
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->done);
+
+  if (n_threads > 1)
+    {
+      /* exclusive threads are started right away and kept */
+      self->pool = g_thread_pool_new (run_tile,
+                                      self,
+                                      n_threads - 1,
+                                      TRUE,
+                                      &error);
+      if (self->pool == NULL)
+        {
+          g_warning ("Failed to start depth worker threads: %s",
+                     error->message);
+          g_error_free (error);
+          self->n_threads = 1;
+        }
+    }
+
+  return self;
+}
+
+void
+depth_workers_free (DepthWorkers *self)
+{
+  if (self == NULL)
+    return;
+
+  if (self->pool != NULL)
+    g_thread_pool_free (self->pool, TRUE, TRUE);
+
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->done);
+
+  g_slice_free (DepthWorkers, self);
+}
+
+guint
+depth_workers_get_n_threads (DepthWorkers *self)
+{
+  return self != NULL ? self->n_threads : 1;
+}
+
+/* Runs @func over items [0, @n_items) split in one tile per thread,
+   every tile but the last starting and ending at a multiple of
+   @alignment, and returns once all of them are done. Without @self,
+   the whole job runs in the calling thread. Jobs must not be run from
+   several threads at once. */
+void
+depth_workers_run (DepthWorkers     *self,
+                   gint              n_items,
+                   gint              alignment,
+                   DepthWorkersFunc  func,
+                   gpointer          data)
+{
+  Tile *tiles;
+  gint n_tiles, tile_items, first, i;
+
+  if (n_items <= 0)
+    return;
+
+  n_tiles = self != NULL ? (gint) self->n_threads : 1;
+  n_tiles = MIN (n_tiles, MAX (n_items / MIN_TILE_ITEMS, 1));
+  if (n_tiles == 1)
+    {
+      func (0, n_items, data);
+      return;
+    }
+
+  alignment = MAX (alignment, 1);
+  tile_items = (n_items + n_tiles - 1) / n_tiles;
+  tile_items = (tile_items + alignment - 1) / alignment * alignment;
+
+  tiles = g_alloca (n_tiles * sizeof (Tile));
+  first = 0;
+  for (i = 0; i < n_tiles && first < n_items; i++)
+    {
+      tiles[i].workers = self;
+      tiles[i].func = func;
+      tiles[i].data = data;
+      tiles[i].first = first;
+      tiles[i].last = MIN (first + tile_items, n_items);
+      first = tiles[i].last;
+    }
+  n_tiles = i;
+
+  self->pending = n_tiles - 1;
+  for (i = 1; i < n_tiles; i++)
+    g_thread_pool_push (self->pool, &tiles[i], NULL);
+
+  func (tiles[0].first, tiles[0].last, data);
+
+  g_mutex_lock (&self->lock);
+  while (self->pending > 0)
+    g_cond_wait (&self->done, &self->lock);
+  g_mutex_unlock (&self->lock);
+}
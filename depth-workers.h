@@ -0,0 +1,52 @@
+/*
+ * depth-workers.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __DEPTH_WORKERS_H__
+#define __DEPTH_WORKERS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _DepthWorkers DepthWorkers;
+
+/* Processes items [@first, @last) of a job, usually rows of a frame */
+typedef void (*DepthWorkersFunc) (gint     first,
+                                  gint     last,
+                                  gpointer data);
+
+DepthWorkers * depth_workers_new           (guint             n_threads);
+
+void           depth_workers_free          (DepthWorkers     *self);
+
+guint          depth_workers_get_n_threads (DepthWorkers     *self);
+
+void           depth_workers_run           (DepthWorkers     *self,
+                                            gint              n_items,
+                                            gint              alignment,
+                                            DepthWorkersFunc  func,
+                                            gpointer          data);
+
+G_END_DECLS
+
+#endif /* __DEPTH_WORKERS_H__ */
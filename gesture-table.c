@@ -0,0 +1,1003 @@
+/*
+ * gesture-table.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+/* Gestures are described in a key file, one group per gesture, and
+   compiled into tables of relations that Salut evaluates frame after
+   frame. A gesture goes through keyframes: the first is recorded when
+   it starts, and every step records the next one, until the last step
+   completes the gesture.
+
+   joints        the joints recorded at every keyframe, read back
+                 as @joint in the steps
+   steps         how many steps the gesture takes
+   side          none, first or upper: which side of the body shoulder,
+                 elbow and hand stand for, the first of right and left
+                 that meets side-requires or the one of them meeting it
+                 with the highest hand
+   side-requires relations the side chosen must meet
+   requires      relations the pose must meet in every frame
+   gate          relations that must all hold for a step to be
+                 considered at all
+   advance       relations that must all hold for the step to be taken
+   break         relations any of which breaks the movement off
+   gate-<n>, advance-<n>, break-<n>
+                 the same for the <n>th step only, from 1
+   on-missing    what is done when a joint is missing: ignore (the
+                 default), reset, drop or back
+   on-pose-lost  what is done when the pose or side requirements fail:
+                 ignore, reset (the default), drop or back
+   on-break      what is done when the movement breaks off: ignore,
+                 reset, drop (the default), back or rebase
+   timeout       milliseconds the gesture may stay in a keyframe before
+                 starting over, 0 (the default) for no limit
+
+   A relation compares a measure between two joints with a number, in
+   millimetres or pixels for screen-x and screen-y:
+
+     head.z - @head.z < -100
+     |head.y - @head.y| <= 100
+     distance (hand, @hand) > 200
+     planar-distance (head, @head) > 150
+
+   and crossed (hand.x, elbow.x) holds when the difference changed
+   sign since the keyframe. The terms of a difference are separated by
+   spaces, as joint and coordinate names have dashes. The head is
+   always needed, and so is every joint the relations read. */
+
+#include <string.h>
+
+#include "gesture-table.h"
+
+struct _GestureTable
+{
+  GPtrArray *gestures;
+};
+
+static const gchar *DEFAULT_GESTURES =
+  "[bow]\n"
+  "joints = head\n"
+  "steps = 2\n"
+  "gate = distance (head, @head) >= 100\n"
+  "advance = head.z - @head.z < -100; head.screen-y - @head.screen-y > 0\n"
+  "break = planar-distance (head, @head) > 150; head.z - @head.z > 150\n"
+  "\n"
+  "[kiss]\n"
+  "joints = head; hand\n"
+  "side = upper\n"
+  "steps = 3\n"
+  "on-missing = reset\n"
+  "advance-1 = distance (hand, head) < 400\n"
+  "advance = distance (hand, @hand) > 200; distance (hand, @hand) < 500; "
+  "hand.z - @hand.z < 0\n"
+  "\n"
+  "[curtsy]\n"
+  "joints = head\n"
+  "steps = 2\n"
+  "requires = right-hand.y - head.y >= 0; left-hand.y - head.y >= 0; "
+  "right-hand.x - right-elbow.x <= 0; left-hand.x - left-elbow.x >= 0\n"
+  "gate = distance (head, @head) >= 150\n"
+  "advance-1 = |head.z - @head.z| < 100; head.y - @head.y > 100\n"
+  "advance-2 = |head.z - @head.z| < 100; head.y - @head.y < -100\n"
+  "break = |head.z - @head.z| >= 100; |head.y - @head.y| <= 100\n"
+  "on-break = rebase\n"
+  "\n"
+  "[wave]\n"
+  "joints = hand; elbow\n"
+  "side = first\n"
+  "side-requires = hand.y - elbow.y < -100\n"
+  "steps = 4\n"
+  "on-pose-lost = back\n"
+  "advance = crossed (hand.x, elbow.x)\n";
+
+static const gchar *slot_names[GESTURE_SLOT_KEY] =
+{
+  "head",
+  "left-shoulder",
+  "right-shoulder",
+  "left-elbow",
+  "right-elbow",
+  "left-hand",
+  "right-hand",
+  "shoulder",
+  "elbow",
+  "hand"
+};
+
+static const gchar *action_names[] =
+{
+  "ignore",
+  "reset",
+  "drop",
+  "back",
+  "rebase"
+};
+
+static const gchar *side_names[] =
+{
+  "none",
+  "first",
+  "upper"
+};
+
+/* what a relation is being compiled for */
+typedef enum
+{
+  CONTEXT_POSE,
+  CONTEXT_STEP
+} Context;
+
+typedef struct
+{
+  GestureRecognizer *gesture;
+  const gchar *text;
+  const gchar *cursor;
+  GError **error;
+} Parser;
+
+static gboolean
+parse_error (Parser *parser, const gchar *what)
+{
+  g_set_error (parser->error,
+               G_KEY_FILE_ERROR,
+               G_KEY_FILE_ERROR_INVALID_VALUE,
+               "Gesture '%s': %s in '%s'",
+               parser->gesture->name,
+               what,
+               parser->text);
+
+  return FALSE;
+}
+
+static void
+skip_spaces (Parser *parser)
+{
+  while (g_ascii_isspace (*parser->cursor))
+    parser->cursor++;
+}
+
+static gboolean
+accept (Parser *parser, const gchar *token)
+{
+  gsize length = strlen (token);
+
+  skip_spaces (parser);
+  if (strncmp (parser->cursor, token, length) != 0)
+    return FALSE;
+
+  parser->cursor += length;
+  return TRUE;
+}
+
+static gboolean
+expect (Parser *parser, const gchar *token)
+{
+  if (accept (parser, token))
+    return TRUE;
+
+  g_set_error (parser->error,
+               G_KEY_FILE_ERROR,
+               G_KEY_FILE_ERROR_INVALID_VALUE,
+               "Gesture '%s': expected '%s' in '%s'",
+               parser->gesture->name,
+               token,
+               parser->text);
+
+  return FALSE;
+}
+
+/* Names are letters and dashes, a dash being part of the name only if
+   a letter follows it. Returns the length of the name at the cursor,
+   which is left after it. */
+static gsize
+read_name (Parser *parser, const gchar **name)
+{
+  const gchar *end;
+
+  skip_spaces (parser);
+  end = parser->cursor;
+  while (g_ascii_isalpha (*end) ||
+         (*end == '-' && g_ascii_isalpha (end[1])))
+    end++;
+
+  *name = parser->cursor;
+  parser->cursor = end;
+
+  return end - *name;
+}
+
+static gint
+find_name (const gchar  *name,
+           gsize         length,
+           const gchar **names,
+           guint         n_names)
+{
+  guint i;
+
+  for (i = 0; i < n_names; i++)
+    {
+      if (strlen (names[i]) == length && strncmp (names[i], name, length) == 0)
+        return i;
+    }
+
+  return -1;
+}
+
+static gint
+find_key_joint (const GestureRecognizer *gesture, guint slot)
+{
+  guint i;
+
+  for (i = 0; i < gesture->n_joints; i++)
+    {
+      if (gesture->joints[i] == slot)
+        return i;
+    }
+
+  return -1;
+}
+
+/* a joint, or as recorded at the keyframe with an @ */
+static gboolean
+parse_joint (Parser *parser, Context context, guint8 *slot)
+{
+  GestureRecognizer *gesture = parser->gesture;
+  const gchar *name;
+  gsize length;
+  gboolean key;
+  gint n;
+
+  key = accept (parser, "@");
+  length = read_name (parser, &name);
+  n = find_name (name, length, slot_names, GESTURE_SLOT_KEY);
+  if (n < 0)
+    return parse_error (parser, "unknown joint");
+
+  if (n >= GESTURE_SLOT_SHOULDER && gesture->side == GESTURE_SIDE_NONE)
+    return parse_error (parser, "side joint in a gesture without side");
+
+  if (key)
+    {
+      gint index;
+
+      if (context != CONTEXT_STEP)
+        return parse_error (parser, "keyframe joint outside the steps");
+
+      index = find_key_joint (gesture, n);
+      if (index < 0)
+        return parse_error (parser, "joint not recorded at keyframes");
+
+      *slot = GESTURE_SLOT_KEY + index;
+    }
+  else
+    {
+      *slot = n;
+      gesture->needed |= 1 << n;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+parse_axis (Parser *parser, guint8 *axis)
+{
+  static const gchar *axis_names[] = { "x", "y", "z", "screen-x", "screen-y" };
+  static const guint8 axis_offsets[] =
+    {
+      G_STRUCT_OFFSET (SkeltrackJoint, x),
+      G_STRUCT_OFFSET (SkeltrackJoint, y),
+      G_STRUCT_OFFSET (SkeltrackJoint, z),
+      G_STRUCT_OFFSET (SkeltrackJoint, screen_x),
+      G_STRUCT_OFFSET (SkeltrackJoint, screen_y)
+    };
+  const gchar *name;
+  gsize length;
+  gint n;
+
+  if (! expect (parser, "."))
+    return FALSE;
+
+  length = read_name (parser, &name);
+  n = find_name (name, length, axis_names, G_N_ELEMENTS (axis_names));
+  if (n < 0)
+    return parse_error (parser, "unknown coordinate");
+
+  *axis = axis_offsets[n];
+  return TRUE;
+}
+
+/* a - b, both of the same coordinate */
+static gboolean
+parse_difference (Parser          *parser,
+                  Context          context,
+                  GestureRelation *relation)
+{
+  guint8 axis;
+
+  if (! parse_joint (parser, context, &relation->a) ||
+      ! parse_axis (parser, &relation->axis))
+    return FALSE;
+
+  if (! expect (parser, "-"))
+    return FALSE;
+
+  if (! parse_joint (parser, context, &relation->b) ||
+      ! parse_axis (parser, &axis))
+    return FALSE;
+
+  if (axis != relation->axis)
+    return parse_error (parser, "difference of different coordinates");
+
+  return TRUE;
+}
+
+/* (a, b) */
+static gboolean
+parse_pair (Parser          *parser,
+            Context          context,
+            GestureRelation *relation)
+{
+  return expect (parser, "(") &&
+    parse_joint (parser, context, &relation->a) &&
+    expect (parser, ",") &&
+    parse_joint (parser, context, &relation->b) &&
+    expect (parser, ")");
+}
+
+static gboolean
+parse_crossing (Parser          *parser,
+                Context          context,
+                GestureRelation *relation)
+{
+  GestureRecognizer *gesture = parser->gesture;
+  gint key_a, key_b;
+  guint8 axis;
+
+  if (context != CONTEXT_STEP)
+    return parse_error (parser, "crossing outside the steps");
+
+  if (! expect (parser, "(") ||
+      ! parse_joint (parser, context, &relation->a) ||
+      ! parse_axis (parser, &relation->axis) ||
+      ! expect (parser, ",") ||
+      ! parse_joint (parser, context, &relation->b) ||
+      ! parse_axis (parser, &axis) ||
+      ! expect (parser, ")"))
+    {
+      return FALSE;
+    }
+
+  if (axis != relation->axis)
+    return parse_error (parser, "crossing of different coordinates");
+
+  if (relation->a >= GESTURE_SLOT_KEY || relation->b >= GESTURE_SLOT_KEY)
+    return parse_error (parser, "keyframe joint in a crossing");
+
+  key_a = find_key_joint (gesture, relation->a);
+  key_b = find_key_joint (gesture, relation->b);
+  if (key_a < 0 || key_b < 0)
+    return parse_error (parser, "crossing of joints not recorded at keyframes");
+
+  relation->key_a = GESTURE_SLOT_KEY + key_a;
+  relation->key_b = GESTURE_SLOT_KEY + key_b;
+
+  /* holds when the measure is 1 */
+  relation->op = GESTURE_OP_GREATER;
+  relation->threshold = 0.0;
+
+  return TRUE;
+}
+
+static gboolean
+parse_comparison (Parser *parser, GestureRelation *relation)
+{
+  gchar *end;
+
+  if (accept (parser, "<="))
+    relation->op = GESTURE_OP_LESS_EQUAL;
+  else if (accept (parser, ">="))
+    relation->op = GESTURE_OP_GREATER_EQUAL;
+  else if (accept (parser, "<"))
+    relation->op = GESTURE_OP_LESS;
+  else if (accept (parser, ">"))
+    relation->op = GESTURE_OP_GREATER;
+  else
+    return parse_error (parser, "missing comparison");
+
+  skip_spaces (parser);
+  relation->threshold = g_ascii_strtod (parser->cursor, &end);
+  if (end == parser->cursor)
+    return parse_error (parser, "missing number");
+  parser->cursor = end;
+
+  /* distances are compared squared, and no distance is below a
+     negative threshold */
+  if (relation->measure == GESTURE_MEASURE_DISTANCE ||
+      relation->measure == GESTURE_MEASURE_PLANAR_DISTANCE)
+    {
+      relation->threshold *= ABS (relation->threshold);
+    }
+
+  return TRUE;
+}
+
+static gboolean
+compile_relation (GestureRecognizer  *gesture,
+                  const gchar        *text,
+                  Context             context,
+                  GArray             *relations,
+                  GError            **error)
+{
+  GestureRelation relation = { 0, };
+  Parser parser;
+  gboolean parsed;
+
+  parser.gesture = gesture;
+  parser.text = text;
+  parser.cursor = text;
+  parser.error = error;
+
+  if (accept (&parser, "crossed"))
+    {
+      relation.measure = GESTURE_MEASURE_CROSSED;
+      parsed = parse_crossing (&parser, context, &relation);
+    }
+  else if (accept (&parser, "planar-distance"))
+    {
+      relation.measure = GESTURE_MEASURE_PLANAR_DISTANCE;
+      parsed = parse_pair (&parser, context, &relation) &&
+        parse_comparison (&parser, &relation);
+    }
+  else if (accept (&parser, "distance"))
+    {
+      relation.measure = GESTURE_MEASURE_DISTANCE;
+      parsed = parse_pair (&parser, context, &relation) &&
+        parse_comparison (&parser, &relation);
+    }
+  else if (accept (&parser, "|"))
+    {
+      relation.measure = GESTURE_MEASURE_ABSOLUTE_DIFFERENCE;
+      parsed = parse_difference (&parser, context, &relation) &&
+        expect (&parser, "|") &&
+        parse_comparison (&parser, &relation);
+    }
+  else
+    {
+      relation.measure = GESTURE_MEASURE_DIFFERENCE;
+      parsed = parse_difference (&parser, context, &relation) &&
+        parse_comparison (&parser, &relation);
+    }
+
+  if (! parsed)
+    return FALSE;
+
+  skip_spaces (&parser);
+  if (*parser.cursor != '\0')
+    return parse_error (&parser, "trailing text");
+
+  g_array_append_val (relations, relation);
+
+  return TRUE;
+}
+
+/* Compiles the relations under @key into @range, those of the more
+   general @fallback key if there is no @key. */
+static gboolean
+compile_relations (GestureRecognizer  *gesture,
+                   GKeyFile           *file,
+                   const gchar        *key,
+                   const gchar        *fallback,
+                   Context             context,
+                   GArray             *relations,
+                   GestureRange       *range,
+                   GError            **error)
+{
+  gchar **texts;
+  gboolean compiled = TRUE;
+  guint i;
+
+  range->start = relations->len;
+
+  if (! g_key_file_has_key (file, gesture->name, key, NULL))
+    key = fallback;
+
+  if (key != NULL && g_key_file_has_key (file, gesture->name, key, NULL))
+    {
+      texts = g_key_file_get_string_list (file, gesture->name, key, NULL, error);
+      if (texts == NULL)
+        return FALSE;
+
+      for (i = 0; texts[i] != NULL && compiled; i++)
+        {
+          g_strstrip (texts[i]);
+          if (texts[i][0] != '\0')
+            compiled = compile_relation (gesture, texts[i], context, relations, error);
+        }
+      g_strfreev (texts);
+    }
+
+  range->end = relations->len;
+
+  return compiled;
+}
+
+static gboolean
+compile_choice (GestureRecognizer  *gesture,
+                GKeyFile           *file,
+                const gchar        *key,
+                const gchar       **names,
+                guint               n_names,
+                guint               n_allowed,
+                guint              *choice,
+                GError            **error)
+{
+  gchar *name;
+  gint n;
+
+  if (! g_key_file_has_key (file, gesture->name, key, NULL))
+    return TRUE;
+
+  name = g_key_file_get_string (file, gesture->name, key, error);
+  if (name == NULL)
+    return FALSE;
+
+  g_strstrip (name);
+  n = find_name (name, strlen (name), names, n_names);
+  if (n < 0 || n >= (gint) n_allowed)
+    {
+      g_set_error (error,
+                   G_KEY_FILE_ERROR,
+                   G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "Gesture '%s': '%s' is not valid for %s",
+                   gesture->name,
+                   name,
+                   key);
+      g_free (name);
+      return FALSE;
+    }
+
+  g_free (name);
+  *choice = n;
+
+  return TRUE;
+}
+
+static gboolean
+compile_joints (GestureRecognizer  *gesture,
+                GKeyFile           *file,
+                GError            **error)
+{
+  gchar **names;
+  gboolean compiled = TRUE;
+  guint i;
+
+  names = g_key_file_get_string_list (file, gesture->name, "joints", NULL, error);
+  if (names == NULL)
+    return FALSE;
+
+  for (i = 0; names[i] != NULL && compiled; i++)
+    {
+      gint n;
+
+      g_strstrip (names[i]);
+      n = find_name (names[i], strlen (names[i]), slot_names, GESTURE_SLOT_KEY);
+      if (n < 0 ||
+          (n >= GESTURE_SLOT_SHOULDER && gesture->side == GESTURE_SIDE_NONE) ||
+          find_key_joint (gesture, n) >= 0 ||
+          gesture->n_joints == GESTURE_MAX_JOINTS)
+        {
+          g_set_error (error,
+                       G_KEY_FILE_ERROR,
+                       G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "Gesture '%s': bad keyframe joint '%s'",
+                       gesture->name,
+                       names[i]);
+          compiled = FALSE;
+        }
+      else
+        {
+          gesture->joints[gesture->n_joints++] = n;
+          gesture->needed |= 1 << n;
+        }
+    }
+  g_strfreev (names);
+
+  if (compiled && gesture->n_joints == 0)
+    {
+      g_set_error (error,
+                   G_KEY_FILE_ERROR,
+                   G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "Gesture '%s' records no joints",
+                   gesture->name);
+      compiled = FALSE;
+    }
+
+  return compiled;
+}
+
+/* every key a gesture may have, the per step ones aside */
+static gboolean
+check_keys (GestureRecognizer  *gesture,
+            GKeyFile           *file,
+            GError            **error)
+{
+  static const gchar *known[] =
+    {
+      "joints", "steps", "side", "side-requires", "requires",
+      "gate", "advance", "break",
+      "on-missing", "on-pose-lost", "on-break", "timeout"
+    };
+  static const gchar *step_keys[] = { "gate", "advance", "break" };
+  gchar **keys;
+  gboolean checked = TRUE;
+  guint i;
+
+  keys = g_key_file_get_keys (file, gesture->name, NULL, error);
+  if (keys == NULL)
+    return FALSE;
+
+  for (i = 0; keys[i] != NULL && checked; i++)
+    {
+      const gchar *dash;
+      guint64 step = 0;
+      gchar *end = NULL;
+
+      if (find_name (keys[i], strlen (keys[i]), known, G_N_ELEMENTS (known)) >= 0)
+        continue;
+
+      dash = strrchr (keys[i], '-');
+      if (dash != NULL)
+        step = g_ascii_strtoull (dash + 1, &end, 10);
+
+      if (dash == NULL ||
+          find_name (keys[i], dash - keys[i], step_keys, G_N_ELEMENTS (step_keys)) < 0 ||
+          end == dash + 1 || *end != '\0' ||
+          step < 1 || step > gesture->n_steps)
+        {
+          g_set_error (error,
+                       G_KEY_FILE_ERROR,
+                       G_KEY_FILE_ERROR_KEY_NOT_FOUND,
+                       "Gesture '%s': unknown key '%s'",
+                       gesture->name,
+                       keys[i]);
+          checked = FALSE;
+        }
+    }
+  g_strfreev (keys);
+
+  return checked;
+}
+
+static void
+gesture_free (GestureRecognizer *gesture)
+{
+  g_free (gesture->name);
+  g_free (gesture->relations);
+  g_slice_free (GestureRecognizer, gesture);
+}
+
+static GestureRecognizer *
+compile_gesture (GKeyFile     *file,
+                 const gchar  *name,
+                 GError      **error)
+{
+  GestureRecognizer *gesture;
+  GArray *relations;
+  guint side = GESTURE_SIDE_NONE;
+  guint on_missing = GESTURE_ACTION_IGNORE;
+  guint on_pose_lost = GESTURE_ACTION_RESET;
+  guint on_break = GESTURE_ACTION_DROP;
+  GError *value_error = NULL;
+  gboolean compiled = TRUE;
+  gint steps, timeout = 0;
+  guint i;
+
+  gesture = g_slice_new0 (GestureRecognizer);
+  gesture->name = g_strdup (name);
+  gesture->needed = 1 << SKELTRACK_JOINT_ID_HEAD;
+  relations = g_array_new (FALSE, FALSE, sizeof (GestureRelation));
+
+  steps = g_key_file_get_integer (file, name, "steps", &value_error);
+  if (value_error != NULL || steps < 1 || steps > GESTURE_MAX_STEPS)
+    {
+      g_clear_error (&value_error);
+      steps = 0;
+      g_set_error (error,
+                   G_KEY_FILE_ERROR,
+                   G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "Gesture '%s' must take 1 to %u steps",
+                   name,
+                   GESTURE_MAX_STEPS);
+      compiled = FALSE;
+    }
+  gesture->n_steps = steps;
+
+  if (compiled && g_key_file_has_key (file, name, "timeout", NULL))
+    {
+      timeout = g_key_file_get_integer (file, name, "timeout", &value_error);
+      if (value_error != NULL || timeout < 0)
+        {
+          g_clear_error (&value_error);
+          timeout = 0;
+          g_set_error (error,
+                       G_KEY_FILE_ERROR,
+                       G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "Gesture '%s' has a bad timeout",
+                       name);
+          compiled = FALSE;
+        }
+    }
+  gesture->timeout = (gint64) timeout * 1000;
+
+  /* rebasing records the current joints, which aren't known when they
+     are missing or no side was found */
+  compiled = compiled &&
+    check_keys (gesture, file, error) &&
+    compile_choice (gesture, file, "side", side_names,
+                    G_N_ELEMENTS (side_names), G_N_ELEMENTS (side_names),
+                    &side, error) &&
+    compile_choice (gesture, file, "on-missing", action_names,
+                    G_N_ELEMENTS (action_names), GESTURE_ACTION_REBASE,
+                    &on_missing, error) &&
+    compile_choice (gesture, file, "on-pose-lost", action_names,
+                    G_N_ELEMENTS (action_names), GESTURE_ACTION_REBASE,
+                    &on_pose_lost, error) &&
+    compile_choice (gesture, file, "on-break", action_names,
+                    G_N_ELEMENTS (action_names), G_N_ELEMENTS (action_names),
+                    &on_break, error);
+
+  gesture->side = side;
+  gesture->on_missing = on_missing;
+  gesture->on_pose_lost = on_pose_lost;
+  gesture->on_break = on_break;
+
+  /* the highest hand is looked for */
+  if (side == GESTURE_SIDE_UPPER)
+    gesture->needed |= 1 << GESTURE_SLOT_HAND;
+
+  compiled = compiled && compile_joints (gesture, file, error);
+
+  if (compiled && (steps + 1) * gesture->n_joints > GESTURE_MAX_SAMPLES)
+    {
+      g_set_error (error,
+                   G_KEY_FILE_ERROR,
+                   G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "Gesture '%s' records more than %u joints over its keyframes",
+                   name,
+                   GESTURE_MAX_SAMPLES);
+      compiled = FALSE;
+    }
+
+  compiled = compiled &&
+    compile_relations (gesture, file, "side-requires", NULL, CONTEXT_POSE,
+                       relations, &gesture->side_requires, error) &&
+    compile_relations (gesture, file, "requires", NULL, CONTEXT_POSE,
+                       relations, &gesture->requires, error);
+
+  for (i = 0; compiled && i < gesture->n_steps; i++)
+    {
+      GestureStep *step = &gesture->steps[i];
+      gchar *gate, *advance, *brk;
+
+      gate = g_strdup_printf ("gate-%u", i + 1);
+      advance = g_strdup_printf ("advance-%u", i + 1);
+      brk = g_strdup_printf ("break-%u", i + 1);
+
+      compiled =
+        compile_relations (gesture, file, gate, "gate", CONTEXT_STEP,
+                           relations, &step->gate, error) &&
+        compile_relations (gesture, file, advance, "advance", CONTEXT_STEP,
+                           relations, &step->advance, error) &&
+        compile_relations (gesture, file, brk, "break", CONTEXT_STEP,
+                           relations, &step->brk, error);
+
+      if (compiled && step->advance.start == step->advance.end)
+        {
+          g_set_error (error,
+                       G_KEY_FILE_ERROR,
+                       G_KEY_FILE_ERROR_INVALID_VALUE,
+                       "Gesture '%s' has no advance relations for step %u",
+                       name,
+                       i + 1);
+          compiled = FALSE;
+        }
+
+      g_free (gate);
+      g_free (advance);
+      g_free (brk);
+    }
+
+  gesture->n_relations = relations->len;
+  gesture->relations = (GestureRelation *) g_array_free (relations, FALSE);
+
+  if (! compiled)
+    {
+      gesture_free (gesture);
+      return NULL;
+    }
+
+  return gesture;
+}
+
+GestureTable *
+gesture_table_new (void)
+{
+  GestureTable *self;
+
+  self = g_slice_new (GestureTable);
+  self->gestures = g_ptr_array_new ();
+
+  return self;
+}
+
+void
+gesture_table_free (GestureTable *self)
+{
+  guint i;
+
+  if (self == NULL)
+    return;
+
+  for (i = 0; i < self->gestures->len; i++)
+    gesture_free (g_ptr_array_index (self->gestures, i));
+  g_ptr_array_free (self->gestures, TRUE);
+
+  g_slice_free (GestureTable, self);
+}
+
+/* Compiles every gesture described in @data, replacing those of the
+   table with the same name. Nothing is added if any of them fails to
+   compile. Gestures being tracked must not be replaced. */
+gboolean
+gesture_table_load_data (GestureTable  *self,
+                         const gchar   *data,
+                         gsize          length,
+                         GError       **error)
+{
+  GKeyFile *file;
+  GPtrArray *compiled;
+  gchar **names;
+  gboolean loaded = TRUE;
+  guint i, j;
+
+  file = g_key_file_new ();
+  if (! g_key_file_load_from_data (file, data, length, G_KEY_FILE_NONE, error))
+    {
+      g_key_file_free (file);
+      return FALSE;
+    }
+
+  compiled = g_ptr_array_new ();
+  names = g_key_file_get_groups (file, NULL);
+  for (i = 0; names[i] != NULL && loaded; i++)
+    {
+      GestureRecognizer *gesture;
+
+      gesture = compile_gesture (file, names[i], error);
+      if (gesture != NULL)
+        g_ptr_array_add (compiled, gesture);
+      else
+        loaded = FALSE;
+    }
+  g_strfreev (names);
+  g_key_file_free (file);
+
+  for (i = 0; i < compiled->len; i++)
+    {
+      GestureRecognizer *gesture = g_ptr_array_index (compiled, i);
+
+      if (! loaded)
+        {
+          gesture_free (gesture);
+          continue;
+        }
+
+      for (j = 0; j < self->gestures->len; j++)
+        {
+          GestureRecognizer *old = g_ptr_array_index (self->gestures, j);
+
+          if (g_strcmp0 (old->name, gesture->name) == 0)
+            {
+              gesture_free (old);
+              g_ptr_array_index (self->gestures, j) = gesture;
+              break;
+            }
+        }
+
+      if (j == self->gestures->len)
+        g_ptr_array_add (self->gestures, gesture);
+    }
+  g_ptr_array_free (compiled, TRUE);
+
+  return loaded;
+}
+
+gboolean
+gesture_table_load_file (GestureTable  *self,
+                         const gchar   *path,
+                         GError       **error)
+{
+  gchar *data;
+  gsize length;
+  gboolean loaded;
+
+  if (! g_file_get_contents (path, &data, &length, error))
+    return FALSE;
+
+  loaded = gesture_table_load_data (self, data, length, error);
+  g_free (data);
+
+  return loaded;
+}
+
+const GestureRecognizer *
+gesture_table_lookup (GestureTable *self, const gchar *name)
+{
+  guint i;
+
+  for (i = 0; i < self->gestures->len; i++)
+    {
+      const GestureRecognizer *gesture = g_ptr_array_index (self->gestures, i);
+
+      if (g_strcmp0 (gesture->name, name) == 0)
+        return gesture;
+    }
+
+  return NULL;
+}
+
+guint
+gesture_table_get_n_gestures (GestureTable *self)
+{
+  return self->gestures->len;
+}
+
+const GestureRecognizer *
+gesture_table_get_gesture (GestureTable *self, guint n)
+{
+  g_return_val_if_fail (n < self->gestures->len, NULL);
+
+  return g_ptr_array_index (self->gestures, n);
+}
+
+/* The gestures Salut tracks, the built-in ones at first. Descriptions
+   loaded into it replace them, and must be loaded before any is
+   tracked. */
+GestureTable *
+gesture_table_get_default (void)
+{
+  static GestureTable *table = NULL;
+  static gsize initialized = 0;
+
+  if (g_once_init_enter (&initialized))
+    {
+      GError *error = NULL;
+
+      table = gesture_table_new ();
+      if (! gesture_table_load_data (table, DEFAULT_GESTURES, -1, &error))
+        g_error ("Built-in gestures don't compile: %s", error->message);
+
+      g_once_init_leave (&initialized, 1);
+    }
+
+  return table;
+}
@@ -0,0 +1,183 @@
+/*
+ * gesture-table.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __GESTURE_TABLE_H__
+#define __GESTURE_TABLE_H__
+
+#include <glib.h>
+#include <skeltrack-joint.h>
+
+G_BEGIN_DECLS
+
+/* keyframes a gesture goes through after the first one, and joints
+   recorded at each of them */
+#define GESTURE_MAX_STEPS 8
+#define GESTURE_MAX_JOINTS 4
+
+/* joints of all the keyframes a gesture keeps at once */
+#define GESTURE_MAX_SAMPLES 16
+
+/* what relations read: the joints of the frame, under their skeltrack
+   ids, the joints of the side chosen, and the joints recorded at the
+   current keyframe */
+typedef enum
+{
+  GESTURE_SLOT_SHOULDER = SKELTRACK_JOINT_MAX_JOINTS,
+  GESTURE_SLOT_ELBOW,
+  GESTURE_SLOT_HAND,
+  GESTURE_SLOT_KEY,
+  GESTURE_N_SLOTS = GESTURE_SLOT_KEY + GESTURE_MAX_JOINTS
+} GestureSlot;
+
+typedef enum
+{
+  GESTURE_MEASURE_DIFFERENCE,
+  GESTURE_MEASURE_ABSOLUTE_DIFFERENCE,
+  /* squared, and so is the threshold */
+  GESTURE_MEASURE_DISTANCE,
+  GESTURE_MEASURE_PLANAR_DISTANCE,
+  /* 1 if the difference changed sign since the keyframe, else 0 */
+  GESTURE_MEASURE_CROSSED
+} GestureMeasure;
+
+typedef enum
+{
+  GESTURE_OP_LESS,
+  GESTURE_OP_LESS_EQUAL,
+  GESTURE_OP_GREATER,
+  GESTURE_OP_GREATER_EQUAL
+} GestureOp;
+
+/* how the side of the body the alias slots stand for is chosen */
+typedef enum
+{
+  GESTURE_SIDE_NONE,
+  /* the first, right then left, that meets the side requirements */
+  GESTURE_SIDE_FIRST,
+  /* the one meeting them with the highest hand */
+  GESTURE_SIDE_UPPER
+} GestureSide;
+
+/* what is done when the joints are missing, the pose is lost, or the
+   movement breaks off */
+typedef enum
+{
+  /* the frame is skipped */
+  GESTURE_ACTION_IGNORE,
+  /* the gesture starts over */
+  GESTURE_ACTION_RESET,
+  /* the current keyframe is recorded again on the next frame */
+  GESTURE_ACTION_DROP,
+  /* the current keyframe is dropped and the previous one is current */
+  GESTURE_ACTION_BACK,
+  /* as back, but the previous keyframe is recorded again right away */
+  GESTURE_ACTION_REBASE
+} GestureAction;
+
+typedef struct
+{
+  guint8 measure;
+  guint8 op;
+  /* offset of the coordinate in SkeltrackJoint */
+  guint8 axis;
+  guint8 a;
+  guint8 b;
+  /* the keyframe's a and b, for crossings */
+  guint8 key_a;
+  guint8 key_b;
+  gfloat threshold;
+} GestureRelation;
+
+/* relations from @start to @end, not included */
+typedef struct
+{
+  guint16 start;
+  guint16 end;
+} GestureRange;
+
+/* going from a keyframe to the next: nothing is done unless all the
+   gate relations hold, the step is taken if all the advance ones do,
+   and the movement breaks off if any of the break ones does */
+typedef struct
+{
+  GestureRange gate;
+  GestureRange advance;
+  GestureRange brk;
+} GestureStep;
+
+typedef struct
+{
+  gchar *name;
+
+  guint n_steps;
+  guint n_joints;
+  guint8 joints[GESTURE_MAX_JOINTS];
+
+  GestureSide side;
+  GestureRange side_requires;
+  GestureRange requires;
+
+  /* slots of the frame the gesture reads, as bits */
+  guint32 needed;
+
+  GestureAction on_missing;
+  GestureAction on_pose_lost;
+  GestureAction on_break;
+
+  /* longest time in a keyframe, in microseconds, 0 for no limit */
+  gint64 timeout;
+
+  GestureStep steps[GESTURE_MAX_STEPS];
+
+  GestureRelation *relations;
+  guint n_relations;
+} GestureRecognizer;
+
+typedef struct _GestureTable GestureTable;
+
+GestureTable *            gesture_table_new             (void);
+
+void                      gesture_table_free            (GestureTable  *self);
+
+gboolean                  gesture_table_load_data       (GestureTable  *self,
+                                                         const gchar   *data,
+                                                         gsize          length,
+                                                         GError       **error);
+
+gboolean                  gesture_table_load_file       (GestureTable  *self,
+                                                         const gchar   *path,
+                                                         GError       **error);
+
+const GestureRecognizer * gesture_table_lookup          (GestureTable  *self,
+                                                         const gchar   *name);
+
+guint                     gesture_table_get_n_gestures  (GestureTable  *self);
+
+const GestureRecognizer * gesture_table_get_gesture     (GestureTable  *self,
+                                                         guint          n);
+
+GestureTable *            gesture_table_get_default     (void);
+
+G_END_DECLS
+
+#endif /* __GESTURE_TABLE_H__ */
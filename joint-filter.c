@@ -0,0 +1,248 @@
+/*
+ * joint-filter.c
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+/* Smooths the joints of consecutive frames with a double exponential
+   filter, the way skeltrack does for the frames it tracks, but over
+   time rather than over frames, as frames may be skipped. Joints
+   missing from a frame are carried on along their trend for a few
+   frames. The filter lives outside of the skeletons so joints are
+   smoothed in frame order whichever skeleton tracked them.
+
+   The same trends predict where the joints are in frames that are not
+   tracked at all, until the next tracked frame corrects them. */
+
+#include "joint-filter.h"
+
+#include <math.h>
+
+/* x, y, z, screen_x and screen_y */
+#define N_COORDS 5
+
+/* joints are not predicted further than this from their last
+   position, as people don't keep moving in a straight line */
+#define MAX_PREDICTION 200 /* milliseconds */
+
+typedef struct
+{
+  gboolean valid;
+  guint missing;
+  gint64 timestamp;
+  gfloat value[N_COORDS];
+
+  /* per millisecond */
+  gfloat trend[N_COORDS];
+} JointState;
+
+struct _JointFilter
+{
+  /* weight of the new position, and of the new trend */
+  gfloat weight;
+  guint persistency;
+
+  JointState joints[SKELTRACK_JOINT_MAX_JOINTS];
+};
+
+static void
+joint_get_coords (const SkeltrackJoint *joint, gfloat *coords)
+{
+  coords[0] = joint->x;
+  coords[1] = joint->y;
+  coords[2] = joint->z;
+  coords[3] = joint->screen_x;
+  coords[4] = joint->screen_y;
+}
+
+static void
+joint_set_coords (SkeltrackJoint *joint, const gfloat *coords)
+{
+  joint->x = (gint) floorf (coords[0] + .5f);
+  joint->y = (gint) floorf (coords[1] + .5f);
+  joint->z = (gint) floorf (coords[2] + .5f);
+  joint->screen_x = (gint) floorf (coords[3] + .5f);
+  joint->screen_y = (gint) floorf (coords[4] + .5f);
+}
+
+/* in milliseconds, never 0 so trends stay finite */
+static gfloat
+get_elapsed (const JointState *state, gint64 timestamp)
+{
+  return MAX ((timestamp - state->timestamp) / 1000.0f, 1.0f);
+}
+
+/* public methods */
+
+/* @smoothing goes from 0, no smoothing at all, towards 1; joints
+   missing from up to @persistency frames in a row are extrapolated */
+JointFilter *
+joint_filter_new (gfloat smoothing, guint persistency)
+{
+  JointFilter *self;
+
+  self = g_slice_new0 (JointFilter);
+  self->weight = 1.0f - CLAMP (smoothing, 0.0f, 1.0f);
+  self->persistency = persistency;
+
+  return self;
+}
+
+void
+joint_filter_free (JointFilter *self)
+{
+  if (self == NULL)
+    return;
+
+  g_slice_free (JointFilter, self);
+}
+
+/* Forgets every joint, for when the joints to come are from someone
+   else or another point of view */
+void
+joint_filter_reset (JointFilter *self)
+{
+  gint i;
+
+  for (i = 0; i < SKELTRACK_JOINT_MAX_JOINTS; i++)
+    self->joints[i].valid = FALSE;
+}
+
+/* Smooths the joints of @list, of a frame captured at @timestamp, in
+   place, and adds those that went missing lately. Frames must be
+   applied in the order they were captured. */
+void
+joint_filter_apply (JointFilter        *self,
+                    SkeltrackJointList  list,
+                    gint64              timestamp)
+{
+  gint i, j;
+
+  /* no skeleton at all, nothing to carry on */
+  if (list == NULL)
+    return;
+
+  for (i = 0; i < SKELTRACK_JOINT_MAX_JOINTS; i++)
+    {
+      JointState *state = &self->joints[i];
+      gfloat coords[N_COORDS];
+      gfloat elapsed;
+
+      if (list[i] == NULL)
+        {
+          SkeltrackJoint joint = { 0 };
+
+          if (! state->valid || state->missing >= self->persistency)
+            {
+              state->valid = FALSE;
+              continue;
+            }
+
+          elapsed = get_elapsed (state, timestamp);
+          for (j = 0; j < N_COORDS; j++)
+            state->value[j] += state->trend[j] * elapsed;
+          state->timestamp = timestamp;
+          state->missing++;
+
+          joint.id = i;
+          joint_set_coords (&joint, state->value);
+          list[i] = skeltrack_joint_copy (&joint);
+          continue;
+        }
+
+      joint_get_coords (list[i], coords);
+
+      if (! state->valid)
+        {
+          for (j = 0; j < N_COORDS; j++)
+            {
+              state->value[j] = coords[j];
+              state->trend[j] = 0.0f;
+            }
+        }
+      else
+        {
+          elapsed = get_elapsed (state, timestamp);
+          for (j = 0; j < N_COORDS; j++)
+            {
+              gfloat predicted, value;
+
+              predicted = state->value[j] + state->trend[j] * elapsed;
+              value = self->weight * coords[j] + (1 - self->weight) * predicted;
+
+              state->trend[j] = self->weight * (value - state->value[j]) / elapsed +
+                (1 - self->weight) * state->trend[j];
+              state->value[j] = value;
+            }
+
+          joint_set_coords (list[i], state->value);
+        }
+
+      state->valid = TRUE;
+      state->missing = 0;
+      state->timestamp = timestamp;
+    }
+}
+
+/* Returns where the joints are expected to be in a frame captured at
+   @timestamp, from the frames applied so far, without changing them,
+   or NULL if there is no head to expect. Free it with
+   skeltrack_joint_list_free(). */
+SkeltrackJointList
+joint_filter_predict (JointFilter *self, gint64 timestamp)
+{
+  SkeltrackJointList list;
+  gint i, j;
+
+  if (! self->joints[SKELTRACK_JOINT_ID_HEAD].valid)
+    return NULL;
+
+  list = skeltrack_joint_list_new ();
+
+  for (i = 0; i < SKELTRACK_JOINT_MAX_JOINTS; i++)
+    {
+      const JointState *state = &self->joints[i];
+      SkeltrackJoint joint = { 0 };
+      gfloat coords[N_COORDS];
+      gfloat elapsed;
+
+      if (! state->valid)
+        continue;
+
+      elapsed = get_elapsed (state, timestamp);
+      if (elapsed > MAX_PREDICTION)
+        continue;
+
+      for (j = 0; j < N_COORDS; j++)
+        coords[j] = state->value[j] + state->trend[j] * elapsed;
+
+      joint.id = i;
+      joint_set_coords (&joint, coords);
+      list[i] = skeltrack_joint_copy (&joint);
+    }
+
+  if (list[SKELTRACK_JOINT_ID_HEAD] == NULL)
+    {
+      skeltrack_joint_list_free (list);
+      return NULL;
+    }
+
+  return list;
+}
@@ -0,0 +1,50 @@
+/*
+ * joint-filter.h
+ *
+ * MSPT Salutations, interactive installation
+ *
+ * Copyright (C) 2012, Igalia S.L.
+ *
+ * Authors:
+ *   Joaquim Rocha <jrocha@igalia.com>
+ *   Eduardo Lima Mitev <elima@igalia.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 3, or (at your option) any later version as published by
+ * the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Affero General Public License at http://www.gnu.org/licenses/gpl.html
+ * for more details.
+ */
+
+#ifndef __JOINT_FILTER_H__
+#define __JOINT_FILTER_H__
+
+#include <glib.h>
+#include <skeltrack-joint.h>
+
+G_BEGIN_DECLS
+
+typedef struct _JointFilter JointFilter;
+
+JointFilter *      joint_filter_new     (gfloat              smoothing,
+                                         guint               persistency);
+
+void               joint_filter_free    (JointFilter        *self);
+
+void               joint_filter_reset   (JointFilter        *self);
+
+void               joint_filter_apply   (JointFilter        *self,
+                                         SkeltrackJointList  list,
+                                         gint64              timestamp);
+
+SkeltrackJointList joint_filter_predict (JointFilter        *self,
+                                         gint64              timestamp);
+
+G_END_DECLS
+
+#endif /* __JOINT_FILTER_H__ */
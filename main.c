@@ -41,6 +41,37 @@ main (gint argc, gchar *argv[])
   if (argc < 2)
     {
       g_print ("\nUsage: %s <absolute-path-to-video-snippets>\n\n", argv[0]);
+      g_print ("Environment:\n"
+               "  MSPT_DEPTH_ALL_VISITORS      track everyone in view as one visitor, rather than\n"
+               "                               only the nearest one\n"
+               "  MSPT_DEPTH_DEVICES=<n>       number of Kinects to track visitors with (1 by default)\n"
+               "  MSPT_DEPTH_DEVICE_SPACING=<mm>\n"
+               "                               distance between Kinects side by side (1500 by default)\n"
+               "  MSPT_DEPTH_DISPARITY         take the Kinect's raw disparities and convert them\n"
+               "                               to millimetres only where needed\n"
+               "  MSPT_DEPTH_FILTER            fill holes and remove flicker over the last frames\n"
+               "  MSPT_DEPTH_NO_BACKGROUND     don't remove the learnt empty scene from the depth\n"
+               "  MSPT_DEPTH_RECORD=<file>     record the depth session to <file>\n"
+               "  MSPT_DEPTH_RECORD_RAW        record uncompressed depth frames\n"
+               "  MSPT_DEPTH_REPLAY=<file>     replay a recorded session instead of using the Kinect\n"
+               "  MSPT_DEPTH_REPLAY_FULL_SPEED replay as fast as possible, not in real time\n"
+               "  MSPT_DEPTH_SAMPLING=<mode>   how depth is reduced for tracking: point (default),\n"
+               "                               nearest or mean\n"
+               "  MSPT_DEPTH_SYNTH=<motion>    render a person doing <motion> instead of using the Kinect\n"
+               "                               (idle, wave, bow, kiss, curtsy or all)\n"
+               "  MSPT_DEPTH_SYNTH_FPS=<fps>   frames rendered per second, 0 for as fast as possible\n"
+               "  MSPT_DEPTH_THREADS=<n>       threads preprocessing the frames of every Kinect,\n"
+               "                               0 to share the processors between them (default)\n"
+               "  MSPT_GESTURES=<file>         gestures described in <file>, replacing the\n"
+               "                               built-in ones of the same name\n"
+               "  MSPT_MAX_VISITORS=<n>        people in view followed as visitors of their own\n"
+               "                               (1 by default, 4 at most)\n"
+               "  MSPT_TRACKING_BUDGET=<ms>    time tracking a frame should take, 0 for a fixed\n"
+               "                               dimension reduction (30 by default)\n"
+               "  MSPT_TRACKING_INTERVAL=<n>   track one frame of every <n> while following\n"
+               "                               someone, predicting the joints in the others\n"
+               "  MSPT_TRACKING_JOBS=<n>       frames tracked at once, 0 for one for every\n"
+               "                               processor (default), 4 at most\n\n");
       return -1;
     }
 
@@ -22,330 +22,1425 @@
  */
 
 #include "salut-stream.h"
+#include "joint-filter.h"
 
 #define DEPTH_FRAME_CHECK_INTERVAL 5000
 
-#define TRANSFORM_BUFFER TRUE
+/* a tracking job older than this is cancelled when a newer frame is
+   waiting, to keep the gesture latency bounded */
+#define STALE_TRACKING_TIME 150 /* milliseconds */
+
+/* frames of a sensor tracked at once at most, each on a skeleton of
+   its own and holding a frame of the capture */
+#define MAX_TRACKING_JOBS 4
+
+/* what skeltrack would smooth joints with, and for how many frames it
+   would keep a joint that went missing */
+#define JOINT_SMOOTHING .25
+#define JOINT_PERSISTENCY 3
+
 static guint THRESHOLD_BEGIN = 500;
 
-struct _BufferInfo
+/* dimension reductions the latency controller moves along, finest
+   first */
+static const guint dimension_factors[] = { 6, 8, 10, 12, 16, 20, 24, 32 };
+
+/* tracking jobs averaged before the controller decides anything */
+#define BUDGET_SAMPLES 15
+
+#define DEFAULT_TRACKING_BUDGET 30 /* milliseconds */
+
+/* weight of every new frame in the score of a sensor */
+#define SCORE_SMOOTHING .2
+
+/* how much better than the active sensor another one must see the
+   scene to take over, so tracking doesn't flap between sensors */
+#define SENSOR_SWITCH_RATIO 1.5
+
+/* a sensor that sent nothing for this long is left out */
+#define SENSOR_STALL_TIME 1000 /* milliseconds */
+
+/* visitors followed at once at most, each in an object of the frames
+   of their own */
+#define MAX_VISITORS DEPTH_FRAME_MAX_REGIONS
+
+/* how far, in pixels of the full resolution frame, an object may be
+   from where a visitor was last seen to still be taken for them when
+   several are followed */
+#define MAX_VISITOR_STEP 100
+
+/* a visitor not seen for this long has left */
+#define VISITOR_LOST_TIME 1000 /* milliseconds */
+
+struct _SalutSensor
 {
-  guint16 *buffer;
-  guint16 *reduced_buffer;
-  gint width;
-  gint height;
-  gint reduced_width;
-  gint reduced_height;
+  SalutStream *stream;
+  guint index;
+
+  /* every sensor captures and preprocesses in its own thread, and
+     tracks with its own skeletons, which its visitors share */
+  DepthCapture *capture;
+  GQueue idle_skeletons;
+  guint n_skeletons;
+  gboolean opened;
+
+  /* where the sensor is in the shared scene: joints it tracks are
+     moved this many millimetres along x */
+  gint scene_offset;
+
+  /* how much of the visitors the sensor sees, smoothed over frames */
+  gdouble score;
+  gint64 last_frame_time;
+
+  guint frames_tracked;
+  guint frames_coalesced;
+  guint frames_cancelled;
+
+  /* accumulated since the last report */
+  guint last_frame_count;
+  guint last_processed_count;
+  gint64 latency_sum;
+  guint latency_samples;
+
+  /* as of the last report */
+  gdouble frame_rate;
+  gdouble latency;
 };
 
+/* someone followed in the frames of the active sensor, in the object
+   of every frame that is them. Their joints are smoothed by their own
+   filter, as smoothing only makes sense for a single body seen from a
+   single point of view, and watched for gestures on their own. */
+typedef struct
+{
+  SalutStream *stream;
+  guint id;
+
+  /* only announced once a skeleton is found for them; once they left,
+     they are freed as soon as their jobs are finished */
+  gboolean entered;
+  gboolean gone;
+  gboolean finishing;
+
+  /* the centre of their object when last seen, in pixels of the full
+     resolution frame of the active sensor, unless it has not been
+     seen since tracking was handed over to another sensor */
+  gfloat x;
+  gfloat y;
+  gboolean placed;
+  gboolean matched;
+  gint64 last_seen;
+
+  /* in-flight tracking jobs, oldest first, how many of them are on a
+     skeleton, and the newest frame they are in waiting for one */
+  GQueue tracking_jobs;
+  guint n_tracking;
+  DepthFrame *pending_frame;
+  guint pending_region;
+
+  JointFilter *joint_filter;
+
+  /* whether the last frame tracked showed their skeleton, whose joints
+     are then predicted in the frames in between tracked ones, and how
+     many frames they were predicted in since */
+  gboolean following;
+  guint frames_predicted;
+  SkeltrackJoint head;
+
+  /* while no skeleton is found for them, it is only looked for once
+     every lookup interval */
+  gint64 last_lookup_attempt;
+  gint64 last_lookup_successful_attempt;
+
+  Salut *salut;
+} SalutVisitor;
+
+/* a region of a frame being tracked on one of the skeletons of a
+   sensor, for one visitor, and its joints once done */
+typedef struct
+{
+  SalutSensor *sensor;
+  SalutVisitor *visitor;
+  SkeltrackSkeleton *skeleton;
+  DepthFrame *frame;
+  DepthRegion region;
+  gint64 timestamp;
+  GCancellable *cancellable;
+  gint64 start_time;
+  gint64 end_time;
+
+  /* not tracked but predicted, once the frames before it are in, so
+     it doesn't hold its frame */
+  gboolean predicted;
+
+  gboolean done;
+  SkeltrackJointList list;
+  GError *error;
+} TrackingJob;
+
 typedef struct {
   void (*callback) (SalutStream *, gpointer);
   gpointer data;
+  SalutStream *stream;
 } CallbackData;
 
+static void start_tracking_visitors (SalutStream *self);
+static void sensor_free (SalutSensor *sensor);
+static void stream_free (SalutStream *stream);
+static void update_capture (SalutStream *self);
+
+/* Goes one step coarser when tracking jobs take longer than the budget
+   on average, or one finer if the cost expected at the finer step,
+   which grows with the number of pixels, still leaves some headroom */
 static void
-on_track_joints (GObject      *obj,
-                 GAsyncResult *res,
-                 gpointer      user_data)
+adapt_dimension_factor (SalutStream *self, gint64 latency)
 {
-  SalutStream *self;
-  BufferInfo *buffer_info;
-  guint16 *reduced, *buffer;
-  gint width, height, reduced_width, reduced_height;
-  SkeltrackJointList list;
-  GError *error = NULL;
+  gdouble average, finer_ratio;
+  guint i, n_factors, new_factor;
+
+  if (self->tracking_budget == 0)
+    return;
+
+  self->latency_sum += latency;
+  self->latency_samples++;
+  if (self->latency_samples < BUDGET_SAMPLES)
+    return;
+
+  average = self->latency_sum / 1000.0 / self->latency_samples;
+  self->latency_sum = 0;
+  self->latency_samples = 0;
+
+  n_factors = G_N_ELEMENTS (dimension_factors);
+  for (i = 0; i < n_factors - 1 && dimension_factors[i] < self->dimension_factor; i++);
+
+  new_factor = self->dimension_factor;
+  if (average > self->tracking_budget && i + 1 < n_factors)
+    {
+      new_factor = dimension_factors[i + 1];
+    }
+  else if (i > 0)
+    {
+      finer_ratio = (gdouble) self->dimension_factor / dimension_factors[i - 1];
+      if (average * finer_ratio * finer_ratio < self->tracking_budget * .8)
+        new_factor = dimension_factors[i - 1];
+    }
+
+  if (new_factor == self->dimension_factor)
+    return;
+
+  g_print ("Dimension reduction %u -> %u (tracking took %.1f ms on average, budget is %u ms)\n",
+           self->dimension_factor,
+           new_factor,
+           average,
+           self->tracking_budget);
+
+  self->dimension_factor = new_factor;
+}
+
+static guint
+get_n_tracking_jobs (SalutStream *self)
+{
+  guint n_jobs;
+
+  n_jobs = self->n_tracking_jobs > 0 ?
+    self->n_tracking_jobs : g_get_num_processors ();
+
+  return CLAMP (n_jobs, 1, MAX_TRACKING_JOBS);
+}
+
+/* The jobs are split between the visitors, each of whom is tracked a
+   frame at a time at least, so all of them are tracked in parallel */
+static guint
+get_n_visitor_jobs (SalutStream *self)
+{
+  guint n_visitors;
+
+  n_visitors = MAX (g_queue_get_length (&self->visitors), 1);
+
+  return MAX (get_n_tracking_jobs (self) / n_visitors, 1);
+}
+
+static guint
+get_n_skeletons (SalutStream *self)
+{
+  return MAX (get_n_tracking_jobs (self), g_queue_get_length (&self->visitors));
+}
+
+static SkeltrackSkeleton *
+sensor_new_skeleton (SalutSensor *sensor)
+{
+  SkeltrackSkeleton *skeleton;
+
+  /* no skeleton sees every frame, so they are smoothed afterwards, by
+     the visitor's joint filter */
+  skeleton = SKELTRACK_SKELETON (skeltrack_skeleton_new ());
+  g_object_set (skeleton,
+                "smoothing-factor", 0.0,
+                "joints-persistency", 0,
+                NULL);
+  sensor->n_skeletons++;
+
+  return skeleton;
+}
+
+/* whether a frame could be tracked right away */
+static gboolean
+sensor_has_idle_skeleton (SalutSensor *sensor)
+{
+  return ! g_queue_is_empty (&sensor->idle_skeletons) ||
+    sensor->n_skeletons < get_n_skeletons (sensor->stream);
+}
+
+static SkeltrackSkeleton *
+sensor_acquire_skeleton (SalutSensor *sensor)
+{
+  if (g_queue_is_empty (&sensor->idle_skeletons))
+    return sensor_new_skeleton (sensor);
+
+  return SKELTRACK_SKELETON (g_queue_pop_head (&sensor->idle_skeletons));
+}
+
+/* the pool shrinks as skeletons come back, if there are too many */
+static void
+sensor_release_skeleton (SalutSensor *sensor, SkeltrackSkeleton *skeleton)
+{
+  if (sensor->n_skeletons > get_n_skeletons (sensor->stream))
+    {
+      g_object_unref (skeleton);
+      sensor->n_skeletons--;
+    }
+  else
+    {
+      g_queue_push_tail (&sensor->idle_skeletons, skeleton);
+    }
+}
+
+static gboolean
+visitor_can_track (SalutVisitor *visitor)
+{
+  SalutStream *self = visitor->stream;
+
+  return visitor->n_tracking < get_n_visitor_jobs (self) &&
+    sensor_has_idle_skeleton (self->active_sensor);
+}
+
+static void
+on_visitor_gesture (gpointer data)
+{
+  SalutVisitor *visitor = (SalutVisitor *) data;
+  SalutStream *self = visitor->stream;
+
+  if (visitor->entered && self->gesture_cb != NULL)
+    self->gesture_cb (self, visitor->id, self->gesture_cb_data);
+}
+
+static SalutVisitor *
+visitor_new (SalutStream *self)
+{
+  SalutVisitor *visitor;
+
+  visitor = g_slice_new0 (SalutVisitor);
+  visitor->stream = self;
+  visitor->id = ++self->last_visitor_id;
+  visitor->joint_filter = joint_filter_new (JOINT_SMOOTHING, JOINT_PERSISTENCY);
+
+  visitor->salut = salut_new ();
+  salut_set_gesture_to_track (visitor->salut,
+                              self->gesture,
+                              on_visitor_gesture,
+                              visitor);
+
+  /* their skeleton is looked for in every frame at first */
+  visitor->last_lookup_successful_attempt = g_get_real_time ();
+
+  g_queue_push_tail (&self->visitors, visitor);
+
+  return visitor;
+}
+
+static void
+visitor_free (SalutVisitor *visitor)
+{
+  joint_filter_free (visitor->joint_filter);
+  salut_free (visitor->salut);
+
+  g_slice_free (SalutVisitor, visitor);
+}
+
+/* Frames waiting are dropped and those being tracked cancelled; what
+   is tracked next starts smoothing anew */
+static void
+visitor_drop_pending_frames (SalutVisitor *visitor)
+{
+  GList *l;
+
+  if (visitor->pending_frame != NULL)
+    {
+      depth_frame_release (visitor->pending_frame);
+      visitor->pending_frame = NULL;
+    }
+
+  for (l = visitor->tracking_jobs.head; l != NULL; l = l->next)
+    {
+      TrackingJob *job = (TrackingJob *) l->data;
+
+      if (job->cancellable != NULL)
+        g_cancellable_cancel (job->cancellable);
+    }
+
+  joint_filter_reset (visitor->joint_filter);
+  visitor->following = FALSE;
+}
+
+/* The visitor is no longer followed, and is announced to have left if
+   they had been to have entered */
+static void
+visitor_leave (SalutVisitor *visitor)
+{
+  SalutStream *self = visitor->stream;
+
+  g_queue_remove (&self->visitors, visitor);
+  visitor->gone = TRUE;
+  visitor_drop_pending_frames (visitor);
+
+  /* whoever comes next is found anew */
+  if (self->max_visitors <= 1)
+    depth_capture_set_visitor_position (self->active_sensor->capture, -1, -1);
+
+  if (visitor->entered && self->visitor_left_cb != NULL)
+    self->visitor_left_cb (self, visitor->id, self->visitor_left_cb_data);
+
+  if (g_queue_is_empty (&visitor->tracking_jobs) && ! visitor->finishing)
+    visitor_free (visitor);
+}
+
+static void
+visitors_leave (SalutStream *self)
+{
+  SalutVisitor *visitor;
+
+  while ((visitor = g_queue_peek_head (&self->visitors)) != NULL)
+    visitor_leave (visitor);
+}
+
+/* The score is the area the foreground covers in the raw frame, so
+   sensors reducing differently compare fairly, halved when it touches
+   a side of the frame, as the visitor is then partly out of view */
+static void
+sensor_score_frame (SalutSensor *sensor, DepthFrame *frame)
+{
+  const DepthBox *foreground = &frame->foreground;
+  gdouble score;
+
+  score = (gdouble) foreground->width * foreground->height *
+    frame->dimension_factor * frame->dimension_factor;
+
+  if (foreground->width > 0 &&
+      (foreground->x == 0 ||
+       foreground->x + foreground->width == frame->reduced_width))
+    {
+      score /= 2;
+    }
+
+  sensor->score = sensor->score * (1 - SCORE_SMOOTHING) + score * SCORE_SMOOTHING;
+}
+
+static gboolean
+sensor_is_live (SalutSensor *sensor, gint64 current_time)
+{
+  return current_time - sensor->last_frame_time < SENSOR_STALL_TIME * 1000;
+}
+
+/* Hands tracking over to the sensor that sees the scene best, if it
+   does clearly better than the active one or the active one stopped
+   sending frames */
+static void
+choose_active_sensor (SalutStream *self)
+{
+  SalutSensor *active, *best;
+  gint64 current_time;
+  GList *l;
+  guint i;
+
+  current_time = g_get_real_time ();
+  active = self->active_sensor;
+
+  best = NULL;
+  for (i = 0; i < self->n_sensors; i++)
+    {
+      SalutSensor *sensor = self->sensors[i];
+
+      if (sensor_is_live (sensor, current_time) &&
+          (best == NULL || sensor->score > best->score))
+        {
+          best = sensor;
+        }
+    }
+
+  if (best == NULL || best == active)
+    return;
 
-  self = (SalutStream *) user_data;
-  buffer_info = self->buffer_info;
-  buffer = buffer_info->buffer;
-  reduced = (guint16 *) buffer_info->reduced_buffer;
-  width = buffer_info->width;
-  height = buffer_info->height;
-  reduced_width = buffer_info->reduced_width;
-  reduced_height = buffer_info->reduced_height;
+  if (sensor_is_live (active, current_time) &&
+      best->score <= active->score * SENSOR_SWITCH_RATIO)
+    {
+      return;
+    }
+
+  g_print ("Tracking on depth sensor %u\n", best->index);
+
+  /* visitors are found again in the frames of the new sensor, from
+     left to right as they stood, which the sensors agree on as they
+     face the same way */
+  for (l = self->visitors.head; l != NULL; l = l->next)
+    {
+      SalutVisitor *visitor = (SalutVisitor *) l->data;
+
+      visitor_drop_pending_frames (visitor);
+      visitor->placed = FALSE;
+    }
+
+  depth_capture_set_visitor_position (active->capture, -1, -1);
+  self->active_sensor = best;
+
+  /* only the active sensor keeps full resolution frames */
+  update_capture (self);
+}
+
+/* Takes the joints of a job once those of all the frames before it
+   were taken, so they go on in the order the frames were captured */
+static void
+finish_tracking_job (TrackingJob *job)
+{
+  SalutSensor *sensor = job->sensor;
+  SalutVisitor *visitor = job->visitor;
+  SalutStream *self = sensor->stream;
+  DepthFrame *frame = job->frame;
+  SkeltrackJointList list = job->list;
+  SkeltrackJoint *head;
+  GError *error = job->error;
+  gint i;
+
+  if (job->predicted)
+    {
+      /* from every frame tracked before this one */
+      list = joint_filter_predict (visitor->joint_filter, job->timestamp);
 
-  list = skeltrack_skeleton_track_joints_finish (self->skeleton,
-                                                 res,
-                                                 &error);
+      sensor->latency_sum += g_get_real_time () - job->timestamp;
+      sensor->latency_samples++;
+    }
+  else if (error == NULL)
+    {
+      /* skeltrack only saw the region around the visitor */
+      depth_process_uncrop_joints (list,
+                                   &job->region.crop,
+                                   frame->reduced_width,
+                                   frame->reduced_height,
+                                   frame->dimension_factor);
+
+      /* gestures are followed in the shared scene, which keeps them
+         continuous when the visitor is handed over to another sensor;
+         screen coordinates stay the sensor's, for its depth view */
+      for (i = 0; list != NULL && i < SKELTRACK_JOINT_MAX_JOINTS; i++)
+        {
+          if (list[i] != NULL)
+            list[i]->x += sensor->scene_offset;
+        }
+
+      joint_filter_apply (visitor->joint_filter, list, job->timestamp);
+
+      adapt_dimension_factor (self, job->end_time - job->start_time);
+
+      sensor->latency_sum += g_get_real_time () - job->timestamp;
+      sensor->latency_samples++;
+    }
+
+  if (! job->predicted)
+    {
+      visitor->following = error == NULL && list != NULL &&
+        skeltrack_joint_list_get_joint (list, SKELTRACK_JOINT_ID_HEAD) != NULL;
+    }
 
   if (error != NULL)
     {
-      g_warning ("%s\n", error->message);
+      if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        sensor->frames_cancelled++;
+      else
+        g_warning ("%s\n", error->message);
       g_error_free (error);
     }
-  else if (list && skeltrack_joint_list_get_joint (list, SKELTRACK_JOINT_ID_HEAD))
+  else if (visitor->gone || sensor != self->active_sensor)
     {
-      if (self->status == SALUT_STREAM_NO_PERSON)
+      /* left, or handed over, while the job was running */
+    }
+  else if (list != NULL &&
+           (head = skeltrack_joint_list_get_joint (list, SKELTRACK_JOINT_ID_HEAD)) != NULL)
+    {
+      /* the next frames keep isolating this visitor, when only one is
+         followed */
+      if (self->max_visitors <= 1)
+        {
+          depth_capture_set_visitor_position (sensor->capture,
+                                              head->screen_x,
+                                              head->screen_y);
+        }
+
+      visitor->head = *head;
+      if (! job->predicted)
+        {
+          visitor->last_lookup_successful_attempt = job->end_time;
+
+          /* however still they stand, they are still there */
+          depth_presence_keep (self->presence, job->timestamp);
+        }
+
+      if (! visitor->entered)
         {
-          self->status = SALUT_STREAM_HAS_PERSON;
-          if (self->person_entered_scene_cb != NULL)
+          visitor->entered = TRUE;
+
+          if (self->visitor_entered_cb != NULL)
             {
-              self->person_entered_scene_cb (self,
-                                             self->person_entered_scene_cb_data);
+              self->visitor_entered_cb (self,
+                                        visitor->id,
+                                        self->visitor_entered_cb_data);
             }
         }
-      self->last_skeleton_lookup_successful_attempt = g_get_real_time ();
 
-      if (self->can_detect_gesture)
+      /* hand poses read the depth, so they are only looked at in
+         tracked frames */
+      if (self->can_detect_gesture && ! visitor->gone)
         {
-          salut_set_track_data (self->salut, buffer, width, height, list);
+          salut_set_track_data (visitor->salut,
+                                frame != NULL ? &frame->pyramid : NULL,
+                                frame != NULL ? &frame->mask : NULL,
+                                list,
+                                job->timestamp);
         }
     }
 
-  g_slice_free1 (reduced_width * reduced_height * sizeof (guint16), reduced);
-  buffer_info->reduced_buffer = NULL;
+  depth_frame_release (frame);
 
   skeltrack_joint_list_free (list);
+  if (job->cancellable != NULL)
+    g_object_unref (job->cancellable);
+
+  g_slice_free (TrackingJob, job);
+}
+
+/* Jobs may finish out of order, the older ones being waited for.
+   Returns FALSE if the visitor had left and is now freed. */
+static gboolean
+finish_tracking_jobs (SalutVisitor *visitor)
+{
+  TrackingJob *job;
+
+  visitor->finishing = TRUE;
+  while ((job = g_queue_peek_head (&visitor->tracking_jobs)) != NULL &&
+         job->done)
+    {
+      g_queue_pop_head (&visitor->tracking_jobs);
+      finish_tracking_job (job);
+    }
+  visitor->finishing = FALSE;
+
+  if (visitor->gone && g_queue_is_empty (&visitor->tracking_jobs))
+    {
+      visitor_free (visitor);
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+on_track_joints (GObject      *obj,
+                 GAsyncResult *res,
+                 gpointer      user_data)
+{
+  TrackingJob *job = (TrackingJob *) user_data;
+  SalutSensor *sensor = job->sensor;
+  SalutVisitor *visitor = job->visitor;
+  SalutStream *self = sensor->stream;
+
+  job->list = skeltrack_skeleton_track_joints_finish (job->skeleton,
+                                                      res,
+                                                      &job->error);
+  job->end_time = g_get_real_time ();
+  job->done = TRUE;
+
+  sensor_release_skeleton (sensor, job->skeleton);
+  job->skeleton = NULL;
+  visitor->n_tracking--;
+  self->n_tracking--;
+
+  finish_tracking_jobs (visitor);
+
+  if (self->freed)
+    {
+      if (self->n_tracking == 0)
+        stream_free (self);
+      return;
+    }
+
+  /* go on with the newest frames that arrived meanwhile, if any, of
+     this visitor or of one who was waiting for a skeleton */
+  start_tracking_visitors (self);
+}
+
+static gboolean
+abort_app (gpointer user_data)
+{
+  g_error ("The depth camera took to long initialize, aborting application!");
+
+  return FALSE;
+}
+
+/* Reports every sensor's frame rate and latency, from capture to
+   joints, separately, so a slow sensor can be told apart. Only if
+   none of them sent any frame while tracking is the application
+   aborted. */
+static gboolean
+check_depth_frames (gpointer user_data)
+{
+  SalutStream *self = (SalutStream *) user_data;
+  gboolean any_frames = FALSE;
+  guint i;
+
+  for (i = 0; i < self->n_sensors; i++)
+    {
+      SalutSensor *sensor = self->sensors[i];
+      guint frame_count, processed_count;
+      gdouble processed_rate;
+
+      frame_count = depth_capture_get_frame_count (sensor->capture);
+      processed_count = depth_capture_get_processed_count (sensor->capture);
+      if (frame_count != sensor->last_frame_count)
+        any_frames = TRUE;
+      else if (self->n_sensors > 1 && self->tracking)
+        g_warning ("Depth sensor %u sent no frames lately", sensor->index);
+
+      sensor->frame_rate = (frame_count - sensor->last_frame_count) * 1000.0 /
+        DEPTH_FRAME_CHECK_INTERVAL;
+      processed_rate = (processed_count - sensor->last_processed_count) * 1000.0 /
+        DEPTH_FRAME_CHECK_INTERVAL;
+      sensor->latency = sensor->latency_samples > 0 ?
+        sensor->latency_sum / 1000.0 / sensor->latency_samples : 0.0;
+
+      sensor->last_frame_count = frame_count;
+      sensor->last_processed_count = processed_count;
+      sensor->latency_sum = 0;
+      sensor->latency_samples = 0;
+
+      if (self->n_sensors > 1)
+        {
+          g_print ("Depth sensor %u: %.1f frames/s, %.1f preprocessed, %.1f ms from capture to joints, %u dropped%s\n",
+                   sensor->index,
+                   sensor->frame_rate,
+                   processed_rate,
+                   sensor->latency,
+                   depth_capture_get_dropped_count (sensor->capture),
+                   sensor == self->active_sensor ? " (tracking)" : "");
+        }
+    }
+
+  /* replays and generators stop while nothing is tracked */
+  if (! any_frames && self->tracking)
+    return abort_app (self);
+
+  return TRUE;
+}
+
+/* whether a visitor is watched for a hand pose */
+static gboolean
+visitors_need_depth (SalutStream *self)
+{
+  GList *l;
+
+  for (l = self->visitors.head; l != NULL; l = l->next)
+    {
+      if (salut_needs_depth (((SalutVisitor *) l->data)->salut))
+        return TRUE;
+    }
+
+  return FALSE;
 }
 
+/* pushes the current settings to the capture threads, which apply
+   them from their next frame on */
 static void
-process_buffer (BufferInfo *buffer_info,
-                guint dimension_factor,
-                guint threshold_begin,
-                guint threshold_end)
+update_capture (SalutStream *self)
 {
-  guint width, height;
-  gint i, j, reduced_width, reduced_height;
-  guint16 *buffer, *reduced_buffer;
+  guint i;
+
+  for (i = 0; i < self->n_sensors; i++)
+    {
+      DepthCapture *capture = self->sensors[i]->capture;
+
+      depth_capture_set_reduction (capture,
+                                   self->dimension_factor,
+                                   THRESHOLD_BEGIN,
+                                   self->depth_threshold);
+      depth_capture_set_sampling (capture, self->sampling);
+      depth_capture_set_filter (capture, self->filter_depth);
+      depth_capture_set_isolate_visitor (capture, self->isolate_visitor);
+      depth_capture_set_max_visitors (capture, self->max_visitors);
+
+      /* the processors are shared between the sensors, all of which
+         preprocess every frame */
+      depth_capture_set_n_threads (capture,
+                                   self->n_threads > 0 ?
+                                   self->n_threads :
+                                   MAX (g_get_num_processors () / self->n_sensors, 1));
+
+      /* the background is only learnt while nobody is being tracked */
+      depth_capture_set_background (capture,
+                                    self->subtract_background,
+                                    self->status == SALUT_STREAM_NO_PERSON);
+      depth_capture_set_keep_raw (capture,
+                                  self->sensors[i] == self->active_sensor &&
+                                  self->can_detect_gesture &&
+                                  visitors_need_depth (self));
+
+      /* sensors not tracking still preprocess, to be scored */
+      depth_capture_set_enabled (capture, self->tracking);
+    }
+}
+
+/* Starts tracking the pending frame of a visitor on one of the
+   skeletons of the active sensor, unless all of those they may use
+   are busy. Every skeleton tracks a frame at a time, each in a thread
+   of its own. While a visitor is being followed, only one frame every
+   tracking interval is tracked, the joints in the others being
+   predicted. */
+static void
+start_tracking (SalutVisitor *visitor)
+{
+  SalutStream *self = visitor->stream;
+  SalutSensor *sensor = self->active_sensor;
+  SkeltrackSkeleton *skeleton;
+  TrackingJob *job;
+  DepthFrame *frame;
+  gint64 current_time;
+  gint time_diff;
+  guint dimension_factor;
 
-  buffer = buffer_info->buffer;
-  width = buffer_info->width;
-  height = buffer_info->height;
+  frame = visitor->pending_frame;
+  if (frame == NULL)
+    return;
 
-  g_return_if_fail (buffer != NULL);
+  if (visitor->following &&
+      visitor->frames_predicted + 1 < self->tracking_interval)
+    {
+      /* still goes after the frames being tracked, so it is
+         predicted from them; only its time is needed for that, and
+         the ring slot is not held meanwhile */
+      job = g_slice_new0 (TrackingJob);
+      job->sensor = sensor;
+      job->visitor = visitor;
+      job->timestamp = frame->timestamp;
+      job->predicted = TRUE;
+      job->done = TRUE;
+      g_queue_push_tail (&visitor->tracking_jobs, job);
+      depth_frame_release (frame);
+      visitor->pending_frame = NULL;
+      visitor->frames_predicted++;
+
+      finish_tracking_jobs (visitor);
+      return;
+    }
 
-  reduced_width = (width - width % dimension_factor) / dimension_factor;
-  reduced_height = (height - height % dimension_factor) / dimension_factor;
+  if (! visitor_can_track (visitor))
+    return;
 
-  reduced_buffer = g_slice_alloc0 (reduced_width * reduced_height *
-                                   sizeof (guint16));
+  visitor->pending_frame = NULL;
 
-  for (i = 0; i < reduced_width; i++)
+  /* someone is there but shows no skeleton, so it is only looked for
+     once every lookup interval */
+  current_time = g_get_real_time ();
+  time_diff = (gint) ((current_time - visitor->last_lookup_successful_attempt) / 1000);
+  if (time_diff > self->lookup_interval)
     {
-      for (j = 0; j < reduced_height; j++)
+      time_diff = (gint) ((current_time - visitor->last_lookup_attempt) / 1000);
+      if (time_diff < self->lookup_interval)
         {
-          gint index;
-          guint16 value;
+          depth_frame_release (frame);
+          return;
+        }
+    }
+
+  visitor->last_lookup_attempt = current_time;
 
-          index = j * width * dimension_factor + i * dimension_factor;
-          value = buffer[index];
+  skeleton = sensor_acquire_skeleton (sensor);
 
-          if (value < threshold_begin || value > threshold_end)
+  /* frames reduced before the controller changed the reduction must
+     still be tracked with the one they were reduced with */
+  g_object_get (skeleton, "dimension-reduction", &dimension_factor, NULL);
+  if (dimension_factor != frame->dimension_factor)
+    {
+      g_object_set (skeleton,
+                    "dimension-reduction", frame->dimension_factor,
+                    NULL);
+    }
+
+  /* the slot is held by the tracking job until it is finished */
+  job = g_slice_new0 (TrackingJob);
+  job->sensor = sensor;
+  job->visitor = visitor;
+  job->skeleton = skeleton;
+  job->frame = frame;
+  job->region = frame->regions[visitor->pending_region];
+  job->timestamp = frame->timestamp;
+  job->cancellable = g_cancellable_new ();
+  job->start_time = current_time;
+  g_queue_push_tail (&visitor->tracking_jobs, job);
+  visitor->n_tracking++;
+  self->n_tracking++;
+  visitor->frames_predicted = 0;
+  sensor->frames_tracked++;
+
+  skeltrack_skeleton_track_joints (skeleton,
+                                   job->region.reduced,
+                                   job->region.crop.width,
+                                   job->region.crop.height,
+                                   job->cancellable,
+                                   on_track_joints,
+                                   job);
+}
+
+static void
+start_tracking_visitors (SalutStream *self)
+{
+  GList *l, *next;
+
+  for (l = self->visitors.head; l != NULL; l = next)
+    {
+      next = l->next;
+      start_tracking ((SalutVisitor *) l->data);
+    }
+}
+
+static gfloat
+visitor_get_distance (SalutVisitor      *visitor,
+                      const DepthRegion *region,
+                      guint              dimension_factor)
+{
+  gfloat dx, dy;
+
+  dx = region->x * dimension_factor - visitor->x;
+  dy = region->y * dimension_factor - visitor->y;
+
+  return dx * dx + dy * dy;
+}
+
+/* Hands every object of a frame of the active sensor over to the
+   visitor it is, taking the closest pairs of a visitor and an object
+   first, or to a new visitor if there is room for one */
+static void
+dispatch_frame (SalutStream *self, DepthFrame *frame)
+{
+  SalutVisitor *owners[DEPTH_FRAME_MAX_REGIONS] = { NULL };
+  SalutVisitor *visitor;
+  GList *l;
+  guint i, chosen = 0;
+
+  for (l = self->visitors.head; l != NULL; l = l->next)
+    ((SalutVisitor *) l->data)->matched = FALSE;
+
+  for (;;)
+    {
+      /* a single visitor is kept in the frames by the isolation */
+      gfloat best = self->max_visitors > 1 ?
+        MAX_VISITOR_STEP * MAX_VISITOR_STEP : G_MAXFLOAT;
+
+      visitor = NULL;
+      for (l = self->visitors.head; l != NULL; l = l->next)
+        {
+          SalutVisitor *candidate = (SalutVisitor *) l->data;
+
+          if (candidate->matched || ! candidate->placed)
+            continue;
+
+          for (i = 0; i < frame->n_regions; i++)
+            {
+              gfloat distance;
+
+              if (owners[i] != NULL)
+                continue;
+
+              distance = visitor_get_distance (candidate,
+                                               &frame->regions[i],
+                                               frame->dimension_factor);
+              if (distance < best)
+                {
+                  best = distance;
+                  visitor = candidate;
+                  chosen = i;
+                }
+            }
+        }
+
+      if (visitor == NULL)
+        break;
+
+      owners[chosen] = visitor;
+      visitor->matched = TRUE;
+    }
+
+  /* those not seen since tracking was handed over to this sensor take
+     the objects left from left to right, in the order they stood */
+  for (;;)
+    {
+      visitor = NULL;
+      for (l = self->visitors.head; l != NULL; l = l->next)
+        {
+          SalutVisitor *candidate = (SalutVisitor *) l->data;
+
+          if (! candidate->matched && ! candidate->placed &&
+              (visitor == NULL || candidate->x < visitor->x))
             {
-              reduced_buffer[j * reduced_width + i] = 0;
-              continue;
+              visitor = candidate;
             }
+        }
 
-          reduced_buffer[j * reduced_width + i] = value;
+      chosen = frame->n_regions;
+      for (i = 0; i < frame->n_regions; i++)
+        {
+          if (owners[i] == NULL &&
+              (chosen == frame->n_regions ||
+               frame->regions[i].x < frame->regions[chosen].x))
+            {
+              chosen = i;
+            }
         }
+
+      if (visitor == NULL || chosen == frame->n_regions)
+        break;
+
+      owners[chosen] = visitor;
+      visitor->matched = TRUE;
     }
 
-  buffer_info->reduced_buffer = reduced_buffer;
-  buffer_info->reduced_width = reduced_width;
-  buffer_info->reduced_height = reduced_height;
+  for (i = 0; i < frame->n_regions; i++)
+    {
+      const DepthRegion *region = &frame->regions[i];
 
-  return;
+      visitor = owners[i];
+      if (visitor == NULL)
+        {
+          if (g_queue_get_length (&self->visitors) >= self->max_visitors)
+            continue;
+
+          visitor = visitor_new (self);
+        }
+
+      visitor->x = region->x * frame->dimension_factor;
+      visitor->y = region->y * frame->dimension_factor;
+      visitor->placed = TRUE;
+      visitor->last_seen = frame->timestamp;
+
+      /* only the newest frame is kept while their jobs are running */
+      if (visitor->pending_frame != NULL)
+        {
+          depth_frame_release (visitor->pending_frame);
+          self->active_sensor->frames_coalesced++;
+        }
+      visitor->pending_frame = depth_frame_ref (frame);
+      visitor->pending_region = i;
+    }
 }
 
-static gboolean
-abort_app (gpointer user_data)
+/* Visitors come and go as the presence detector says */
+static void
+update_presence (SalutStream *self)
 {
-  g_error ("The depth camera took to long initialize, aborting application!");
+  gboolean present;
+  guint i;
 
-  return FALSE;
+  present = depth_presence_is_present (self->presence);
+
+  if (present && self->status == SALUT_STREAM_NO_PERSON)
+    {
+      self->status = SALUT_STREAM_HAS_PERSON;
+
+      if (self->person_entered_scene_cb != NULL)
+        {
+          self->person_entered_scene_cb (self,
+                                         self->person_entered_scene_cb_data);
+        }
+    }
+  else if (! present && self->status == SALUT_STREAM_HAS_PERSON)
+    {
+      self->status = SALUT_STREAM_NO_PERSON;
+
+      /* whoever comes next is found anew */
+      visitors_leave (self);
+      for (i = 0; i < self->n_sensors; i++)
+        depth_capture_set_visitor_position (self->sensors[i]->capture, -1, -1);
+
+      if (self->person_left_scene_cb != NULL)
+        {
+          self->person_left_scene_cb (self,
+                                      self->person_left_scene_cb_data);
+        }
+    }
 }
 
-static void
-on_depth_frame (GFreenectDevice *device, gpointer user_data)
-{
-  gint width, height;
-  gint dimension_factor;
-  guint16 *depth;
-  BufferInfo *buffer_info;
-  gsize len;
-  GFreenectFrameMode frame_mode;
-  SalutStream *self;
-  gint64 current_time;
-  gint time_diff;
+/* those whose object is gone for a while have left */
+static void
+expire_visitors (SalutStream *self)
+{
+  gint64 current_time;
+  GList *l, *next;
+
+  current_time = g_get_real_time ();
+
+  for (l = self->visitors.head; l != NULL; l = next)
+    {
+      SalutVisitor *visitor = (SalutVisitor *) l->data;
+
+      next = l->next;
+      if (current_time - visitor->last_seen > VISITOR_LOST_TIME * 1000)
+        visitor_leave (visitor);
+    }
+}
+
+/* called in the main context whenever a capture thread has queued
+   preprocessed frames */
+static void
+on_depth_frames (DepthCapture *capture, gpointer user_data)
+{
+  SalutSensor *sensor = (SalutSensor *) user_data;
+  SalutStream *self = sensor->stream;
+  DepthFrame *frame;
+  GList *l;
+
+  while ((frame = depth_capture_pop_frame (capture)) != NULL)
+    {
+      if (! self->tracking)
+        {
+          depth_frame_release (frame);
+          continue;
+        }
+
+      sensor_score_frame (sensor, frame);
+      sensor->last_frame_time = g_get_real_time ();
 
-  self = (SalutStream *) user_data;
+      /* the other sensors' frames are only needed for their score, and
+         nobody is tracked while nobody is there */
+      if (sensor == self->active_sensor)
+        {
+          depth_presence_update (self->presence, frame);
 
-  if (self->depth_frame_check_src_id != 0)
-    {
-      g_source_remove (self->depth_frame_check_src_id);
+          if (self->status == SALUT_STREAM_HAS_PERSON)
+            dispatch_frame (self, frame);
+        }
 
-      /* schedule a new re-check of the depth camera */
-      self->depth_frame_check_src_id =
-        g_timeout_add (DEPTH_FRAME_CHECK_INTERVAL, abort_app, self);
+      depth_frame_release (frame);
     }
 
-  if (! self->tracking)
+  /* only waiting for its last jobs to be finished */
+  if (self->freed)
     return;
 
-  buffer_info = self->buffer_info;
+  if (self->n_sensors > 1)
+    choose_active_sensor (self);
 
-  current_time = g_get_real_time ();
-  time_diff = (gint) ((current_time - self->last_skeleton_lookup_successful_attempt) / 1000);
-  if (time_diff > self->lookup_interval)
-    {
-      time_diff = (gint) ((current_time - self->last_skeleton_lookup_attempt) / 1000);
-      if (time_diff < self->lookup_interval)
-        {
-          return;
-        }
+  update_presence (self);
+
+  if (sensor != self->active_sensor)
+    return;
 
-      if (self->status == SALUT_STREAM_HAS_PERSON)
+  expire_visitors (self);
+
+  /* the oldest job of a visitor holds back the joints of all the
+     others */
+  for (l = self->visitors.head; l != NULL; l = l->next)
+    {
+      SalutVisitor *visitor = (SalutVisitor *) l->data;
+      TrackingJob *job;
+
+      job = g_queue_peek_head (&visitor->tracking_jobs);
+      if (job != NULL &&
+          job->cancellable != NULL &&
+          visitor->pending_frame != NULL &&
+          ! visitor_can_track (visitor) &&
+          g_get_real_time () - job->start_time > STALE_TRACKING_TIME * 1000)
         {
-          self->status = SALUT_STREAM_NO_PERSON;
-          if (self->person_left_scene_cb != NULL)
-            {
-              self->person_left_scene_cb (self,
-                                          self->person_left_scene_cb_data);
-            }
+          g_cancellable_cancel (job->cancellable);
         }
     }
 
-  self->last_skeleton_lookup_attempt = current_time;
+  start_tracking_visitors (self);
 
-  depth = (guint16 *) gfreenect_device_get_depth_frame_raw (device,
-                                                            &len,
-                                                            &frame_mode);
+  update_capture (self);
+}
 
-  if (depth == NULL)
-    return;
+/* Called once for every sensor. The stream is ready when all of them
+   have reported, with those that could not be opened left out; it
+   only fails if none could. */
+static void
+on_capture_ready (DepthCapture *capture,
+                  GError       *error,
+                  gpointer      user_data)
+{
+  CallbackData *cb_data;
+  SalutStream *stream;
+  guint i, n_opened;
 
-  width = frame_mode.width;
-  height = frame_mode.height;
+  cb_data = (CallbackData *) user_data;
+  stream = cb_data->stream;
 
-  if (TRANSFORM_BUFFER)
+  for (i = 0; i < stream->n_sensors; i++)
     {
-      if (buffer_info->buffer == NULL)
-        {
-          buffer_info->buffer = g_slice_alloc0 (width * height * sizeof (guint16));
+      SalutSensor *sensor = stream->sensors[i];
 
-        }
+      if (sensor->capture != capture)
+        continue;
+
+      if (error != NULL)
+        g_print ("Error opening depth device %u: %s\n", sensor->index, error->message);
+      else
+        sensor->opened = TRUE;
+    }
+
+  stream->sensors_opening--;
+  if (stream->sensors_opening > 0)
+    return;
 
-      guint i, j;
+  n_opened = 0;
+  for (i = 0; i < stream->n_sensors; i++)
+    {
+      SalutSensor *sensor = stream->sensors[i];
 
-      for (j = 0; j < width; j++)
+      if (sensor->opened)
         {
-          for (i = height - 1; i > 0; i--)
-            {
-              buffer_info->buffer[((width -1 - j) * height + ((height - 1) - i))] = depth[i * width + j];
-            }
+          stream->sensors[n_opened++] = sensor;
+        }
+      else
+        {
+          sensor_free (sensor);
         }
+    }
+  stream->n_sensors = n_opened;
 
-      width = height;
-      height = frame_mode.width;
+  if (n_opened == 0)
+    {
+      salut_stream_free (stream);
+      stream = NULL;
     }
   else
     {
-      buffer_info->buffer = depth;
-    }
+      stream->active_sensor = stream->sensors[0];
+      update_capture (stream);
 
-  buffer_info->width = width;
-  buffer_info->height = height;
-
-  g_object_get (self->skeleton, "dimension-reduction", &dimension_factor, NULL);
+      /* timeout to halt if no depth stream is received soon enough */
+      stream->depth_frame_check_src_id =
+        g_timeout_add (DEPTH_FRAME_CHECK_INTERVAL, check_depth_frames, stream);
+    }
 
-  process_buffer (buffer_info,
-                  dimension_factor,
-                  THRESHOLD_BEGIN,
-                  self->depth_threshold);
+  cb_data->callback (stream, cb_data->data);
 
-  skeltrack_skeleton_track_joints (self->skeleton,
-                                   buffer_info->reduced_buffer,
-                                   buffer_info->reduced_width,
-                                   buffer_info->reduced_height,
-                                   NULL,
-                                   on_track_joints,
-                                   self);
+  g_slice_free (CallbackData, cb_data);
 }
 
-static void
-on_new_device (GObject      *obj,
-               GAsyncResult *res,
-               gpointer      user_data)
+static SalutSensor *
+sensor_new (SalutStream *stream, guint index)
 {
-  GError *error = NULL;
-  SalutStream *stream = NULL;
-  Salut *salut;
-  BufferInfo *buffer_info;
-  SkeltrackSkeleton *skeleton;
-  CallbackData *cb_data;
-  void (*callback) (SalutStream *, gpointer);
-  GFreenectDevice *device;
+  SalutSensor *sensor;
 
-  cb_data = (CallbackData *) user_data;
-  callback = cb_data->callback;
+  sensor = g_slice_new0 (SalutSensor);
+  sensor->stream = stream;
+  sensor->index = index;
 
-  device = gfreenect_device_new_finish (res, &error);
+  /* more skeletons are created as frames need them */
+  g_queue_push_tail (&sensor->idle_skeletons, sensor_new_skeleton (sensor));
 
-  g_assert (callback != NULL);
+  /* the device is opened, and its frames rotated and reduced, in the
+     capture thread, away from the main loop */
+  sensor->capture = depth_capture_new (index, on_depth_frames, sensor);
 
-  if (device == NULL)
-    goto leave;
+  /* one frame is held by every job on a skeleton, and by every visitor
+     the newest frame they are in; predicted frames hold none */
+  depth_capture_set_frames_held (sensor->capture,
+                                 MAX_TRACKING_JOBS + MAX_VISITORS);
 
-  salut = salut_new ();
+  return sensor;
+}
 
-  skeleton = SKELTRACK_SKELETON (skeltrack_skeleton_new ());
-  g_object_set (skeleton, "smoothing-factor", .25, NULL);
+static void
+sensor_free (SalutSensor *sensor)
+{
+  depth_capture_free (sensor->capture);
+  g_queue_foreach (&sensor->idle_skeletons, (GFunc) g_object_unref, NULL);
+  g_queue_clear (&sensor->idle_skeletons);
 
-  buffer_info = g_slice_new0 (BufferInfo);
+  g_slice_free (SalutSensor, sensor);
+}
+
+static SalutStream *
+stream_new (guint n_sensors)
+{
+  SalutStream *stream;
+  guint i;
 
   stream = g_slice_new0 (SalutStream);
-  stream->device = device;
-  stream->skeleton = skeleton;
-  stream->salut = salut;
+  stream->tracking_budget = DEFAULT_TRACKING_BUDGET;
+  stream->tracking_interval = 1;
+  stream->max_visitors = 1;
+  stream->gesture = NONE;
+  stream->presence = depth_presence_new ();
   stream->depth_threshold = 2000;
-  stream->buffer_info = buffer_info;
+  stream->subtract_background = TRUE;
+  stream->isolate_visitor = TRUE;
   stream->status = SALUT_STREAM_NO_PERSON;
   stream->lookup_interval = 2000;
-  stream->last_skeleton_lookup_attempt = 0;
   stream->can_detect_gesture = FALSE;
   stream->person_entered_scene_cb = NULL;
   stream->person_entered_scene_cb_data = NULL;
   stream->person_left_scene_cb = NULL;
   stream->person_left_scene_cb_data = NULL;
 
-  /* timeout to halt if no depth stream is received soon enough */
-  stream->depth_frame_check_src_id =
-    g_timeout_add (DEPTH_FRAME_CHECK_INTERVAL, abort_app, stream);
+  stream->n_sensors = n_sensors;
+  stream->sensors = g_new (SalutSensor *, n_sensors);
+  for (i = 0; i < n_sensors; i++)
+    stream->sensors[i] = sensor_new (stream, i);
+  stream->active_sensor = stream->sensors[0];
+
+  g_object_get (g_queue_peek_head (&stream->active_sensor->idle_skeletons),
+                "dimension-reduction", &stream->dimension_factor,
+                NULL);
+
+  return stream;
+}
+
+static void
+stream_free (SalutStream *stream)
+{
+  guint i;
+
+  for (i = 0; i < stream->n_sensors; i++)
+    sensor_free (stream->sensors[i]);
+  g_free (stream->sensors);
+
+  depth_presence_free (stream->presence);
+
+  g_slice_free (SalutStream, stream);
+}
+
+static void
+stream_start_capture (SalutStream *stream,
+                      void (*callback) (SalutStream *, gpointer),
+                      gpointer data)
+{
+  CallbackData *cb_data;
+  guint i;
+
+  cb_data = g_slice_new (CallbackData);
+  cb_data->callback = callback;
+  cb_data->data = data;
+  cb_data->stream = stream;
+
+  stream->sensors_opening = stream->n_sensors;
+  for (i = 0; i < stream->n_sensors; i++)
+    depth_capture_start (stream->sensors[i]->capture, on_capture_ready, cb_data);
+}
+
+void
+salut_stream_new (void (*callback) (SalutStream *, gpointer), gpointer data)
+{
+  salut_stream_new_with_devices (1, FALSE, callback, data);
+}
+
+/* Like salut_stream_new(), but for @n_devices Kinects, from device
+   index 0 on, each captured in its own thread. Visitors are tracked on
+   the device that sees them best (see salut_stream_set_sensor_offset()
+   for placing the devices). With @disparity, the devices send their
+   raw 11 bit disparities, which are only converted to millimetres
+   where needed (see depth_capture_set_disparity()). */
+void
+salut_stream_new_with_devices (guint n_devices,
+                               gboolean disparity,
+                               void (*callback) (SalutStream *, gpointer),
+                               gpointer data)
+{
+  SalutStream *stream;
+  guint i;
+
+  g_assert (callback != NULL);
+  g_assert (n_devices > 0);
+
+  stream = stream_new (n_devices);
+  for (i = 0; i < n_devices; i++)
+    depth_capture_set_disparity (stream->sensors[i]->capture, disparity);
+
+  stream_start_capture (stream, callback, data);
+}
+
+/* Like salut_stream_new(), but frames are replayed from a recording
+   made with salut_stream_start_recording() instead of coming from the
+   Kinect. With @realtime the recorded frame timing is honoured,
+   otherwise frames are fed as fast as the tracking consumes them. */
+void
+salut_stream_new_from_recording (const gchar *path,
+                                 gboolean realtime,
+                                 void (*callback) (SalutStream *, gpointer),
+                                 gpointer data)
+{
+  SalutStream *stream;
+  GError *error = NULL;
+
+  g_assert (callback != NULL);
 
-  g_signal_connect (device,
-                    "depth-frame",
-                    G_CALLBACK (on_depth_frame),
-                    stream);
+  stream = stream_new (1);
 
-  if (! gfreenect_device_start_depth_stream (device,
-                                             GFREENECT_DEPTH_FORMAT_MM,
-                                             &error))
+  if (! depth_capture_set_replay (stream->active_sensor->capture,
+                                  path,
+                                  realtime,
+                                  &error))
     {
-      g_print ("Error starting depth stream: %s\n", error->message);
+      g_print ("Error opening depth recording: %s\n", error->message);
       g_error_free (error);
+
+      salut_stream_free (stream);
+      callback (NULL, data);
+      return;
     }
 
-  /* turn the kinect's led off */
-  gfreenect_device_set_led (device, GFREENECT_LED_OFF, NULL, NULL, NULL);
+  stream_start_capture (stream, callback, data);
+}
 
- leave:
-  callback (stream, cb_data->data);
+/* Like salut_stream_new(), but frames are rendered by @synth, which
+   the stream takes ownership of, instead of coming from the Kinect.
+   Frames are produced @fps times per second, or as fast as the
+   tracking consumes them if @fps is 0. */
+void
+salut_stream_new_synthetic (DepthSynth *synth,
+                            guint fps,
+                            void (*callback) (SalutStream *, gpointer),
+                            gpointer data)
+{
+  SalutStream *stream;
 
-  g_slice_free (CallbackData, cb_data);
+  g_assert (callback != NULL);
+
+  stream = stream_new (1);
+  depth_capture_set_synth (stream->active_sensor->capture, synth, fps);
+
+  stream_start_capture (stream, callback, data);
 }
 
-void
-salut_stream_new (void (*callback) (SalutStream *, gpointer), gpointer data)
+/* Records the frames of the first sensor only */
+gboolean
+salut_stream_start_recording (SalutStream *self,
+                              const gchar *path,
+                              gboolean compress,
+                              GError **error)
 {
-  CallbackData *cb_data = g_slice_new (CallbackData);
-  cb_data->callback = callback;
-  cb_data->data = data;
+  g_return_val_if_fail (self != NULL, FALSE);
 
-  gfreenect_device_new (0,
-                        GFREENECT_SUBDEVICE_CAMERA,
-                        NULL,
-                        on_new_device,
-                        cb_data);
+  return depth_capture_start_recording (self->sensors[0]->capture,
+                                        path,
+                                        compress,
+                                        error);
 }
 
 void
@@ -355,6 +1450,8 @@ salut_stream_start (SalutStream *self)
     return;
 
   self->tracking = TRUE;
+
+  update_capture (self);
 }
 
 void
@@ -366,34 +1463,86 @@ salut_stream_stop (SalutStream *self)
   self->tracking = FALSE;
 
   self->status = SALUT_STREAM_NO_PERSON;
+  depth_presence_reset (self->presence);
+
+  visitors_leave (self);
+
+  update_capture (self);
 }
 
 void
 salut_stream_free (SalutStream *self)
 {
+  SalutVisitor *visitor;
+  guint i;
+
   if (self == NULL)
     return;
 
-  if (self->buffer_info)
+  if (self->depth_frame_check_src_id != 0)
+    g_source_remove (self->depth_frame_check_src_id);
+  self->depth_frame_check_src_id = 0;
+
+  /* nothing new is tracked, nor is anyone told anything, from now on */
+  self->freed = TRUE;
+  self->tracking = FALSE;
+  for (i = 0; i < self->n_sensors; i++)
+    depth_capture_set_enabled (self->sensors[i]->capture, FALSE);
+
+  /* those whose jobs are still running are freed once they are
+     finished */
+  while ((visitor = g_queue_pop_head (&self->visitors)) != NULL)
     {
-      if (TRANSFORM_BUFFER)
-        {
-          guint width, height;
-          width = self->buffer_info->width;
-          height = self->buffer_info->height;
-          g_slice_free1 (width * height * sizeof (guint16),
-                         self->buffer_info->buffer);
-      }
-      g_slice_free (BufferInfo, self->buffer_info);
+      visitor->gone = TRUE;
+      visitor_drop_pending_frames (visitor);
+      if (g_queue_is_empty (&visitor->tracking_jobs))
+        visitor_free (visitor);
     }
 
-  if (self->device != NULL)
-    g_object_unref (self->device);
+  /* running jobs, of visitors who left before included, read frames
+     of the captures' rings and return their skeletons to the sensors,
+     so these are only freed once the last of them is finished */
+  if (self->n_tracking == 0)
+    stream_free (self);
+}
+
+/* Tracks only one frame out of every @interval while a skeleton is
+   being followed, the joints in the others being predicted from the
+   frames tracked before; gestures still get joints for every frame.
+   1, the default, tracks every frame. */
+void
+salut_stream_set_tracking_interval (SalutStream *self, guint interval)
+{
+  if (self == NULL)
+    return;
+
+  self->tracking_interval = MAX (interval, 1);
+}
+
+/* Number of frames of the active sensor tracked at once, each on a
+   skeleton of its own, 0 (the default) for one for every processor, 4
+   at most. Joints are still taken in the order frames were captured,
+   so more jobs track more frames rather than track them sooner. */
+void
+salut_stream_set_tracking_jobs (SalutStream *self, guint n_jobs)
+{
+  if (self == NULL)
+    return;
+
+  self->n_tracking_jobs = n_jobs;
+}
+
+/* Number of threads preprocessing the frames of every sensor, 0 (the
+   default) sharing the processors between all of the sensors */
+void
+salut_stream_set_preprocessing_threads (SalutStream *self, guint n_threads)
+{
+  if (self == NULL)
+    return;
 
-  if (self->skeleton != NULL)
-    g_object_unref (self->skeleton);
+  self->n_threads = n_threads;
 
-  g_slice_free (SalutStream, self);
+  update_capture (self);
 }
 
 void
@@ -420,6 +1569,109 @@ salut_stream_set_person_left_cb (SalutStream *self,
   self->person_left_scene_cb_data = data;
 }
 
+/* Called once a skeleton is found for someone new in view, who is
+   followed from then on, with their id */
+void
+salut_stream_set_visitor_entered_cb (SalutStream *self,
+                                     SalutStreamVisitorFunc visitor_entered_cb,
+                                     gpointer data)
+{
+  if (self == NULL)
+    return;
+
+  self->visitor_entered_cb = visitor_entered_cb;
+  self->visitor_entered_cb_data = data;
+}
+
+/* Called once a visitor who entered is no longer seen, or when nobody
+   is in view anymore */
+void
+salut_stream_set_visitor_left_cb (SalutStream *self,
+                                  SalutStreamVisitorFunc visitor_left_cb,
+                                  gpointer data)
+{
+  if (self == NULL)
+    return;
+
+  self->visitor_left_cb = visitor_left_cb;
+  self->visitor_left_cb_data = data;
+}
+
+/* Watches every visitor for @gesture, from scratch, while gestures
+   can be detected, calling @gesture_cb with the id of whoever did it */
+void
+salut_stream_set_gesture_to_track (SalutStream *self,
+                                   GestId gesture,
+                                   SalutStreamVisitorFunc gesture_cb,
+                                   gpointer data)
+{
+  GList *l;
+
+  if (self == NULL)
+    return;
+
+  self->gesture = gesture;
+  self->gesture_cb = gesture_cb;
+  self->gesture_cb_data = data;
+
+  for (l = self->visitors.head; l != NULL; l = l->next)
+    {
+      SalutVisitor *visitor = (SalutVisitor *) l->data;
+
+      salut_set_gesture_to_track (visitor->salut,
+                                  gesture,
+                                  on_visitor_gesture,
+                                  visitor);
+    }
+
+  update_capture (self);
+}
+
+/* Up to how many people in view are followed as visitors of their
+   own, each tracked on a skeleton of their own, in parallel, 4 at
+   most. With 1, the default, only the one nearest to the installation,
+   or already being followed, is; unless visitors are not isolated
+   (see salut_stream_set_visitor_isolation()), in which case everyone
+   is followed as one. */
+void
+salut_stream_set_max_visitors (SalutStream *self, guint max_visitors)
+{
+  if (self == NULL)
+    return;
+
+  self->max_visitors = CLAMP (max_visitors, 1, MAX_VISITORS);
+
+  update_capture (self);
+}
+
+/* Where the head of visitor @visitor_id was last seen, in the shared
+   scene. Returns FALSE if they are not followed. */
+gboolean
+salut_stream_get_visitor_head (SalutStream *self,
+                               guint visitor_id,
+                               SkeltrackJoint *head)
+{
+  GList *l;
+
+  if (self == NULL)
+    return FALSE;
+
+  for (l = self->visitors.head; l != NULL; l = l->next)
+    {
+      SalutVisitor *visitor = (SalutVisitor *) l->data;
+
+      if (visitor->id == visitor_id && visitor->entered)
+        {
+          *head = visitor->head;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* How often skeletons are looked for while someone is there but none
+   has been found for that long, in milliseconds */
 void
 salut_stream_set_person_lookup_seconds (SalutStream *self, gint msecs)
 {
@@ -436,6 +1688,79 @@ salut_stream_set_depth_threshold (SalutStream *self, guint threshold)
     return;
 
   self->depth_threshold = threshold;
+
+  update_capture (self);
+}
+
+/* Sets the time, in milliseconds, tracking a frame should take. The
+   dimension reduction is adapted to it as the load of the machine
+   varies. 0 keeps the dimension reduction fixed. */
+void
+salut_stream_set_tracking_budget (SalutStream *self, guint msecs)
+{
+  if (self == NULL)
+    return;
+
+  self->tracking_budget = msecs;
+  self->latency_sum = 0;
+  self->latency_samples = 0;
+}
+
+/* How blocks of depth pixels are reduced for tracking. Point
+   sampling, the default, is the cheapest; nearest keeps limbs that
+   are thinner than a block at high dimension reductions. */
+void
+salut_stream_set_sampling (SalutStream *self, DepthSampling sampling)
+{
+  if (self == NULL)
+    return;
+
+  self->sampling = sampling;
+
+  update_capture (self);
+}
+
+/* Whether frames go through a temporal filter, filling holes and
+   removing flicker (see depth-filter.c), before anything else.
+   Disabled by default. */
+void
+salut_stream_set_temporal_filter (SalutStream *self, gboolean filter)
+{
+  if (self == NULL)
+    return;
+
+  self->filter_depth = filter;
+
+  update_capture (self);
+}
+
+/* Whether what is learnt to be the empty scene, within the depth
+   threshold, is removed from the frames before tracking. Enabled by
+   default. */
+void
+salut_stream_set_background_subtraction (SalutStream *self,
+                                         gboolean subtract)
+{
+  if (self == NULL)
+    return;
+
+  self->subtract_background = subtract;
+
+  update_capture (self);
+}
+
+/* Whether only the visitor nearest to the installation, or the one
+   already being followed, is tracked when several people are in view,
+   rather than all of them as one. Enabled by default. */
+void
+salut_stream_set_visitor_isolation (SalutStream *self, gboolean isolate)
+{
+  if (self == NULL)
+    return;
+
+  self->isolate_visitor = isolate;
+
+  update_capture (self);
 }
 
 void
@@ -446,4 +1771,83 @@ salut_stream_set_can_detect_gesture (SalutStream *self,
     return;
 
   self->can_detect_gesture = can_detect_gesture;
+
+  update_capture (self);
+}
+
+/* Places @sensor in the shared scene, @offset millimetres along x from
+   the first one. Sensors are expected to face the same way. */
+void
+salut_stream_set_sensor_offset (SalutStream *self,
+                                guint sensor,
+                                gint offset)
+{
+  if (self == NULL || sensor >= self->n_sensors)
+    return;
+
+  self->sensors[sensor]->scene_offset = offset;
+}
+
+guint
+salut_stream_get_n_sensors (SalutStream *self)
+{
+  if (self == NULL)
+    return 0;
+
+  return self->n_sensors;
+}
+
+/* Frames per second @sensor sent, and the average time from capturing
+   a frame to its joints, in milliseconds, as of the last report, which
+   is made every few seconds */
+void
+salut_stream_get_sensor_stats (SalutStream *self,
+                               guint sensor,
+                               gdouble *frame_rate,
+                               gdouble *latency)
+{
+  if (self == NULL || sensor >= self->n_sensors)
+    return;
+
+  if (frame_rate != NULL)
+    *frame_rate = self->sensors[sensor]->frame_rate;
+  if (latency != NULL)
+    *latency = self->sensors[sensor]->latency;
+}
+
+/* totals over all sensors */
+void
+salut_stream_get_frame_stats (SalutStream *self,
+                              guint       *tracked,
+                              guint       *coalesced,
+                              guint       *cancelled,
+                              guint       *dropped)
+{
+  guint i;
+
+  if (self == NULL)
+    return;
+
+  if (tracked != NULL)
+    *tracked = 0;
+  if (coalesced != NULL)
+    *coalesced = 0;
+  if (cancelled != NULL)
+    *cancelled = 0;
+  if (dropped != NULL)
+    *dropped = 0;
+
+  for (i = 0; i < self->n_sensors; i++)
+    {
+      SalutSensor *sensor = self->sensors[i];
+
+      if (tracked != NULL)
+        *tracked += sensor->frames_tracked;
+      if (coalesced != NULL)
+        *coalesced += sensor->frames_coalesced;
+      if (cancelled != NULL)
+        *cancelled += sensor->frames_cancelled;
+      if (dropped != NULL)
+        *dropped += depth_capture_get_dropped_count (sensor->capture);
+    }
 }
@@ -27,9 +27,17 @@
 #include <gfreenect.h>
 #include <skeltrack.h>
 #include "salut.h"
+#include "depth-capture.h"
+#include "depth-presence.h"
 
 typedef struct _SalutStream SalutStream;
-typedef struct _BufferInfo BufferInfo;
+typedef struct _SalutSensor SalutSensor;
+
+/* visitors are told apart by an id, never 0, that stays theirs while
+   they are in view */
+typedef void (*SalutStreamVisitorFunc) (SalutStream *stream,
+                                        guint        visitor_id,
+                                        gpointer     data);
 
 typedef enum {
   SALUT_STREAM_NO_PERSON,
@@ -38,26 +46,64 @@ typedef enum {
 
 struct _SalutStream
 {
-  GFreenectDevice *device;
-  SkeltrackSkeleton *skeleton;
-  Salut *salut;
+  /* one for every depth device, visitors being tracked on the one
+     that sees them best */
+  SalutSensor **sensors;
+  guint n_sensors;
+  SalutSensor *active_sensor;
+  guint sensors_opening;
+
+  /* everyone followed in the frames of the active sensor, each with
+     their own skeleton and gesture state, oldest first */
+  GQueue visitors;
+  guint max_visitors;
+  guint last_visitor_id;
+
+  /* the gesture every visitor is watched for */
+  GestId gesture;
 
   guint depth_threshold;
-  BufferInfo *buffer_info;
-
+  guint dimension_factor;
+  DepthSampling sampling;
+  gboolean subtract_background;
+  gboolean filter_depth;
+  gboolean isolate_visitor;
+  guint n_threads;
+
+  /* whether someone is there comes from the foreground of the active
+     sensor, skeletons are only looked for meanwhile */
+  DepthPresence *presence;
   SalutStreamStatus status;
   gint lookup_interval;
-  gint64 last_skeleton_lookup_attempt;
-  gint64 last_skeleton_lookup_successful_attempt;
 
   gboolean can_detect_gesture;
   gboolean tracking;
 
+  /* frames tracked at once, and one of how many tracked at all */
+  guint n_tracking_jobs;
+  guint tracking_interval;
+
+  /* frames on a skeleton, those of visitors who left included; the
+     stream only goes once they are all finished, even if freed */
+  guint n_tracking;
+  gboolean freed;
+
+  /* the dimension reduction is adapted to keep tracking within budget */
+  guint tracking_budget;
+  gint64 latency_sum;
+  guint latency_samples;
+
   /* callbacks */
   void (*person_entered_scene_cb) (SalutStream *stream, gpointer data);
   void (*person_left_scene_cb) (SalutStream *stream, gpointer data);
   gpointer person_entered_scene_cb_data;
   gpointer person_left_scene_cb_data;
+  SalutStreamVisitorFunc visitor_entered_cb;
+  SalutStreamVisitorFunc visitor_left_cb;
+  SalutStreamVisitorFunc gesture_cb;
+  gpointer visitor_entered_cb_data;
+  gpointer visitor_left_cb_data;
+  gpointer gesture_cb_data;
 
   guint depth_frame_check_src_id;
 };
@@ -65,12 +111,51 @@ struct _SalutStream
 void salut_stream_new (void (*callback) (SalutStream *, gpointer),
                        gpointer user_data);
 
+void salut_stream_new_with_devices (guint n_devices,
+                                    gboolean disparity,
+                                    void (*callback) (SalutStream *, gpointer),
+                                    gpointer user_data);
+
+void salut_stream_new_from_recording (const gchar *path,
+                                      gboolean realtime,
+                                      void (*callback) (SalutStream *, gpointer),
+                                      gpointer user_data);
+
+void salut_stream_new_synthetic (DepthSynth *synth,
+                                 guint fps,
+                                 void (*callback) (SalutStream *, gpointer),
+                                 gpointer user_data);
+
 void salut_stream_free (SalutStream *self);
 
+gboolean salut_stream_start_recording (SalutStream *self,
+                                       const gchar *path,
+                                       gboolean compress,
+                                       GError **error);
+
 void salut_stream_set_person_lookup_seconds (SalutStream *self, gint msecs);
 
 void salut_stream_set_depth_threshold (SalutStream *self, guint threshold);
 
+void salut_stream_set_tracking_budget (SalutStream *self, guint msecs);
+
+void salut_stream_set_tracking_jobs (SalutStream *self, guint n_jobs);
+
+void salut_stream_set_tracking_interval (SalutStream *self, guint interval);
+
+void salut_stream_set_sampling (SalutStream *self, DepthSampling sampling);
+
+void salut_stream_set_temporal_filter (SalutStream *self, gboolean filter);
+
+void salut_stream_set_background_subtraction (SalutStream *self,
+                                              gboolean subtract);
+
+void salut_stream_set_visitor_isolation (SalutStream *self,
+                                         gboolean isolate);
+
+void salut_stream_set_preprocessing_threads (SalutStream *self,
+                                             guint n_threads);
+
 void salut_stream_set_person_entered_cb (SalutStream *self,
                                          void (*person_entered_cb) (SalutStream *, gpointer),
                                          gpointer data);
@@ -79,6 +164,25 @@ void salut_stream_set_person_left_cb (SalutStream *self,
                                       void (*person_left_cb) (SalutStream *, gpointer),
                                       gpointer data);
 
+void salut_stream_set_visitor_entered_cb (SalutStream *self,
+                                          SalutStreamVisitorFunc visitor_entered_cb,
+                                          gpointer data);
+
+void salut_stream_set_visitor_left_cb (SalutStream *self,
+                                       SalutStreamVisitorFunc visitor_left_cb,
+                                       gpointer data);
+
+void salut_stream_set_gesture_to_track (SalutStream *self,
+                                        GestId gesture,
+                                        SalutStreamVisitorFunc gesture_cb,
+                                        gpointer data);
+
+void salut_stream_set_max_visitors (SalutStream *self, guint max_visitors);
+
+gboolean salut_stream_get_visitor_head (SalutStream *self,
+                                        guint visitor_id,
+                                        SkeltrackJoint *head);
+
 void salut_stream_start (SalutStream *self);
 
 void salut_stream_stop (SalutStream *self);
@@ -86,4 +190,21 @@ void salut_stream_stop (SalutStream *self);
 void salut_stream_set_can_detect_gesture (SalutStream *self,
                                           gboolean can_detect_gesture);
 
+void salut_stream_set_sensor_offset (SalutStream *self,
+                                     guint sensor,
+                                     gint offset);
+
+guint salut_stream_get_n_sensors (SalutStream *self);
+
+void salut_stream_get_sensor_stats (SalutStream *self,
+                                    guint sensor,
+                                    gdouble *frame_rate,
+                                    gdouble *latency);
+
+void salut_stream_get_frame_stats (SalutStream *self,
+                                   guint *tracked,
+                                   guint *coalesced,
+                                   guint *cancelled,
+                                   guint *dropped);
+
 #endif /* __SALUT_STREAM_H__ */
@@ -28,41 +28,94 @@ static const guint THRESHOLD_END   = 1500;
 static const guint THRESHOLD_BEGIN = 500;
 
 #define HAND_BOX_SIZE 150.0
-#define USE_HANDS_IN_CURTSY TRUE
 
-static void
-empty_gesture_list (SkeltrackJoint **list, int length)
+/* names in the gesture table of the gestures made with the skeleton,
+   the hand poses being looked for below */
+static const gchar *gesture_names[TOTAL_GESTURES] =
 {
-  int l;
+  NULL,
+  "bow",
+  "kiss",
+  "curtsy",
+  "wave",
+  NULL,
+  NULL,
+  NULL
+};
 
-  if (list == NULL)
-    return;
-
-  for (l = 0; l < length; l++)
-    {
-      skeltrack_joint_free (list[l]);
-      list[l] = NULL;
-    }
+static void
+history_clear (SalutHistory *history)
+{
+  history->first = 0;
+  history->length = 0;
 }
 
+/* drops the samples from @length on */
 static void
-free_gesture_list (SkeltrackJoint **list, int length)
+history_truncate (SalutHistory *history, gint length)
 {
-  if (list == NULL)
-    return;
+  if (length < (gint) history->length)
+    history->length = MAX (length, 0);
+}
 
-  empty_gesture_list (list, length);
-  g_slice_free1 (length * sizeof (SkeltrackJoint), list);
+/* Copies the sample at @index, counted from the oldest, to @joint, but
+   its id. Returns FALSE if there is no such sample. */
+static gboolean
+history_get (const SalutHistory *history,
+             gint index,
+             SkeltrackJoint *joint)
+{
+  guint slot;
+
+  if (index < 0 || index >= (gint) history->length)
+    return FALSE;
+
+  slot = (history->first + index) % SALUT_HISTORY_SIZE;
+  joint->x = history->x[slot];
+  joint->y = history->y[slot];
+  joint->z = history->z[slot];
+  joint->screen_x = history->screen_x[slot];
+  joint->screen_y = history->screen_y[slot];
+
+  return TRUE;
 }
 
-static gfloat
-get_distance (SkeltrackJoint *a, SkeltrackJoint *b)
+static gint64
+history_get_timestamp (const SalutHistory *history, gint index)
 {
-  gfloat x, y, z;
-  x = a->x - b->x;
-  y = a->y - b->y;
-  z = a->z - b->z;
-  return sqrt (x * x + y * y + z * z);
+  return history->timestamp[(history->first + index) % SALUT_HISTORY_SIZE];
+}
+
+/* Replaces the sample at @index with @joint, or adds it after the
+   newest if @index is the number of samples */
+static void
+history_set (SalutHistory *history,
+             gint index,
+             const SkeltrackJoint *joint,
+             gint64 timestamp)
+{
+  guint slot;
+
+  g_return_if_fail (index >= 0 && index <= (gint) history->length);
+
+  if (index == (gint) history->length)
+    {
+      if (history->length == SALUT_HISTORY_SIZE)
+        {
+          history->first = (history->first + 1) % SALUT_HISTORY_SIZE;
+          history->length--;
+          index--;
+        }
+      history->length++;
+    }
+
+  slot = (history->first + index) % SALUT_HISTORY_SIZE;
+  history->x[slot] = joint->x;
+  history->y[slot] = joint->y;
+  history->z[slot] = joint->z;
+  history->screen_x[slot] = joint->screen_x;
+  history->screen_y[slot] = joint->screen_y;
+  history->timestamp[slot] = timestamp;
 }
 
 static gfloat
@@ -74,376 +127,385 @@ get_points_distance (CvPoint *a, CvPoint *b)
   return sqrt (x * x + y * y);
 }
 
-static void
-bow_gesture (Salut *self, SkeltrackJointList list)
-{
-  SkeltrackJoint *head, *previous_head;
+/* the coordinate at @axis bytes into @joint */
+#define JOINT_COORDINATE(joint, axis) G_STRUCT_MEMBER (gint, joint, axis)
 
-  if (list == NULL)
-    return;
+static gint
+get_sign (gint n)
+{
+  return n >= 0 ? 1 : -1;
+}
 
-  head = skeltrack_joint_list_get_joint (list, SKELTRACK_JOINT_ID_HEAD);
+static gboolean
+relation_holds (const GestureRelation *relation, SkeltrackJoint **slots)
+{
+  SkeltrackJoint *a, *b;
+  gfloat value, x, y, z;
 
-  if (head == NULL)
-    return;
+  a = slots[relation->a];
+  b = slots[relation->b];
 
-  previous_head = self->gesture_list[self->gesture_index];
-  if (previous_head != NULL)
+  switch (relation->measure)
     {
-      gfloat x, y, z, d;
-      gint dist = 100;
-      gint min_head_distance = 150;
-      x = previous_head->x - head->x;
-      y = previous_head->y - head->y;
-      z = previous_head->z - head->z;
-      d = sqrt (x * x + y * y + z * z);
+    case GESTURE_MEASURE_DIFFERENCE:
+      value = JOINT_COORDINATE (a, relation->axis) -
+        JOINT_COORDINATE (b, relation->axis);
+      break;
 
-      if (d >= dist)
-        {
-          if (ABS (previous_head->z - head->z) > 100 &&
-              previous_head->z > head->z &&
-              previous_head->screen_y < head->screen_y)
-            {
-              self->gesture_list[++self->gesture_index] =
-                skeltrack_joint_copy (head);
-            }
-          else if (sqrt (x * x + y * y) > min_head_distance ||
-                   (ABS (previous_head->z - head->z) > min_head_distance &&
-                    previous_head->z < head->z))
-            {
-              skeltrack_joint_free (self->gesture_list[self->gesture_index]);
-              self->gesture_list[self->gesture_index] = NULL;
-            }
-          if (self->gesture_index == 2)
-            {
-              if (self->callback != NULL)
-                self->callback(self->callback_data);
+    case GESTURE_MEASURE_ABSOLUTE_DIFFERENCE:
+      value = ABS (JOINT_COORDINATE (a, relation->axis) -
+                   JOINT_COORDINATE (b, relation->axis));
+      break;
 
-              for (; self->gesture_index >= 0; self->gesture_index--)
-                {
-                  skeltrack_joint_free (self->gesture_list[self->gesture_index]);
-                  self->gesture_list[self->gesture_index] = NULL;
-                }
-              self->gesture_index = 0;
-            }
-        }
-    }
-  else
-    {
-      self->gesture_list[self->gesture_index] = skeltrack_joint_copy (head);
-    }
+    case GESTURE_MEASURE_DISTANCE:
+      x = a->x - b->x;
+      y = a->y - b->y;
+      z = a->z - b->z;
+      value = x * x + y * y + z * z;
+      break;
 
-}
+    case GESTURE_MEASURE_PLANAR_DISTANCE:
+      x = a->x - b->x;
+      y = a->y - b->y;
+      value = x * x + y * y;
+      break;
 
-static void
-kiss_gesture          (Salut *self, SkeltrackJointList list)
-{
-  SkeltrackJoint *head, *left_hand, *right_hand, *hand, *previous_hand;
+    case GESTURE_MEASURE_CROSSED:
+      value =
+        get_sign (JOINT_COORDINATE (a, relation->axis) -
+                  JOINT_COORDINATE (b, relation->axis)) !=
+        get_sign (JOINT_COORDINATE (slots[relation->key_a], relation->axis) -
+                  JOINT_COORDINATE (slots[relation->key_b], relation->axis));
+      break;
 
-  if (list == NULL)
-    return;
+    default:
+      return FALSE;
+    }
 
-  head = skeltrack_joint_list_get_joint (list, SKELTRACK_JOINT_ID_HEAD);
-  right_hand = skeltrack_joint_list_get_joint (list,
-                                               SKELTRACK_JOINT_ID_RIGHT_HAND);
-  left_hand = skeltrack_joint_list_get_joint (list,
-                                              SKELTRACK_JOINT_ID_LEFT_HAND);
+  switch (relation->op)
+    {
+    case GESTURE_OP_LESS:
+      return value < relation->threshold;
 
-  hand = NULL;
-  previous_hand = NULL;
+    case GESTURE_OP_LESS_EQUAL:
+      return value <= relation->threshold;
 
-  if (head == NULL || (left_hand == NULL && right_hand == NULL))
-    {
-      for (self->gesture_index = 3;
-           self->gesture_index >= 0; self->gesture_index--)
-        {
-          skeltrack_joint_free (self->gesture_list[self->gesture_index]);
-          self->gesture_list[self->gesture_index] = NULL;
-        }
-      self->gesture_index = 0;
+    case GESTURE_OP_GREATER:
+      return value > relation->threshold;
 
-      return;
+    default:
+      return value >= relation->threshold;
     }
+}
 
-  if (right_hand == NULL)
-    hand = left_hand;
-  else if (left_hand == NULL)
-    hand = right_hand;
+static gboolean
+all_relations_hold (const GestureRecognizer *gesture,
+                    GestureRange             range,
+                    SkeltrackJoint         **slots)
+{
+  guint i;
 
-  if (hand == NULL)
+  for (i = range.start; i < range.end; i++)
     {
-      if (left_hand->y < right_hand->y)
-        hand = left_hand;
-      else
-        hand = right_hand;
+      if (! relation_holds (&gesture->relations[i], slots))
+        return FALSE;
     }
 
-  previous_hand = NULL;
-  if (self->gesture_index == 0)
-    {
-      if (self->gesture_list[0] == NULL)
-        {
-          self->gesture_list[0] = skeltrack_joint_copy (head);
-        }
-    }
-  else
-    {
-      previous_hand = self->gesture_list[self->gesture_index];
-    }
+  return TRUE;
+}
 
-  if (previous_hand == NULL)
-    {
-      guint initial_hand_head_max_dist = 400;
-      if (get_distance (hand, head) < initial_hand_head_max_dist)
-        {
-          self->gesture_index++;
-          self->gesture_list[self->gesture_index] = skeltrack_joint_copy (hand);
-        }
-    }
-  else
-    {
-      guint dist = get_distance (previous_hand, hand);
-      if ((dist > 200) && (dist < 500) && (hand->z < previous_hand->z))
-        {
-          self->gesture_list[++self->gesture_index] =
-            skeltrack_joint_copy (hand);
-        }
-    }
+static gboolean
+any_relation_holds (const GestureRecognizer *gesture,
+                    GestureRange             range,
+                    SkeltrackJoint         **slots)
+{
+  guint i;
 
-  if (self->gesture_index == -1 || self->gesture_index == 3)
+  for (i = range.start; i < range.end; i++)
     {
-      if (self->gesture_index == 3 && self->callback)
-        self->callback (self->callback_data);
-
-      for (self->gesture_index = 3;
-           self->gesture_index >= 0; self->gesture_index--)
-        {
-          skeltrack_joint_free (self->gesture_list[self->gesture_index]);
-          self->gesture_list[self->gesture_index] = NULL;
-        }
-      self->gesture_index = 0;
+      if (relation_holds (&gesture->relations[i], slots))
+        return TRUE;
     }
 
+  return FALSE;
 }
 
-static void
-curtsy_gesture (Salut *self, SkeltrackJointList list)
+/* Points the side slots at the joints of the side the gesture is
+   made with. Returns FALSE if there is none, with @missing set if it
+   is because no hand is seen at all; a side whose hand is seen but
+   not the other joints the gesture reads is out of pose instead. */
+static gboolean
+choose_side (const GestureRecognizer  *gesture,
+             SkeltrackJoint          **slots,
+             gboolean                 *missing)
 {
-  SkeltrackJoint *head, *left_hand, *right_hand, *left_elbow, *right_elbow;
+  static const guint8 side_joints[2][3] =
+    {
+      {
+        SKELTRACK_JOINT_ID_RIGHT_SHOULDER,
+        SKELTRACK_JOINT_ID_RIGHT_ELBOW,
+        SKELTRACK_JOINT_ID_RIGHT_HAND
+      },
+      {
+        SKELTRACK_JOINT_ID_LEFT_SHOULDER,
+        SKELTRACK_JOINT_ID_LEFT_ELBOW,
+        SKELTRACK_JOINT_ID_LEFT_HAND
+      }
+    };
+  SkeltrackJoint *chosen[3] = { NULL, NULL, NULL };
+  gboolean found = FALSE;
+  guint side, i;
 
-  if (list == NULL)
-    return;
+  *missing = TRUE;
 
-  head = skeltrack_joint_list_get_joint (list, SKELTRACK_JOINT_ID_HEAD);
-  right_hand = skeltrack_joint_list_get_joint (list,
-                                               SKELTRACK_JOINT_ID_RIGHT_HAND);
-  left_hand = skeltrack_joint_list_get_joint (list,
-                                              SKELTRACK_JOINT_ID_LEFT_HAND);
-  right_elbow = skeltrack_joint_list_get_joint (list,
-                                                SKELTRACK_JOINT_ID_RIGHT_ELBOW);
-  left_elbow = skeltrack_joint_list_get_joint (list,
-                                               SKELTRACK_JOINT_ID_LEFT_ELBOW);
+  for (side = 0; side < 2; side++)
+    {
+      gboolean complete = TRUE;
 
-  if (head == NULL || (left_hand == NULL || right_hand == NULL))
-    return;
+      if (slots[side_joints[side][2]] != NULL)
+        *missing = FALSE;
 
-  if (head)
-    {
-      /* Check if arms are in the correct pose,
-         if not, clean the list so far */
-      if (USE_HANDS_IN_CURTSY &&
-          (right_hand->y < head->y ||
-           left_hand->y < head->y ||
-           right_hand->x > right_elbow->x ||
-           left_hand->x < left_elbow->x))
+      for (i = 0; i < 3; i++)
         {
-          for (; self->gesture_index >= 0; self->gesture_index--)
-            {
-              skeltrack_joint_free (self->gesture_list[self->gesture_index]);
-              self->gesture_list[self->gesture_index] = NULL;
-            }
-          self->gesture_index = 0;
+          slots[GESTURE_SLOT_SHOULDER + i] = slots[side_joints[side][i]];
+          if (slots[GESTURE_SLOT_SHOULDER + i] == NULL &&
+              (gesture->needed & (1 << (GESTURE_SLOT_SHOULDER + i))))
+            complete = FALSE;
         }
 
-      SkeltrackJoint *previous_head = self->gesture_list[self->gesture_index];
-      if (previous_head != NULL)
-        {
-          gfloat x, y, z, d;
-          gint dist_with_previous_head = 150;
-          gint min_head_movement = 100;
-          x = previous_head->x - head->x;
-          y = previous_head->y - head->y;
-          z = previous_head->z - head->z;
-          d = sqrt (x * x + y * y + z * z);
-
-          if (d >= dist_with_previous_head)
-            {
-              if (ABS (previous_head->z - head->z) < min_head_movement &&
-                  ABS (previous_head->y - head->y) > min_head_movement)
-                {
-                  /* Movement reached lowest point (initial movement) */
-                  if (self->gesture_index == 0 && previous_head->y < head->y)
-                    {
-                      self->gesture_list[++self->gesture_index] =
-                        skeltrack_joint_copy (head);
-                    }
-                  /* Movement went back up (final movement) */
-                  else if (self->gesture_index == 1 &&
-                           previous_head->y > head->y)
-                    {
-                      self->gesture_list[++self->gesture_index] =
-                        skeltrack_joint_copy (head);
-                    }
-                }
-              else
-                {
-                  skeltrack_joint_free (self->gesture_list[self->gesture_index]);
-                  self->gesture_list[self->gesture_index] = NULL;
-
-                  if (self->gesture_index > 0)
-                    self->gesture_index--;
+      if (! complete)
+        continue;
 
-                  self->gesture_list[self->gesture_index] =
-                    skeltrack_joint_copy (head);
-                }
+      if (! all_relations_hold (gesture, gesture->side_requires, slots))
+        continue;
 
-              if (self->gesture_index == 2)
-                {
-                  if (self->callback != NULL)
-                    self->callback(self->callback_data);
-
-                  for (; self->gesture_index >= 0; self->gesture_index--)
-                    {
-                      skeltrack_joint_free (self->gesture_list[self->gesture_index]);
-                      self->gesture_list[self->gesture_index] = NULL;
-                    }
-                  self->gesture_index = 0;
-                }
-            }
-        }
-      else
+      /* the right one is kept if both are as high */
+      if (! found ||
+          (gesture->side == GESTURE_SIDE_UPPER &&
+           slots[GESTURE_SLOT_HAND]->y < chosen[2]->y))
         {
-          self->gesture_list[self->gesture_index] = skeltrack_joint_copy (head);
+          for (i = 0; i < 3; i++)
+            chosen[i] = slots[GESTURE_SLOT_SHOULDER + i];
+          found = TRUE;
         }
+
+      if (gesture->side == GESTURE_SIDE_FIRST)
+        break;
     }
+
+  for (i = 0; i < 3; i++)
+    slots[GESTURE_SLOT_SHOULDER + i] = chosen[i];
+
+  return found;
 }
 
+/* The history holds the joints of every keyframe so far, one after
+   the other, those of the current keyframe being the last unless it
+   is to be recorded again. */
 static gboolean
-can_wave_hello (SkeltrackJoint *hand, SkeltrackJoint *elbow)
+keyframe_is_recorded (Salut *self, const GestureRecognizer *gesture)
 {
-  return hand != NULL && elbow != NULL &&
-    hand->y < elbow->y && ABS (hand->y - elbow->y) > 100;
+  return self->history.length > self->gesture_index * gesture->n_joints;
 }
 
-static gint
-get_sign (gint n)
+static void
+record_keyframe (Salut                    *self,
+                 const GestureRecognizer  *gesture,
+                 SkeltrackJoint          **slots,
+                 gint64                    timestamp)
 {
-  return n >= 0 ? 1 : -1;
+  guint i;
+
+  for (i = 0; i < gesture->n_joints; i++)
+    {
+      history_set (&self->history,
+                   self->gesture_index * gesture->n_joints + i,
+                   slots[gesture->joints[i]],
+                   timestamp);
+    }
 }
 
 static void
-hello_gesture (Salut *self, SkeltrackJointList list)
+apply_action (Salut                    *self,
+              const GestureRecognizer  *gesture,
+              GestureAction             action,
+              SkeltrackJoint          **slots,
+              gint64                    timestamp)
 {
-  SkeltrackJoint *head, *left_hand, *left_elbow,
-    *right_hand, *right_elbow, *elbow = NULL, *hand = NULL;
+  switch (action)
+    {
+    case GESTURE_ACTION_IGNORE:
+      break;
+
+    case GESTURE_ACTION_RESET:
+      history_clear (&self->history);
+      self->gesture_index = 0;
+      break;
+
+    case GESTURE_ACTION_DROP:
+      history_truncate (&self->history, self->gesture_index * gesture->n_joints);
+      break;
+
+    case GESTURE_ACTION_BACK:
+    case GESTURE_ACTION_REBASE:
+      if (! keyframe_is_recorded (self, gesture))
+        break;
+
+      history_truncate (&self->history, self->gesture_index * gesture->n_joints);
+      if (self->gesture_index > 0)
+        self->gesture_index--;
+
+      if (action == GESTURE_ACTION_REBASE)
+        record_keyframe (self, gesture, slots, timestamp);
+      break;
+    }
+}
+
+/* Runs a frame through the tables of the gesture being tracked. */
+static void
+track_gesture (Salut *self, SkeltrackJointList list, gint64 timestamp)
+{
+  const GestureRecognizer *gesture = self->gesture;
+  const GestureStep *step;
+  SkeltrackJoint *slots[GESTURE_N_SLOTS];
+  SkeltrackJoint keys[GESTURE_MAX_JOINTS];
+  gboolean missing;
+  guint i;
 
   if (list == NULL)
     return;
 
-  head = skeltrack_joint_list_get_joint (list, SKELTRACK_JOINT_ID_HEAD);
-  right_hand = skeltrack_joint_list_get_joint (list,
-                                               SKELTRACK_JOINT_ID_RIGHT_HAND);
-  left_hand = skeltrack_joint_list_get_joint (list,
-                                              SKELTRACK_JOINT_ID_LEFT_HAND);
-  right_elbow = skeltrack_joint_list_get_joint (list,
-                                                SKELTRACK_JOINT_ID_RIGHT_ELBOW);
-  left_elbow = skeltrack_joint_list_get_joint (list,
-                                               SKELTRACK_JOINT_ID_LEFT_ELBOW);
+  for (i = 0; i < SKELTRACK_JOINT_MAX_JOINTS; i++)
+    {
+      slots[i] = skeltrack_joint_list_get_joint (list, i);
+      if (slots[i] == NULL && (gesture->needed & (1 << i)))
+        {
+          apply_action (self, gesture, gesture->on_missing, slots, timestamp);
+          return;
+        }
+    }
 
-  if (head == NULL || (left_hand == NULL && right_hand == NULL))
-    return;
+  if (gesture->side != GESTURE_SIDE_NONE &&
+      ! choose_side (gesture, slots, &missing))
+    {
+      apply_action (self,
+                    gesture,
+                    missing ? gesture->on_missing : gesture->on_pose_lost,
+                    slots,
+                    timestamp);
+      return;
+    }
 
-  if (can_wave_hello (right_hand, right_elbow))
+  /* the gesture goes on from this frame */
+  if (! all_relations_hold (gesture, gesture->requires, slots))
     {
-      hand = right_hand;
-      elbow = right_elbow;
+      if (gesture->on_pose_lost == GESTURE_ACTION_IGNORE)
+        return;
+
+      apply_action (self, gesture, gesture->on_pose_lost, slots, timestamp);
     }
-  else if (can_wave_hello (left_hand, left_elbow))
+
+  if (gesture->timeout > 0 &&
+      self->history.length > 0 &&
+      timestamp - history_get_timestamp (&self->history,
+                                         self->history.length - 1) > gesture->timeout)
     {
-      hand = left_hand;
-      elbow = left_elbow;
+      apply_action (self, gesture, GESTURE_ACTION_RESET, slots, timestamp);
     }
 
-  if (hand && elbow)
+  if (! keyframe_is_recorded (self, gesture))
+    record_keyframe (self, gesture, slots, timestamp);
+
+  for (i = 0; i < gesture->n_joints; i++)
     {
-      SkeltrackJoint *previous_hand = self->gesture_list[self->gesture_index];
-      SkeltrackJoint *previous_elbow =
-        self->gesture_list[self->gesture_index + 1];
+      history_get (&self->history,
+                   self->gesture_index * gesture->n_joints + i,
+                   &keys[i]);
+      slots[GESTURE_SLOT_KEY + i] = &keys[i];
+    }
 
-      /* Check if the hand has moved beyond the X coord of the elbow
-         (in comparison with the previous values) */
-      if (previous_hand == NULL ||
-          get_sign (previous_hand->x - previous_elbow->x) !=
-          get_sign (hand->x - elbow->x))
-        {
-          if (previous_hand)
-            self->gesture_index += 2;
+  step = &gesture->steps[self->gesture_index];
+  if (! all_relations_hold (gesture, step->gate, slots))
+    return;
 
-          self->gesture_list[self->gesture_index] =
-            skeltrack_joint_copy (hand);
-          self->gesture_list[self->gesture_index + 1] =
-            skeltrack_joint_copy (elbow);
-        }
+  if (all_relations_hold (gesture, step->advance, slots))
+    {
+      self->gesture_index++;
 
-      if (self->gesture_index == 8)
+      if (self->gesture_index < (gint) gesture->n_steps)
         {
-          gint i;
-          for (i = 0; i <= self->gesture_index; i += 2)
-            {
-              hand = self->gesture_list[i];
-              elbow = self->gesture_list[i + 1];
-              skeltrack_joint_free (hand);
-              skeltrack_joint_free (elbow);
-              self->gesture_list[i] = NULL;
-              self->gesture_list[i + 1] = NULL;
-            }
+          record_keyframe (self, gesture, slots, timestamp);
+        }
+      else
+        {
+          history_clear (&self->history);
+          self->gesture_index = 0;
 
           if (self->callback != NULL)
-            self->callback (self->callback);
-
-          self->gesture_index = 0;
+            self->callback (self->callback_data);
         }
     }
-  else if (self->gesture_list[self->gesture_index])
+  else if (any_relation_holds (gesture, step->brk, slots))
     {
-      skeltrack_joint_free(self->gesture_list[self->gesture_index + 1]);
-      self->gesture_list[self->gesture_index + 1] = NULL;
-      skeltrack_joint_free(self->gesture_list[self->gesture_index]);
-      self->gesture_list[self->gesture_index] = NULL;
-
-      if (self->gesture_index > 0)
-        self->gesture_index-=2;
+      apply_action (self, gesture, gesture->on_break, slots, timestamp);
     }
 }
 
+/* the part of the @size x @size box centred at (@x, @y) within a
+   @width x @height image */
+static void
+clip_box (gint  x,
+          gint  y,
+          gint  size,
+          gint  width,
+          gint  height,
+          gint *left,
+          gint *top,
+          gint *right,
+          gint *bottom)
+{
+  *left = MAX (x - size / 2, 0);
+  *right = MIN (x + size / 2, width);
+  *top = MAX (y - size / 2, 0);
+  *bottom = MIN (y + size / 2, height);
+}
+
+/* Looks for the nearest point around the hand joint, then for the
+   centre of what is about as near, and cuts a box around it. Both
+   searches run on coarser levels of the pyramid: the nearest point
+   on the coarsest, whose pixels already hold the nearest depth of
+   their block, refined within that block only, and the centre on the
+   1/2 level. Only the box itself is read at full resolution, and of
+   it only the depth of the pixels the frame's mask has. The box is
+   drawn in the hand image of @self, which is returned. */
 static IplImage *
-segment_hand (guint16 *buffer,
-              guint width,
-              guint height,
+segment_hand (Salut *self,
+              const DepthPyramid *pyramid,
+              const DepthMask *mask,
               guint hand_x,
               guint hand_y,
               guint hand_z)
 {
-
+  const DepthView *depth, *level_view;
+  DepthBox box;
   IplImage* image;
   CvSize size;
   gfloat scale;
-  gint box_size;
-  guint i, j, x_left, x_right, y_top, y_bottom, counter, avg_x, avg_y;
+  gint box_size, level;
+  gint i, j, x_left, x_right, y_top, y_bottom;
+  gint x, y, nearest_x, nearest_y, avg_x, avg_y, counter;
+  gint width, height;
 
-  if (buffer == NULL)
+  if (pyramid == NULL || mask == NULL)
     return NULL;
 
+  depth = depth_pyramid_get_level (pyramid, 0);
+  if (depth->data == NULL || mask->bits == NULL)
+    return NULL;
+
+  width = depth->width;
+  height = depth->height;
+
   scale = ((gfloat)(THRESHOLD_END - THRESHOLD_BEGIN)) / (hand_z * .8);
   box_size = round(HAND_BOX_SIZE * scale);
   box_size -= box_size % 4;
@@ -451,65 +513,111 @@ segment_hand (guint16 *buffer,
   if (box_size > width || box_size == 0)
     return NULL;
 
-  avg_x = 0;
-  avg_y = 0;
-  counter = 0;
-  x_left = MAX (hand_x - box_size / 2, 0);
-  x_right = MIN (hand_x + box_size / 2, width);
-  y_top = MAX (hand_y - box_size / 2, 0);
-  y_bottom = MIN (hand_y + box_size / 2, height);
+  x = hand_x;
+  y = hand_y;
+
+  /* nothing around the hand, so no contour to find */
+  box.x = x - box_size / 2;
+  box.y = y - box_size / 2;
+  box.width = box_size;
+  box.height = box_size;
+  if (depth_mask_count_box (mask, &box) == 0)
+    return NULL;
 
-  for (i = x_left; i < x_right; i += 2)
-    for (j = y_top; j < y_bottom; j += 2)
+  /* nearest point */
+  level = DEPTH_PYRAMID_LEVELS - 1;
+  level_view = depth_pyramid_get_level (pyramid, level);
+  clip_box (x >> level, y >> level, box_size >> level,
+            level_view->width, level_view->height,
+            &x_left, &y_top, &x_right, &y_bottom);
+
+  nearest_x = -1;
+  nearest_y = -1;
+  for (i = x_left; i < x_right; i++)
+    for (j = y_top; j < y_bottom; j++)
       {
-        guint16 value = buffer[width * j + i];
+        guint16 value = depth_view_get (level_view, i, j);
         if (value < THRESHOLD_END && value > THRESHOLD_BEGIN && value < hand_z)
           {
-            hand_x = i;
-            hand_y = j;
+            nearest_x = i;
+            nearest_y = j;
             hand_z = value;
           }
       }
 
-  x_left = MAX (hand_x - box_size / 2, 0);
-  x_right = MIN (hand_x + box_size / 2, width);
-  y_top = MAX (hand_y - box_size / 2, 0);
-  y_bottom = MIN (hand_y + box_size / 2, height);
+  if (nearest_x >= 0)
+    {
+      gboolean found = FALSE;
+
+      for (i = nearest_x << level; ! found && i < MIN ((nearest_x + 1) << level, width); i++)
+        for (j = nearest_y << level; ! found && j < MIN ((nearest_y + 1) << level, height); j++)
+          {
+            if (depth_view_get (depth, i, j) == hand_z)
+              {
+                x = i;
+                y = j;
+                found = TRUE;
+              }
+          }
+    }
+
+  /* centre of what is about as near */
+  level = 1;
+  level_view = depth_pyramid_get_level (pyramid, level);
+  clip_box (x >> level, y >> level, box_size >> level,
+            level_view->width, level_view->height,
+            &x_left, &y_top, &x_right, &y_bottom);
 
-  for (i = x_left; i < x_right; i += 2)
-    for (j = y_top; j < y_bottom; j += 2)
+  avg_x = 0;
+  avg_y = 0;
+  counter = 0;
+  for (i = x_left; i < x_right; i++)
+    for (j = y_top; j < y_bottom; j++)
       {
-        guint16 value = buffer[width * j + i];
-        if (value > THRESHOLD_BEGIN && value < THRESHOLD_END && ABS (value - hand_z) < 150)
+        gint value = depth_view_get (level_view, i, j);
+        if (value > THRESHOLD_BEGIN && value < THRESHOLD_END &&
+            ABS (value - (gint) hand_z) < 150)
           {
             counter++;
-            avg_x += i;
-            avg_y += j;
+            avg_x += i << level;
+            avg_y += j << level;
           }
       }
 
   if (counter > 0)
     {
-      avg_x /= counter;
-      avg_y /= counter;
+      x = avg_x / counter;
+      y = avg_y / counter;
     }
 
-  x_left = MAX (avg_x - box_size / 2, 0);
-  x_right = MIN (avg_x + box_size / 2, width);
-  y_top = MAX (avg_y - box_size / 2, 0);
-  y_bottom = MIN (avg_y + box_size / 2, height);
+  clip_box (x, y, box_size, width, height,
+            &x_left, &y_top, &x_right, &y_bottom);
 
-  size.width = box_size;
-  size.height = box_size;
-  image = cvCreateImage (size, IPL_DEPTH_8U, 1);
+  /* the box only changes size with the distance to the hand */
+  if (self->hand_image == NULL || self->hand_image->width != box_size)
+    {
+      if (self->hand_image != NULL)
+        {
+          cvReleaseImage (&self->hand_image);
+          cvReleaseImage (&self->hand_scratch);
+        }
+
+      size.width = box_size;
+      size.height = box_size;
+      self->hand_image = cvCreateImage (size, IPL_DEPTH_8U, 1);
+      self->hand_scratch = cvCreateImage (size, IPL_DEPTH_8U, 1);
+    }
+  image = self->hand_image;
 
   for (i = 0; i < image->width; i ++)
     for (j = 0; j < image->height; j ++)
       {
-        if ((i + x_left) < width && (j + y_top) < height)
+        if ((i + x_left) < width && (j + y_top) < height &&
+            depth_mask_get (mask, x_left + i, y_top + j))
           {
-            guint16 value = buffer[width * (y_top + j) + (x_left + i)];
-            if (value > THRESHOLD_BEGIN && value < THRESHOLD_END && ABS (value - hand_z) < 150)
+            gint value = depth_view_get (depth, x_left + i, y_top + j);
+            if (value > THRESHOLD_BEGIN && value < THRESHOLD_END &&
+                ABS (value - (gint) hand_z) < 150)
               {
                 image->imageData[image->width * j + i] = (uchar) 255;
                 continue;
@@ -605,10 +713,11 @@ defects_are_horizontal (CvSeq *defects)
   return TRUE;
 }
 
+/* The defects found are valid until the next call */
 static CvSeq *
-get_defects (guint16* depth,
-             guint width,
-             guint height,
+get_defects (Salut *self,
+             const DepthPyramid *depth,
+             const DepthMask *mask,
              guint start_x,
              guint start_y,
              guint start_z)
@@ -617,11 +726,10 @@ get_defects (guint16* depth,
   IplImage *image = NULL;
   CvSeq *points = NULL;
   CvSeq *contours = NULL;
-  CvMemStorage *g_storage, *hull_storage;
 
-  img = segment_hand (depth,
-                      width,
-                      height,
+  img = segment_hand (self,
+                      depth,
+                      mask,
                       start_x,
                       start_y,
                       start_z);
@@ -631,20 +739,25 @@ get_defects (guint16* depth,
       return NULL;
     }
 
-  image = cvCreateImage(cvGetSize(img), 8, 1);
+  image = self->hand_scratch;
   cvCopy(img, image, 0);
   cvSmooth(image, img, CV_MEDIAN, 7, 0, 0, 0);
   cvThreshold(img, image, 150, 255, CV_THRESH_OTSU);
-  g_storage = cvCreateMemStorage (0);
-  cvFindContours (image, g_storage, &contours, sizeof(CvContour),
+
+  /* the contours, their hull and its defects all go in the same
+     storage, whose memory is reused from frame to frame */
+  if (self->hand_storage == NULL)
+    self->hand_storage = cvCreateMemStorage (0);
+  else
+    cvClearMemStorage (self->hand_storage);
+  cvFindContours (image, self->hand_storage, &contours, sizeof(CvContour),
                   CV_RETR_EXTERNAL,
                   CV_CHAIN_APPROX_SIMPLE,
                   cvPoint(0,0));
-  hull_storage = cvCreateMemStorage(0);
 
   if (contours)
     {
-      points = cvConvexHull2(contours, hull_storage, CV_CLOCKWISE, 0);
+      points = cvConvexHull2(contours, self->hand_storage, CV_CLOCKWISE, 0);
       return cvConvexityDefects (contours, points, NULL);
     }
 
@@ -652,9 +765,9 @@ get_defects (guint16* depth,
 }
 
 static CvSeq *
-get_finger_defects (guint16* depth,
-                    guint width,
-                    guint height,
+get_finger_defects (Salut *self,
+                    const DepthPyramid *depth,
+                    const DepthMask *mask,
                     SkeltrackJointList list)
 {
   CvSeq *defects = NULL;
@@ -692,9 +805,9 @@ get_finger_defects (guint16* depth,
     return NULL;
 
 
-  defects = get_defects (depth,
-                         width,
-                         height,
+  defects = get_defects (self,
+                         depth,
+                         mask,
                          hand->screen_x,
                          hand->screen_y,
                          hand->z);
@@ -722,9 +835,9 @@ get_finger_defects (guint16* depth,
 }
 
 static gboolean
-hands_are_praying (guint16* depth,
-                   guint width,
-                   guint height,
+hands_are_praying (Salut *self,
+                   const DepthPyramid *depth,
+                   const DepthMask *mask,
                    SkeltrackJointList list)
 {
   guint x, y, z;
@@ -756,7 +869,7 @@ hands_are_praying (guint16* depth,
   y = right_elbow->screen_y;
   z = ((gfloat) (right_shoulder->z + left_shoulder->z)) / 2.0 - 300;
 
-  defects = get_defects (depth, width, height, x, y, z);
+  defects = get_defects (self, depth, mask, x, y, z);
 
   if (defects)
     {
@@ -841,9 +954,8 @@ hands_are_praying (guint16* depth,
 
 static void
 hands_pose (Salut *self,
-            guint16* depth,
-            guint width,
-            guint height,
+            const DepthPyramid *depth,
+            const DepthMask *mask,
             SkeltrackJointList list)
 {
   CvSeq *defects;
@@ -851,7 +963,7 @@ hands_pose (Salut *self,
   switch (self->gest_id)
     {
     case HAND_METAL:
-      defects = get_finger_defects (depth, width, height, list);
+      defects = get_finger_defects (self, depth, mask, list);
       if (defects == NULL)
         self->gesture_index = 0;
       else if (defects->total == 1)
@@ -859,7 +971,7 @@ hands_pose (Salut *self,
       break;
 
     case HAND_EAST_COAST:
-      defects = get_finger_defects (depth, width, height, list);
+      defects = get_finger_defects (self, depth, mask, list);
       if (defects == NULL)
         self->gesture_index = 0;
       else if (defects->total == 2 && defects_are_horizontal (defects))
@@ -867,7 +979,7 @@ hands_pose (Salut *self,
       break;
 
     case HAND_INDIAN:
-      if (hands_are_praying  (depth, width, height, list))
+      if (hands_are_praying (self, depth, mask, list))
         self->gesture_index++;
       break;
 
@@ -890,101 +1002,104 @@ salut_new (void)
   salut->gest_id = NONE;
   salut->callback = NULL;
   salut->callback_data = NULL;
-  salut->gesture_list_length = 0;
-  salut->gesture_list = NULL;
+  salut->gesture = NULL;
+  history_clear (&salut->history);
   salut->gesture_index = 0;
+  salut->hand_image = NULL;
+  salut->hand_scratch = NULL;
+  salut->hand_storage = NULL;
 
   return salut;
 }
 
+void
+salut_free (Salut *self)
+{
+  if (self == NULL)
+    return;
+
+  if (self->hand_image != NULL)
+    {
+      cvReleaseImage (&self->hand_image);
+      cvReleaseImage (&self->hand_scratch);
+    }
+  if (self->hand_storage != NULL)
+    cvReleaseMemStorage (&self->hand_storage);
+
+  g_slice_free (Salut, self);
+}
+
 void
 salut_set_gesture_to_track (Salut *self,
                             GestId id,
                             void (*callback) (gpointer),
                             gpointer callback_data)
 {
-  if (self->gest_id == id)
-    empty_gesture_list (self->gesture_list, self->gesture_list_length);
-  else
-    {
-      free_gesture_list (self->gesture_list, self->gesture_list_length);
-      self->gesture_list = NULL;
-      self->gesture_list_length = 0;
-    }
+  history_clear (&self->history);
   self->gesture_index = 0;
 
-  switch (id)
+  self->gest_id = id;
+  self->gesture = NULL;
+  if (id > NONE && id < TOTAL_GESTURES && gesture_names[id] != NULL)
     {
-    case NONE:
-    case TOTAL_GESTURES:
-    case HAND_METAL:
-    case HAND_EAST_COAST:
-    case HAND_INDIAN:
-      break;
-
-    case BOW:
-      self->gesture_list_length = 3;
-      self->gesture_list =
-        g_slice_alloc0 (self->gesture_list_length * sizeof (SkeltrackJoint));
-      break;
-
-    case HAND_WAVE:
-      self->gesture_list_length = 6;
-      self->gesture_list =
-        g_slice_alloc0 (self->gesture_list_length * sizeof (SkeltrackJoint));
-      break;
-
-    case CURTSY:
-      self->gesture_list_length = 2;
-      self->gesture_list =
-        g_slice_alloc0 (self->gesture_list_length * sizeof (SkeltrackJoint));
-      break;
-
-    case KISS:
-      self->gesture_list_length = 3;
-      self->gesture_list =
-        g_slice_alloc0 (self->gesture_list_length * sizeof (SkeltrackJoint));
-      break;
+      self->gesture = gesture_table_lookup (gesture_table_get_default (),
+                                            gesture_names[id]);
     }
-
-  self->gest_id = id;
   self->callback = callback;
   self->callback_data = callback_data;
 }
 
+/* Tracks @gesture, from a GestureTable, rather than a GestId. */
+void
+salut_set_gesture (Salut *self,
+                   const GestureRecognizer *gesture,
+                   void (*callback) (gpointer),
+                   gpointer callback_data)
+{
+  salut_set_gesture_to_track (self, NONE, callback, callback_data);
+  self->gesture = gesture;
+}
+
+/* @depth and @mask may be NULL, for frames whose joints were only
+   predicted, in which case hand poses are not looked at */
 void
 salut_set_track_data (Salut *self,
-                      guint16 *depth,
-                      guint width,
-                      guint height,
-                      SkeltrackJointList list)
+                      const DepthPyramid *depth,
+                      const DepthMask *mask,
+                      SkeltrackJointList list,
+                      gint64 timestamp)
 {
-  switch (self->gest_id)
+  if (self->gesture != NULL)
     {
-    case NONE:
-    case TOTAL_GESTURES:
-      break;
-
-    case BOW:
-      bow_gesture (self, list);
-      break;
-
-    case KISS:
-      kiss_gesture (self, list);
-      break;
+      track_gesture (self, list, timestamp);
+      return;
+    }
 
-    case CURTSY:
-      curtsy_gesture (self, list);
+  switch (self->gest_id)
+    {
+    case HAND_METAL:
+    case HAND_EAST_COAST:
+    case HAND_INDIAN:
+      if (depth != NULL)
+        hands_pose (self, depth, mask, list);
       break;
 
-    case HAND_WAVE:
-      hello_gesture (self, list);
+    default:
       break;
+    }
+}
 
+gboolean
+salut_needs_depth (Salut *self)
+{
+  switch (self->gest_id)
+    {
     case HAND_METAL:
     case HAND_EAST_COAST:
     case HAND_INDIAN:
-      hands_pose (self, depth, width, height, list);
-      break;
+      return TRUE;
+
+    default:
+      return FALSE;
     }
 }
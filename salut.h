@@ -26,6 +26,9 @@
 
 #include <skeltrack-joint.h>
 #include <glib.h>
+#include "depth-mask.h"
+#include "depth-pyramid.h"
+#include "gesture-table.h"
 #include <opencv2/imgproc/imgproc_c.h>
 #include <opencv2/highgui/highgui_c.h>
 
@@ -43,15 +46,38 @@ typedef enum
   TOTAL_GESTURES
 } GestId;
 
+/* the joints recorded at the keyframes of the gesture, in a ring of
+   at most SALUT_HISTORY_SIZE samples, the oldest being dropped */
+#define SALUT_HISTORY_SIZE GESTURE_MAX_SAMPLES
+
+typedef struct
+{
+  gint x[SALUT_HISTORY_SIZE];
+  gint y[SALUT_HISTORY_SIZE];
+  gint z[SALUT_HISTORY_SIZE];
+  gint screen_x[SALUT_HISTORY_SIZE];
+  gint screen_y[SALUT_HISTORY_SIZE];
+  gint64 timestamp[SALUT_HISTORY_SIZE];
+
+  /* slot of the oldest sample */
+  guint first;
+  guint length;
+} SalutHistory;
+
 typedef struct
 {
   GestId gest_id;
+  const GestureRecognizer *gesture;
   void (*callback) (gpointer data);
   gpointer callback_data;
 
-  SkeltrackJoint **gesture_list;
+  SalutHistory history;
   gint gesture_index;
-  gint gesture_list_length;
+
+  /* kept from frame to frame by the hand poses */
+  IplImage *hand_image;
+  IplImage *hand_scratch;
+  CvMemStorage *hand_storage;
 } Salut;
 
 typedef struct
@@ -65,15 +91,24 @@ typedef struct
 
 Salut*  salut_new                     (void);
 
+void    salut_free                    (Salut *self);
+
 void    salut_set_gesture_to_track    (Salut *self,
                                        GestId id,
                                        void (*callback) (gpointer),
                                        gpointer callback_data);
 
+void    salut_set_gesture             (Salut *self,
+                                       const GestureRecognizer *gesture,
+                                       void (*callback) (gpointer),
+                                       gpointer callback_data);
+
 void    salut_set_track_data          (Salut *self,
-                                       guint16 *depth,
-                                       guint width,
-                                       guint height,
-                                       SkeltrackJointList list);
+                                       const DepthPyramid *depth,
+                                       const DepthMask *mask,
+                                       SkeltrackJointList list,
+                                       gint64 timestamp);
+
+gboolean salut_needs_depth            (Salut *self);
 
 #endif /* __SALUT_H */
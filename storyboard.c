@@ -32,6 +32,13 @@
 #define DEFAULT_MAX_KNOCK  3
 #define DEFAULT_MAX_SALUTE 5
 
+/* between Kinects standing side by side */
+#define DEFAULT_DEVICE_SPACING 1500 /* millimetres */
+
+/* ids of visitors, the stream's never being either */
+#define NO_VISITOR       0
+#define KEYBOARD_VISITOR G_MAXUINT
+
 #define TOTAL_GESTURES (sizeof (gestures)/sizeof (Gesture))
 
 typedef struct
@@ -126,7 +133,11 @@ struct _Storyboard
   guint knock_count;
   guint salute_count;
 
-  gboolean person_detected;
+  /* the visitors in view, in the order they entered, and the one the
+     story is being told to */
+  GArray *visitors;
+  guint addressed_visitor;
+
   gboolean gesture_detected;
 
   gint gesture_queue[6];
@@ -207,6 +218,16 @@ on_gesture_accomplished (gpointer data)
     }
 }
 
+static void
+on_visitor_gesture (SalutStream *stream, guint visitor_id, gpointer data)
+{
+  Storyboard *self = (Storyboard *) data;
+
+  /* the others are only looking on */
+  if (visitor_id == self->addressed_visitor)
+    on_gesture_accomplished (self);
+}
+
 static void
 set_detect_gesture (Storyboard *self, gboolean detect)
 {
@@ -226,13 +247,10 @@ handle_initial_status (Storyboard *self)
   self->gesture_index = get_next_gesture_index (self);
 
   /* setup salut stream to track person entering */
-  if (self->salut_stream != NULL)
-    {
-      salut_set_gesture_to_track (self->salut_stream->salut,
-                                  gesture_ids[self->gesture_index],
-                                  on_gesture_accomplished,
-                                  self);
-    }
+  salut_stream_set_gesture_to_track (self->salut_stream,
+                                     gesture_ids[self->gesture_index],
+                                     on_visitor_gesture,
+                                     self);
 
   self->gesture_detected = FALSE;
 
@@ -250,7 +268,7 @@ handle_enter_status (Storyboard *self)
 
   self->knock_count = 1;
 
-  if (self->person_detected)
+  if (self->addressed_visitor != NO_VISITOR)
     {
       self->next_status = STATUS_SALUTE;
       self->salute_count = 1;
@@ -269,7 +287,7 @@ handle_knock_status (Storyboard *self)
   /* but we are not interested in gestures yet */
   set_detect_gesture (self, FALSE);
 
-  if (self->person_detected)
+  if (self->addressed_visitor != NO_VISITOR)
     {
       self->next_status = STATUS_SALUTE;
       self->salute_count = 1;
@@ -378,7 +396,7 @@ transition_on_finish (Transition *transition, gpointer user_data)
   switch (self->status)
     {
     case STATUS_ENTER:
-      if (! self->person_detected)
+      if (self->addressed_visitor == NO_VISITOR)
         {
           preload_snippet (self, self->gesture_index, SNIPPET_TYPE_ENTER_KNOCK);
           set_next_snippet (self, self->gesture_index, SNIPPET_TYPE_ENTER_KNOCK);
@@ -417,33 +435,91 @@ transition_on_finish (Transition *transition, gpointer user_data)
     }
 }
 
+/* The nearest of the visitors in view whose head was seen, or else
+   the first of them to have entered */
+static guint
+choose_visitor (Storyboard *self)
+{
+  SkeltrackJoint head;
+  guint chosen = NO_VISITOR;
+  gint nearest = G_MAXINT;
+  guint i;
+
+  for (i = 0; i < self->visitors->len; i++)
+    {
+      guint visitor_id = g_array_index (self->visitors, guint, i);
+
+      if (chosen == NO_VISITOR)
+        chosen = visitor_id;
+
+      if (salut_stream_get_visitor_head (self->salut_stream, visitor_id, &head) &&
+          head.z < nearest)
+        {
+          nearest = head.z;
+          chosen = visitor_id;
+        }
+    }
+
+  return chosen;
+}
+
 static void
-person_entered_scene (Storyboard *self)
+visitor_entered (Storyboard *self, guint visitor_id)
 {
-  if (! self->person_detected)
+  guint i;
+
+  for (i = 0; i < self->visitors->len; i++)
     {
-      g_print ("PERSON ENTERED\n");
+      if (g_array_index (self->visitors, guint, i) == visitor_id)
+        return;
+    }
 
-      self->person_detected = TRUE;
+  g_print ("VISITOR %u ENTERED\n", visitor_id);
+
+  g_array_append_val (self->visitors, visitor_id);
+
+  /* the story is told to one of them at a time */
+  if (self->addressed_visitor == NO_VISITOR)
+    {
+      self->addressed_visitor = visitor_id;
 
       check_status (self);
     }
 }
 
 static void
-person_left_scene (Storyboard *self)
+visitor_left (Storyboard *self, guint visitor_id)
 {
-  if (self->person_detected)
+  guint i;
+
+  for (i = 0; i < self->visitors->len; i++)
     {
-      g_print ("PERSON LEFT\n");
+      if (g_array_index (self->visitors, guint, i) == visitor_id)
+        break;
+    }
 
-      self->person_detected = FALSE;
+  if (i == self->visitors->len)
+    return;
 
-      if (self->status == STATUS_SALUTE)
-        self->salute_count = self->max_salute;
+  g_print ("VISITOR %u LEFT\n", visitor_id);
 
-      check_status (self);
+  g_array_remove_index (self->visitors, i);
+
+  if (visitor_id != self->addressed_visitor)
+    return;
+
+  /* the story goes on for whoever else is nearest */
+  self->addressed_visitor = choose_visitor (self);
+  if (self->addressed_visitor != NO_VISITOR)
+    {
+      g_print ("ADDRESSING VISITOR %u\n", self->addressed_visitor);
+      return;
     }
+
+  if (self->status == STATUS_SALUTE)
+    self->salute_count = self->max_salute;
+
+  check_status (self);
 }
 
 static void
@@ -457,11 +533,11 @@ stage_on_key_pressed (ClutterActor *actor,
   switch (key)
     {
     case CLUTTER_KEY_Return:
-      person_entered_scene (self);
+      visitor_entered (self, KEYBOARD_VISITOR);
       break;
 
     case CLUTTER_KEY_Escape:
-      person_left_scene (self);
+      visitor_left (self, KEYBOARD_VISITOR);
       break;
 
     case CLUTTER_KEY_space:
@@ -470,27 +546,34 @@ stage_on_key_pressed (ClutterActor *actor,
 }
 
 static void
-on_person_entered_cb (SalutStream *stream, gpointer data)
+on_visitor_entered_cb (SalutStream *stream, guint visitor_id, gpointer data)
 {
   Storyboard *self;
   self = (Storyboard *) data;
 
-  person_entered_scene (self);
+  visitor_entered (self, visitor_id);
 }
 
 static void
-on_person_left_cb (SalutStream *stream, gpointer data)
+on_visitor_left_cb (SalutStream *stream, guint visitor_id, gpointer data)
 {
   Storyboard *self;
   self = (Storyboard *) data;
 
-  person_left_scene (self);
+  visitor_left (self, visitor_id);
 }
 
 static void
 on_salut_stream_ready (SalutStream *stream, gpointer data)
 {
   Storyboard *self = data;
+  const gchar *record_path;
+  const gchar *budget, *jobs, *interval;
+  const gchar *sampling_name;
+  DepthSampling sampling;
+  const gchar *spacing, *threads, *visitors;
+  guint i;
+  GError *error = NULL;
 
   if (stream == NULL)
     {
@@ -507,17 +590,81 @@ on_salut_stream_ready (SalutStream *stream, gpointer data)
 
   salut_stream_set_person_lookup_seconds (self->salut_stream, 1000);
   salut_stream_set_depth_threshold (self->salut_stream, 2000);
-  salut_stream_set_person_entered_cb (self->salut_stream,
-                                      on_person_entered_cb,
-                                      self);
-  salut_stream_set_person_left_cb (self->salut_stream,
-                                   on_person_left_cb,
-                                   self);
-
-  salut_set_gesture_to_track (self->salut_stream->salut,
-                              gesture_ids[self->gesture_index],
-                              on_gesture_accomplished,
-                              self);
+  salut_stream_set_temporal_filter (self->salut_stream,
+                                    g_getenv ("MSPT_DEPTH_FILTER") != NULL);
+  salut_stream_set_background_subtraction (self->salut_stream,
+                                           g_getenv ("MSPT_DEPTH_NO_BACKGROUND") == NULL);
+  salut_stream_set_visitor_isolation (self->salut_stream,
+                                      g_getenv ("MSPT_DEPTH_ALL_VISITORS") == NULL);
+  visitors = g_getenv ("MSPT_MAX_VISITORS");
+  if (visitors != NULL)
+    {
+      salut_stream_set_max_visitors (self->salut_stream,
+                                     g_ascii_strtoull (visitors, NULL, 10));
+    }
+  sampling_name = g_getenv ("MSPT_DEPTH_SAMPLING");
+  if (sampling_name != NULL)
+    {
+      if (depth_process_sampling_from_string (sampling_name, &sampling))
+        salut_stream_set_sampling (self->salut_stream, sampling);
+      else
+        g_warning ("Unknown depth sampling '%s'", sampling_name);
+    }
+  threads = g_getenv ("MSPT_DEPTH_THREADS");
+  if (threads != NULL)
+    {
+      salut_stream_set_preprocessing_threads (self->salut_stream,
+                                              g_ascii_strtoull (threads, NULL, 10));
+    }
+  spacing = g_getenv ("MSPT_DEPTH_DEVICE_SPACING");
+  for (i = 1; i < salut_stream_get_n_sensors (self->salut_stream); i++)
+    {
+      salut_stream_set_sensor_offset (self->salut_stream,
+                                      i,
+                                      i * (spacing != NULL ?
+                                           g_ascii_strtoll (spacing, NULL, 10) :
+                                           DEFAULT_DEVICE_SPACING));
+    }
+  budget = g_getenv ("MSPT_TRACKING_BUDGET");
+  if (budget != NULL)
+    {
+      salut_stream_set_tracking_budget (self->salut_stream,
+                                        g_ascii_strtoull (budget, NULL, 10));
+    }
+  interval = g_getenv ("MSPT_TRACKING_INTERVAL");
+  if (interval != NULL)
+    {
+      salut_stream_set_tracking_interval (self->salut_stream,
+                                          g_ascii_strtoull (interval, NULL, 10));
+    }
+  jobs = g_getenv ("MSPT_TRACKING_JOBS");
+  if (jobs != NULL)
+    {
+      salut_stream_set_tracking_jobs (self->salut_stream,
+                                      g_ascii_strtoull (jobs, NULL, 10));
+    }
+  salut_stream_set_visitor_entered_cb (self->salut_stream,
+                                       on_visitor_entered_cb,
+                                       self);
+  salut_stream_set_visitor_left_cb (self->salut_stream,
+                                    on_visitor_left_cb,
+                                    self);
+
+  salut_stream_set_gesture_to_track (self->salut_stream,
+                                     gesture_ids[self->gesture_index],
+                                     on_visitor_gesture,
+                                     self);
+
+  record_path = g_getenv ("MSPT_DEPTH_RECORD");
+  if (record_path != NULL &&
+      ! salut_stream_start_recording (self->salut_stream,
+                                      record_path,
+                                      g_getenv ("MSPT_DEPTH_RECORD_RAW") == NULL,
+                                      &error))
+    {
+      g_print ("Error starting depth recording: %s\n", error->message);
+      g_error_free (error);
+    }
 
   salut_stream_start (self->salut_stream);
 }
@@ -529,11 +676,16 @@ storyboard_new (const gchar *snippets_path)
 {
   Storyboard *self;
   ClutterColor bg_color = {200, 200, 200, 255};
+  const gchar *replay_path;
+  const gchar *synth_motion;
+  const gchar *gestures_path;
+  GError *error = NULL;
 
   self = g_slice_new0 (Storyboard);
 
   self->max_knock = DEFAULT_MAX_KNOCK;
   self->max_salute = DEFAULT_MAX_SALUTE;
+  self->visitors = g_array_new (FALSE, FALSE, sizeof (guint));
   self->gesture_index = g_random_int_range (0, TOTAL_GESTURES-1);
 
   if (g_strstr_len (snippets_path, -1, "file://") != snippets_path)
@@ -562,8 +714,61 @@ storyboard_new (const gchar *snippets_path)
                                      transition_on_finish,
                                      self);
 
-  /* salut stream */
-  salut_stream_new (on_salut_stream_ready, self);
+  /* before any visitor tracks them */
+  gestures_path = g_getenv ("MSPT_GESTURES");
+  if (gestures_path != NULL &&
+      ! gesture_table_load_file (gesture_table_get_default (),
+                                 gestures_path,
+                                 &error))
+    {
+      g_warning ("Failed to load gestures, using the built-in ones: %s",
+                 error->message);
+      g_error_free (error);
+    }
+
+  /* salut stream, optionally replaying a recorded session */
+  replay_path = g_getenv ("MSPT_DEPTH_REPLAY");
+  if (replay_path != NULL)
+    {
+      salut_stream_new_from_recording (replay_path,
+                                       g_getenv ("MSPT_DEPTH_REPLAY_FULL_SPEED") == NULL,
+                                       on_salut_stream_ready,
+                                       self);
+    }
+  else if ((synth_motion = g_getenv ("MSPT_DEPTH_SYNTH")) != NULL)
+    {
+      DepthSynth *synth;
+      DepthSynthMotion motion;
+      const gchar *fps;
+
+      if (! depth_synth_motion_from_string (synth_motion, &motion))
+        {
+          g_print ("Unknown synthetic motion '%s', using 'all'\n", synth_motion);
+          motion = DEPTH_SYNTH_MOTION_ALL;
+        }
+
+      /* the size of the Kinect's depth frames */
+      synth = depth_synth_new (640, 480);
+      depth_synth_set_motion (synth, motion);
+      depth_synth_set_disparity (synth, g_getenv ("MSPT_DEPTH_DISPARITY") != NULL);
+
+      fps = g_getenv ("MSPT_DEPTH_SYNTH_FPS");
+      salut_stream_new_synthetic (synth,
+                                  fps != NULL ? g_ascii_strtoull (fps, NULL, 10) : DEPTH_SYNTH_FPS,
+                                  on_salut_stream_ready,
+                                  self);
+    }
+  else
+    {
+      const gchar *devices;
+
+      devices = g_getenv ("MSPT_DEPTH_DEVICES");
+      salut_stream_new_with_devices (devices != NULL ?
+                                     MAX (g_ascii_strtoull (devices, NULL, 10), 1) : 1,
+                                     g_getenv ("MSPT_DEPTH_DISPARITY") != NULL,
+                                     on_salut_stream_ready,
+                                     self);
+    }
 
   g_object_unref (self->stage);
 
@@ -579,6 +784,7 @@ void
 storyboard_free (Storyboard *self)
 {
   g_free (self->snippets_path);
+  g_array_free (self->visitors, TRUE);
 
   g_signal_handlers_disconnect_by_func (self->stage,
                                         clutter_main_quit,